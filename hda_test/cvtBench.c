@@ -0,0 +1,236 @@
+/* cvtBench.c - OSS Audio sample conversion benchmark for the build host */
+
+/* Copyright 2012 Wind River Systems, Inc. */
+
+/*
+
+DESCRIPTION
+
+This program times the sample format conversion kernels of ossConvert.c on
+the development host.  For every entry of the playback and capture tables
+it checks the kernel against the byte by byte ossCvtGeneric() or
+ossCapGeneric() path and reports the rate of both in megabytes of
+application data per second.  Capture kernels read an 8 channel ring;
+the extracting ones keep two of the channels.
+
+The program is built and run on the host, not on the target:
+
+    cc -O2 -o cvtBench hda_test/cvtBench.c
+    ./cvtBench [megabytes]
+
+<megabytes> is the amount of input converted per kernel, 256 by default.
+For scale: 48 kHz 8 channel S32 playback is 1.5 MB/s.
+
+*/
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/* host stand-ins for the VxWorks types ossConvert.c uses */
+
+typedef uint8_t         UINT8;
+typedef int16_t         INT16;
+typedef uint16_t        UINT16;
+typedef int32_t         INT32;
+typedef uint32_t        UINT32;
+typedef unsigned long   ULONG;
+typedef int             BOOL;
+
+#define LOCAL           static
+#define FALSE           0
+#define TRUE            1
+#define NELEMENTS(a)    (sizeof(a) / sizeof((a)[0]))
+
+#define _LITTLE_ENDIAN  1234
+#define _BIG_ENDIAN     4321
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define _BYTE_ORDER     _BIG_ENDIAN
+#else
+#define _BYTE_ORDER     _LITTLE_ENDIAN
+#endif
+
+#define AFMT_U8         0x00000008
+#define AFMT_S16_LE     0x00000010
+#define AFMT_S32_LE     0x00001000
+
+#define OSS_CVT_HOST
+#include "../hda_vxbus/ossConvert.c"
+
+/* defines */
+
+#define CVT_BENCH_SAMPLES   (16 * 1024)  /* input samples per call */
+#define CVT_BENCH_MB        256
+#define CVT_BENCH_HWCHANNELS 8          /* channels of a capture ring */
+
+LOCAL double cvtBenchNow (void)
+    {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+/* fill the input with full scale values, floats within [-1, 1] */
+
+LOCAL void cvtBenchFill (int afmt, UINT8 * buf, size_t bytes)
+    {
+    size_t i;
+
+    if (afmt == AFMT_FLOAT)
+        {
+        float * f = (float *)buf;
+
+        for (i = 0; i < bytes / sizeof(float); i++)
+            f[i] = (float)((rand () % 20001) - 10000) / 9000.0f;
+        return;
+        }
+
+    for (i = 0; i < bytes; i++)
+        buf[i] = (UINT8)rand ();
+    }
+
+LOCAL double cvtBenchRate
+    (
+    const OSS_CVT * cvt,
+    BOOL generic,
+    void * dst,
+    const void * src,
+    size_t total
+    )
+    {
+    size_t bytes = CVT_BENCH_SAMPLES * ossCvtSampleSize (cvt->afmt);
+    size_t done;
+    double start;
+
+    start = cvtBenchNow ();
+    for (done = 0; done < total; done += bytes)
+        {
+        if (generic)
+            ossCvtGeneric (cvt, dst, src, CVT_BENCH_SAMPLES);
+        else
+            cvt->func (dst, src, CVT_BENCH_SAMPLES);
+        }
+
+    return (done / (1024.0 * 1024.0)) / (cvtBenchNow () - start);
+    }
+
+LOCAL double capBenchRate
+    (
+    const OSS_CAP * cap,
+    BOOL generic,
+    void * dst,
+    const void * src,
+    int hwchannels,
+    int channels,
+    size_t total
+    )
+    {
+    UINT32 frames = CVT_BENCH_SAMPLES / hwchannels;
+    size_t bytes = frames * channels * ossCvtSampleSize (cap->afmt);
+    size_t done;
+    double start;
+
+    start = cvtBenchNow ();
+    for (done = 0; done < total; done += bytes)
+        {
+        if (generic)
+            ossCapGeneric (cap, dst, src, frames, hwchannels, channels);
+        else
+            cap->func (dst, src, frames, hwchannels, channels);
+        }
+
+    return (done / (1024.0 * 1024.0)) / (cvtBenchNow () - start);
+    }
+
+int main (int argc, char ** argv)
+    {
+    size_t total = (size_t)CVT_BENCH_MB * 1024 * 1024;
+    size_t outBytes = CVT_BENCH_SAMPLES * 2 * sizeof(INT32);
+    const OSS_CVT * cvt;
+    const OSS_CAP * cap;
+    UINT8 * src;
+    UINT8 * dst;
+    UINT8 * ref;
+    int failed = 0;
+    int i;
+
+    if (argc > 1)
+        total = (size_t)atoi (argv[1]) * 1024 * 1024;
+
+    src = malloc (CVT_BENCH_SAMPLES * sizeof(INT32));
+    dst = malloc (outBytes);
+    ref = malloc (outBytes);
+    if ((src == NULL) || (dst == NULL) || (ref == NULL))
+        {
+        printf ("cvtBench: out of memory\n");
+        return 1;
+        }
+
+    printf ("%-12s %12s %12s %8s\n", "kernel", "MB/s", "generic", "speedup");
+
+    for (i = 0; (cvt = ossCvtTable (i)) != NULL; i++)
+        {
+        size_t outLen = CVT_BENCH_SAMPLES * (cvt->mono ? 2 : 1) *
+                        ((cvt->hwfmt == AFMT_S32_LE) ? 4 : 2);
+        double fast, slow;
+
+        cvtBenchFill (cvt->afmt, src, CVT_BENCH_SAMPLES * sizeof(INT32));
+
+        cvt->func (dst, src, CVT_BENCH_SAMPLES);
+        ossCvtGeneric (cvt, ref, src, CVT_BENCH_SAMPLES);
+        if (memcmp (dst, ref, outLen) != 0)
+            {
+            printf ("%-12s mismatch against ossCvtGeneric()\n", cvt->name);
+            failed++;
+            continue;
+            }
+
+        fast = cvtBenchRate (cvt, FALSE, dst, src, total);
+        slow = cvtBenchRate (cvt, TRUE, dst, src, total);
+
+        printf ("%-12s %12.1f %12.1f %7.1fx\n", cvt->name, fast, slow, fast / slow);
+        }
+
+    for (i = 0; (cap = ossCapTable (i)) != NULL; i++)
+        {
+        int hwchannels = CVT_BENCH_HWCHANNELS;
+        int channels = hwchannels;
+        UINT32 frames = CVT_BENCH_SAMPLES / hwchannels;
+        size_t outLen;
+        double fast, slow;
+
+        if (cap->mode == OSS_CAP_MONO)
+            channels = 1;
+        else if (cap->mode == OSS_CAP_EXTRACT)
+            channels = 2;
+
+        outLen = frames * channels * ossCvtSampleSize (cap->afmt);
+
+        cvtBenchFill (0, src, CVT_BENCH_SAMPLES * sizeof(INT32));
+
+        cap->func (dst, src, frames, hwchannels, channels);
+        ossCapGeneric (cap, ref, src, frames, hwchannels, channels);
+        if (memcmp (dst, ref, outLen) != 0)
+            {
+            printf ("%-12s mismatch against ossCapGeneric()\n", cap->name);
+            failed++;
+            continue;
+            }
+
+        fast = capBenchRate (cap, FALSE, dst, src, hwchannels, channels, total);
+        slow = capBenchRate (cap, TRUE, dst, src, hwchannels, channels, total);
+
+        printf ("%-12s %12.1f %12.1f %7.1fx\n", cap->name, fast, slow, fast / slow);
+        }
+
+    free (src);
+    free (dst);
+    free (ref);
+
+    return (failed != 0);
+    }
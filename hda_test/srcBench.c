@@ -0,0 +1,197 @@
+/* srcBench.c - OSS Audio resampler benchmark for the build host */
+
+/* Copyright 2012 Wind River Systems, Inc. */
+
+/*
+
+DESCRIPTION
+
+This program times the polyphase resampler of ossResample.c on the
+development host.  For a set of rate pairs and every quality it resamples
+a stereo 1 kHz sine at -6 dBFS and reports:
+
+    us/s/ch   CPU microseconds per second of audio and per channel
+    %cpu/ch   the same as a share of one CPU
+    SNR       signal to noise and distortion of the output against the
+              ideal sine, in dB
+
+The program is built and run on the host, not on the target:
+
+    cc -O2 -o srcBench hda_test/srcBench.c
+    ./srcBench [seconds]
+
+<seconds> is the length of audio resampled per measurement, 60 by default.
+
+*/
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+/* host stand-ins for the VxWorks types ossResample.c uses */
+
+typedef uint8_t         UINT8;
+typedef int16_t         INT16;
+typedef uint16_t        UINT16;
+typedef int32_t         INT32;
+typedef uint32_t        UINT32;
+typedef int64_t         INT64;
+typedef uint64_t        UINT64;
+typedef int             BOOL;
+
+#define LOCAL           static
+#define FALSE           0
+#define TRUE            1
+#define MIN(a,b)        ((a) < (b) ? (a) : (b))
+
+#define OSS_CVT_HOST
+#include "../hda_vxbus/ossResample.c"
+
+/* defines */
+
+#define SRC_BENCH_SECONDS   60
+#define SRC_BENCH_CHANNELS  2
+#define SRC_BENCH_TONE      1000.0
+#define SRC_BENCH_LEVEL     0.5
+
+LOCAL const struct
+    {
+    int inRate;
+    int outRate;
+    } srcBenchRates[] =
+    {
+    { 44100, 48000 },           /* CD audio to the HD Audio base rate */
+    { 22050, 48000 },
+    {  8000, 48000 },           /* telephony playback */
+    { 48000, 44100 },
+    { 96000, 48000 },
+    { 48000,  8000 },           /* telephony capture */
+    { 12345, 48000 },           /* needs the rounded phase count */
+    };
+
+LOCAL const char * srcBenchQuality[] = { "low", "medium", "high" };
+
+LOCAL double srcBenchNow (void)
+    {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+/*
+ * Resample seconds of sine at inRate.  Returns the CPU seconds spent and
+ * the SNR of the output against the ideal sine at the output positions.
+ */
+
+LOCAL double srcBenchRun
+    (
+    int inRate,
+    int outRate,
+    int quality,
+    double seconds,
+    double * pSnr
+    )
+    {
+    OSS_RS * rs;
+    INT32 * in;
+    UINT32 inFrames = (UINT32)(seconds * inRate);
+    UINT32 done, n, k, i;
+    UINT64 outIndex = 0;
+    double signal = 0.0, noise = 0.0;
+    double elapsed = 0.0, start, ref, y, t;
+    int ch;
+
+    rs = ossRsCreate (inRate, outRate, SRC_BENCH_CHANNELS, quality);
+    in = malloc (OSS_RS_BLOCK * SRC_BENCH_CHANNELS * sizeof(INT32));
+    if ((rs == NULL) || (in == NULL))
+        {
+        printf ("srcBench: cannot create %d -> %d\n", inRate, outRate);
+        exit (1);
+        }
+
+    for (done = 0; done < inFrames; done += n)
+        {
+        n = MIN(MIN(ossRsRoom (rs), OSS_RS_BLOCK), inFrames - done);
+
+        for (k = 0; k < n; k++)
+            {
+            t = (double)(done + k) / inRate;
+            for (ch = 0; ch < SRC_BENCH_CHANNELS; ch++)
+                in[k * SRC_BENCH_CHANNELS + ch] = (INT32)(SRC_BENCH_LEVEL * 2147483647.0 *
+                                                  sin (2 * M_PI * SRC_BENCH_TONE * t));
+            }
+
+        start = srcBenchNow ();
+        memcpy (ossRsTail (rs), in, n * SRC_BENCH_CHANNELS * sizeof(INT32));
+        ossRsProcess (rs, n);
+        elapsed += srcBenchNow () - start;
+
+        /* output i sits at input frame i * step / phases; skip the ramp up */
+
+        for (i = 0; i < rs->outLen; i++, outIndex++)
+            {
+            if (outIndex < (UINT64)rs->taps * rs->phases / rs->step + rs->taps)
+                continue;
+
+            t = ((double)outIndex * rs->step / rs->phases) / inRate;
+            ref = SRC_BENCH_LEVEL * sin (2 * M_PI * SRC_BENCH_TONE * t);
+            for (ch = 0; ch < SRC_BENCH_CHANNELS; ch++)
+                {
+                y = rs->out[i * SRC_BENCH_CHANNELS + ch] / 2147483648.0;
+                signal += ref * ref;
+                noise += (y - ref) * (y - ref);
+                }
+            }
+        }
+
+    *pSnr = 10.0 * log10 (signal / noise);
+
+    ossRsDelete (rs);
+    free (in);
+
+    return elapsed;
+    }
+
+int main (int argc, char ** argv)
+    {
+    double seconds = SRC_BENCH_SECONDS;
+    double cpu, snr, usPerCh;
+    int i, q;
+
+    if (argc > 1)
+        seconds = atof (argv[1]);
+
+    printf ("%-14s %-7s %5s %7s %10s %9s %7s\n",
+            "rates", "quality", "taps", "phases", "us/s/ch", "%cpu/ch", "SNR");
+
+    for (i = 0; i < (int)(sizeof(srcBenchRates) / sizeof(srcBenchRates[0])); i++)
+        {
+        for (q = OSS_RS_LOW; q <= OSS_RS_HIGH; q++)
+            {
+            OSS_RS * rs = ossRsCreate (srcBenchRates[i].inRate,
+                                       srcBenchRates[i].outRate,
+                                       SRC_BENCH_CHANNELS, q);
+            char rates[32];
+
+            cpu = srcBenchRun (srcBenchRates[i].inRate, srcBenchRates[i].outRate,
+                               q, seconds, &snr);
+            usPerCh = cpu * 1e6 / (seconds * SRC_BENCH_CHANNELS);
+
+            snprintf (rates, sizeof(rates), "%d->%d",
+                      srcBenchRates[i].inRate, srcBenchRates[i].outRate);
+            printf ("%-14s %-7s %5d %7u %10.1f %8.3f%% %6.1f\n",
+                    rates, srcBenchQuality[q], rs->taps, rs->phases,
+                    usPerCh, usPerCh / 1e4, snr);
+
+            ossRsDelete (rs);
+            }
+        }
+
+    return 0;
+    }
@@ -20,6 +20,9 @@ modification history
 
 #include <hwif/util/vxbDmaBufLib.h>
 
+#include "ossConvert.h"
+#include "ossResample.h"
+
 /* device driver prototype */
 
 #ifdef _WRS_CONFIG_LP64
@@ -29,6 +32,30 @@ modification history
 #endif  /*_WRS_CONFIG_LP64*/
 
 
+/*
+ * Driver private: bound the time read() and write() wait for a fragment,
+ * in milliseconds.  A negative value waits forever, which is the default.
+ * A transfer that times out returns what it moved, or fails with EAGAIN.
+ */
+
+#define SNDCTL_DSP_SETTIMEOUT   _SIOW ('P', 0x80, int)
+
+/*
+ * Driver private: the filter length of the resampler that serves rates the
+ * codec lacks, OSS_RS_LOW, OSS_RS_MEDIUM or OSS_RS_HIGH.  The value in
+ * effect is returned.
+ */
+
+#define SNDCTL_DSP_SRCQUALITY   _SIOWR ('P', 0x81, int)
+
+/* virtual playback channels, mixed into the hardware one by a task */
+
+#define OSS_VCHAN_MAX           8       /* most virtual channels per device */
+#define OSS_VMIX_CHANNELS       2       /* channels of the mix */
+#define OSS_VMIX_TASK_NAME      "tOssMix"
+#define OSS_VMIX_TASK_PRI       40      /* ahead of the tasks that write */
+#define OSS_VMIX_TASK_STACK     4096
+
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
@@ -46,6 +73,7 @@ typedef struct snd_mixer
     } SND_MIXER;
 
 struct pcm_channel;
+struct oss_vmix;
 struct snd_buf;
 
 typedef struct snd_buf
@@ -56,13 +84,14 @@ typedef struct snd_buf
     UINT32              blksz;
     UINT32              blkcnt;
     caddr_t             buf;
-    int                 head;
-    int                 tail;
+    int                 head;   /* ring offset of the application side */
+    volatile int        tail;   /* ring offset of the engine side */
+    UINT32              hcount; /* bytes moved by the application */
+    volatile UINT32     tcount; /* bytes moved by the engine */
     VXB_DMA_TAG_ID      dma_tag;
     VXB_DMA_MAP_ID      dma_map;
     int                 dma_flags;
     void               *buf_addr;
-    void               *shadow_buf_addr;
     struct pcm_channel *channel;
     } SND_BUF;
 
@@ -89,6 +118,8 @@ typedef struct pcmchan_caps
 #define CHAN_STATE_RUNNING       0x00000001
 #define CHAN_FLAG_ENABLE         0x00000010
 #define CHAN_FLAG_TRIGGER        0x00000020
+#define CHAN_FLAG_MMAP           0x00000040     /* ring mapped by the application */
+#define CHAN_FLAG_GONE           0x00000080     /* device deleted under an open descriptor */
 
 #define CHANNEL_ONE 0
 #define CHANNEL_TWO 1
@@ -100,15 +131,26 @@ typedef struct pcm_channel
     int                 dir;
     int                 channels; /* selected number of audio channels */
     int                 rate;   /* selected sample rate */
+    int                 hwrate; /* rate the codec runs at */
+    int                 quality; /* resampler quality, OSS_RS_LOW..OSS_RS_HIGH */
     int                 afmt;   /* selected format */
     int                 afmts;  /* supported formats */
+    int                 hwfmt;  /* ring format, AFMT_S16_LE or AFMT_S32_LE */
+    int                 hwchannels; /* channels in the ring, at least 2 */
+    const OSS_CVT *     cvt;    /* playback conversion to the ring format */
+    const OSS_CAP *     cap;    /* capture conversion from the ring format */
+    OSS_RS *            rs;     /* resampler when rate and hwrate differ */
+    struct pcm_channel * parent; /* hardware channel a virtual one is mixed into */
+    int                 volume; /* virtual channel: left | right << 8, 0..100 */
     audio_buf_info      abinfo; /* frag and buffer information */
     struct snd_buf *    sndbuf; /* circular sample buffer */
     void *              stream; /* opaque pointer used by drivers */
-    SEM_ID              sem;    /* counting semaphore */
+    SEM_ID              sem;    /* given when the ring crosses a threshold */
     SEM_ID              msem;   /* mutex semaphore */
-    int                 semcnt; /* initial count for CSem */
+    SEL_WAKEUP_LIST *   selList; /* select() waiters on the device */
     UINT32              flags;  /* flags and options */
+    volatile UINT32     blocks; /* fragments completed by the DMA engine */
+    UINT32              blocks_seen; /* blocks reported by GETIPTR/GETOPTR */
     } PCM_CHANNEL;
 
 /* commands */
@@ -142,8 +184,13 @@ typedef struct dsp_t
     int                 num_chan;
     PCM_CHANNEL *       channel;
     SEL_WAKEUP_LIST     selWakeupList;	/* list of tasks pended in select */
+    struct oss_vmix *   vmix;   /* mixer of the virtual playback channels */
     } DSP_DEV;
 
+/* DSP_FD flags */
+
+#define DSP_FD_NONBLOCK         0x00000001      /* O_NONBLOCK or SNDCTL_DSP_NONBLOCK */
+
 typedef struct dsp_fd
     {
     NODE                fdNode;
@@ -151,6 +198,7 @@ typedef struct dsp_fd
     PCM_CHANNEL *       play;
     PCM_CHANNEL *       record;
     UINT32              flags; /* flags and options */
+    int                 timeout; /* ticks read/write wait for a fragment */
     } DSP_FD;
 
 typedef struct mixer_fd
@@ -169,6 +217,7 @@ METHOD_DECL(pcm_channel_stop);
 METHOD_DECL(pcm_channel_trigger);
 METHOD_DECL(pcm_channel_getptr);
 METHOD_DECL(pcm_channel_getcaps);
+METHOD_DECL(pcm_channel_getfifo);
 
 METHOD_DECL(mixer_init);
 METHOD_DECL(mixer_set);
@@ -190,6 +239,15 @@ extern int ossmixer_setrecsrc (SND_MIXER *m, unsigned int src);
 extern int ossmixer_set (SND_MIXER *m, unsigned int dev, unsigned int level);
 extern int ossmixer_get (SND_MIXER *m, unsigned int dev);
 
+extern int ossVchanMax;
+extern struct oss_vmix * ossVmixCreate (DSP_DEV * pDspDev, PCM_CHANNEL * hw);
+extern void ossVmixDelete (struct oss_vmix * vmix);
+extern PCM_CHANNEL * ossVchanCreate (struct oss_vmix * vmix);
+extern void ossVchanDelete (PCM_CHANNEL * pChan);
+extern STATUS ossVchanTrigger (PCM_CHANNEL * pChan, int go);
+extern int ossVchanSetFragments (PCM_CHANNEL * pChan, UINT32 blksz, UINT32 blkcnt);
+extern UINT32 ossVchanDelay (PCM_CHANNEL * pChan);
+
 extern STATUS sndbuf_alloc (SND_BUF *b, VXB_DMA_TAG_ID dmatag, int dmaflags, unsigned int size);
 extern STATUS sndbuf_resize(SND_BUF *b, unsigned int blkcnt, unsigned int blksz);
 extern SND_BUF* sndbuf_create(VXB_DEVICE_ID dev, struct pcm_channel *channel);
@@ -197,6 +255,10 @@ extern void sndbuf_destroy(SND_BUF *b);
 extern size_t sndbuf_copy (const char *source, SND_BUF * b, size_t nbytes);
 extern size_t sndbuf_read (char *dest, SND_BUF * b, size_t nbytes);
 extern void sndbuf_reset(SND_BUF *b);
+extern UINT32 sndbuf_getfree (SND_BUF *b);
+extern UINT32 sndbuf_getready (SND_BUF *b);
+extern UINT32 sndbuf_getseg (SND_BUF *b, int dir, caddr_t *pAddr, UINT32 *pLevel);
+extern void sndbuf_advance (SND_BUF *b, UINT32 nbytes);
 
 #define sndbuf_getsize(b) (b->bufsize)
 #define sndbuf_getblksz(b) (b->blksz)
@@ -0,0 +1,99 @@
+/* ossConvert.h - OSS Audio sample format conversion header */
+
+/*
+ * Copyright (c) 2012 Wind River Systems, Inc.
+ *
+ * The right to copy, distribute, modify or otherwise make use
+ * of this software may be licensed only pursuant to the terms
+ * of an applicable Wind River license agreement.
+ */
+
+#ifndef __INCossConverth
+#define __INCossConverth
+
+/*
+ * The conversion kernels, the resampler and the rest of the OSS layer run
+ * in whatever task calls read(), write() or ioctl(), and VxWorks preserves
+ * floating point and vector registers only for tasks spawned with
+ * VX_FP_TASK.  Auto-vectorization would put the integer loops in those
+ * registers, so it is turned off for every file including this header.
+ * The AFMT_FLOAT kernels are the one remaining use and need a VX_FP_TASK
+ * caller, as any task producing float samples does.  The mixer task of
+ * ossVchan.c is spawned with VX_FP_TASK and uses SIMD explicitly.
+ */
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("no-tree-vectorize")
+#endif
+
+/* OSS 4 encodings that older soundcard.h headers lack */
+
+#ifndef AFMT_S24_LE
+#define AFMT_S24_LE             0x00008000  /* 24 bit in the low bytes of 32 */
+#endif
+
+#ifndef AFMT_FLOAT
+#define AFMT_FLOAT              0x00004000  /* native float, full scale 1.0 */
+#endif
+
+#ifndef AFMT_S24_PACKED
+#define AFMT_S24_PACKED         0x20000000  /* 24 bit in 3 bytes */
+#endif
+
+/* encodings ossAudioWrite() and ossAudioRead() convert */
+
+#define OSS_CVT_FMTS            (AFMT_U8 | AFMT_S16_LE | AFMT_S24_LE |  \
+                                 AFMT_S24_PACKED | AFMT_S32_LE | AFMT_FLOAT)
+
+/*
+ * A conversion kernel reads a number of application samples from src
+ * and writes them to dst in the ring format; a mono kernel writes every
+ * sample twice.
+ */
+
+typedef void (*OSS_CVT_FUNC) (void * dst, const void * src, UINT32 samples);
+
+typedef struct oss_cvt
+    {
+    int                 afmt;   /* application encoding */
+    BOOL                mono;   /* application mono, ring stereo */
+    int                 hwfmt;  /* ring encoding, AFMT_S16_LE or AFMT_S32_LE */
+    OSS_CVT_FUNC        func;   /* kernel for native order, aligned input */
+    const char *        name;
+    } OSS_CVT;
+
+/*
+ * A capture kernel converts a number of ring frames of hwchannels samples
+ * to application frames of channels samples.
+ */
+
+typedef void (*OSS_CAP_FUNC) (void * dst, const void * src, UINT32 frames,
+                              int hwchannels, int channels);
+
+#define OSS_CAP_SAME            0   /* every ring channel */
+#define OSS_CAP_MONO            1   /* average of the first two channels */
+#define OSS_CAP_EXTRACT         2   /* the first channels of every frame */
+
+typedef struct oss_cap
+    {
+    int                 hwfmt;  /* ring encoding, AFMT_S16_LE or AFMT_S32_LE */
+    int                 afmt;   /* application encoding */
+    int                 mode;   /* OSS_CAP_SAME, OSS_CAP_MONO or OSS_CAP_EXTRACT */
+    OSS_CAP_FUNC        func;   /* kernel for native order, aligned output */
+    const char *        name;
+    } OSS_CAP;
+
+extern const OSS_CVT * ossCvtFind (int afmt, int channels, int hwfmt);
+extern const OSS_CVT * ossCvtTable (int index);
+extern int ossCvtHwFormat (int afmt);
+extern int ossCvtSampleSize (int afmt);
+extern void ossCvtRun (const OSS_CVT * cvt, void * dst, const void * src, UINT32 samples);
+extern void ossCvtGeneric (const OSS_CVT * cvt, void * dst, const void * src, UINT32 samples);
+extern const OSS_CAP * ossCapFind (int hwfmt, int hwchannels, int afmt, int channels);
+extern const OSS_CAP * ossCapTable (int index);
+extern void ossCapRun (const OSS_CAP * cap, void * dst, const void * src, UINT32 frames,
+                       int hwchannels, int channels);
+extern void ossCapGeneric (const OSS_CAP * cap, void * dst, const void * src, UINT32 frames,
+                           int hwchannels, int channels);
+
+#endif /* __INCossConverth */
@@ -0,0 +1,59 @@
+/* ossResample.h - OSS Audio sample rate converter header */
+
+/*
+ * Copyright (c) 2012 Wind River Systems, Inc.
+ *
+ * The right to copy, distribute, modify or otherwise make use
+ * of this software may be licensed only pursuant to the terms
+ * of an applicable Wind River license agreement.
+ */
+
+#ifndef __INCossResampleh
+#define __INCossResampleh
+
+#include "ossConvert.h"
+
+/* filter length for each quality, times the decimation factor */
+
+#define OSS_RS_LOW              0       /*  8 taps */
+#define OSS_RS_MEDIUM           1       /* 16 taps */
+#define OSS_RS_HIGH             2       /* 32 taps */
+#define OSS_RS_QUALITY_DEFAULT  OSS_RS_MEDIUM
+
+#define OSS_RS_BLOCK            256     /* input frames taken per pass */
+#define OSS_RS_PHASES_MAX       1024    /* filter phases, bounds the table */
+#define OSS_RS_RATIO_MAX        16      /* widest rate ratio either way */
+
+/*
+ * Polyphase resampler for interleaved, left justified 32 bit frames.  The
+ * input rate is outRate * step / phases; each output frame is the dot
+ * product of taps input frames with one phase of the filter.
+ */
+
+typedef struct oss_rs
+    {
+    int                 channels;
+    int                 taps;
+    UINT32              phases; /* filter phases, L */
+    UINT32              step;   /* phases advanced per output frame, M */
+    UINT32              phase;  /* phase of the next output frame */
+    INT32 *             coef;   /* phases x taps, Q24, unity gain per phase */
+    INT32 *             in;     /* input frames, history first */
+    UINT32              fill;   /* frames in in[] */
+    UINT32              pos;    /* first input frame of the next output */
+    INT32 *             out;    /* resampled frames not yet handed on */
+    UINT32              outCap; /* frames out[] holds */
+    UINT32              outLen; /* frames in out[] */
+    UINT32              outPos; /* frames of out[] handed on */
+    const OSS_CVT *     cvt;    /* playback: application format to 32 bit */
+    const OSS_CAP *     cap;    /* capture: 32 bit to application format */
+    } OSS_RS;
+
+extern OSS_RS * ossRsCreate (int inRate, int outRate, int channels, int quality);
+extern void ossRsDelete (OSS_RS * rs);
+extern void ossRsReset (OSS_RS * rs);
+extern UINT32 ossRsRoom (OSS_RS * rs);
+extern INT32 * ossRsTail (OSS_RS * rs);
+extern UINT32 ossRsProcess (OSS_RS * rs, UINT32 frames);
+
+#endif /* __INCossResampleh */
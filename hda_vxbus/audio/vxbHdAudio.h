@@ -18,6 +18,8 @@ modification history
 #define __INCvxbHdAudioh
 
 extern void vxbHdAudioRegister (void);
+extern STATUS vxbHdAudioWaitReady (int timeout);
+extern STATUS vxbHdAudioReadyEventRegister (int tid, UINT32 events);
 
 
 #define VIA_VX900_DEVICE_ID 0x3288
@@ -60,6 +62,7 @@ extern void vxbHdAudioRegister (void);
 
 typedef int nid_t;
 typedef int cad_t;
+typedef UINT8 nid8_t;           /* compact nid of a single AFG */
 typedef struct hdcodec_t* HDCODEC_ID;
 
 
@@ -86,6 +89,30 @@ typedef struct dma_object_t {
 #define HDAA_CHN_SUSPEND    0x00000002
 
 
+/*
+ * Compiled mixer plan of one OSS device.  Each step applies the request to
+ * one control; the part of the request a control could not realize flows
+ * on to the steps naming it as parent, as the volume tracers used to pass
+ * it down the signal path.  A plan is valid while gen matches the codec
+ * mix_gen, which changes whenever a selector is switched.
+ */
+
+typedef struct hda_mix_step_t
+    {
+    struct audio_ctl_t *ctl;
+    int                 parent;         /* step feeding this one, or -1 */
+    int                 left, right;    /* remainder after this step */
+    } HDA_MIX_STEP;
+
+typedef struct hda_mix_plan_t
+    {
+    BOOL                valid;
+    UINT32              gen;
+    int                 nsteps;
+    int                 size;
+    HDA_MIX_STEP *      steps;
+    } HDA_MIX_PLAN;
+
 typedef struct pcm_devinfo_t
     {
     VXB_DEVICE_ID       pDev;
@@ -106,29 +133,38 @@ typedef struct pcm_devinfo_t
     UINT32              ossmask;  /* Mask of supported OSS devices. */
     UINT32              recsrc;       /* Mask of supported OSS sources. */
     int                 autorecsrc;
+    HDA_MIX_PLAN        plan[SOUND_MIXER_NRDEVICES];
     } PCM_DEVINFO;
 
+/*
+ * caps.fmtlist points at a zero terminated list carved from the codec
+ * arena; pcmrates is a bit per hda_pcm_rates[] entry.  The fields used on
+ * every transfer come first.
+ */
+
 typedef struct chan_t {
     HDCODEC_ID          codec;
     struct snd_buf      *b;
     struct pcm_channel  *c;
-    struct pcmchan_caps caps;
-    PCM_DEVINFO*        pcm_dev;
-    UINT32              spd, fmt, fmtlist[32], pcmrates[16];
-    UINT32              supp_stream_formats, supp_pcm_size_rate;
-    UINT32              blkcnt, blksz;
     UINT32*             dmapos;
     UINT32              flags;
+    UINT32              blkcnt, blksz;
+    UINT32              fifosize;       /* bytes the stream FIFO holds */
+    UINT32              spd, fmt;
     int                 dir;
     int                 off;
     int                 sid;
-    int                 bit16, bit32;
-    int                 channels;       /* Number of audio channels. */
-    int                 as;             /* Number of association. */
-    int                 asindex;        /* Index within association. */
-    nid_t               io[16];
+    PCM_DEVINFO*        pcm_dev;
+    struct pcmchan_caps caps;
+    UINT32              supp_stream_formats, supp_pcm_size_rate;
+    UINT16              pcmrates;
+    INT8                bit16, bit32;
+    INT8                channels;       /* Number of audio channels. */
+    INT8                as;             /* Number of association. */
+    INT8                asindex;        /* Index within association. */
     UINT8               stripecap;      /* AND of stripecap of all ios. */
     UINT8               stripectl;      /* stripe to use to all ios. */
+    nid8_t              io[SEQ_NUM_MAX + 1];    /* 0 terminated */
 } CHAN;
 
 #define MINQDB(ctl)                         \
@@ -148,19 +184,35 @@ typedef struct chan_t {
      ((ctl)->size + 1) + (ctl)->offset), (ctl)->step), 0)
 
 
+/*
+ * Contribution of one OSS device to a control, in 1/4dB.  A control is
+ * only on the paths of a few devices, so it keeps HDA_CTL_DEVS_MAX of
+ * them; an all zero slot contributes nothing and is free for reuse.
+ */
+
+#define HDA_CTL_DEVS_MAX        6
+
+typedef struct hda_ctl_dev_t
+    {
+    UINT8               dev;
+    UINT8               mute;
+    INT16               left, right;
+    } HDA_CTL_DEV;
+
 typedef struct audio_ctl_t
     {
     struct widget_t *   widget;
     struct widget_t *   childwidget;
-    int                 enable;
-    int                 index, dir, ndir;
-    int                 mute, step, size, offset;
-    int                 left, right, forcemute;
-    UINT32              muted;
     UINT32              ossmask;
-    int                 devleft[SOUND_MIXER_NRDEVICES];
-    int                 devright[SOUND_MIXER_NRDEVICES];
-    int                 devmute[SOUND_MIXER_NRDEVICES];
+    INT16               left, right;
+    INT8                enable;
+    INT8                index, dir, ndir;
+    INT8                mute, step, size, offset;
+    INT8                forcemute;
+    UINT8               muted;
+    UINT8               amp_shadow[2][2];   /* [out/in][left/right] */
+    UINT8               amp_valid;          /* bit per committed dir */
+    HDA_CTL_DEV         dev[HDA_CTL_DEVS_MAX];
     } AUDIO_CTL;
 
 typedef struct assoc_t
@@ -185,23 +237,91 @@ typedef struct assoc_t
 
 struct codec_t;
 
+/* read-only codec parameter cache, keyed by verb without the codec address */
+
+#define HDA_PARAM_CACHE_SIZE    1024    /* entries, power of two */
+#define HDA_PARAM_CACHE_PROBE   16      /* slots searched per lookup */
+#define HDA_PARAM_CACHE_VALID   0x80000000
+
+typedef struct hda_param_cache_t
+    {
+    UINT32              key;            /* verb | HDA_PARAM_CACHE_VALID */
+    UINT32              val;
+    } HDA_PARAM_CACHE;
+
+/* bring-up profile: wall time, verbs and widget lookups of each stage */
+
+#define HDA_PROF_STAGES_MAX     32
+
+typedef struct hda_prof_stage_t
+    {
+    const char *        name;
+    UINT32              usec;
+    UINT32              verbs;
+    UINT32              lookups;
+    } HDA_PROF_STAGE;
+
+typedef struct hda_prof_t
+    {
+    UINT32              verbs;          /* running counters */
+    UINT32              lookups;
+    UINT64              t0;             /* state of the open stage */
+    UINT32              verbs0;
+    UINT32              lookups0;
+    int                 nstages;
+    HDA_PROF_STAGE      stage[HDA_PROF_STAGES_MAX];
+    } HDA_PROF;
+
+/*
+ * Parse-time arena.  The widget array, controls, associations, PCM and
+ * channel tables and their indexes are carved from a few large chunks,
+ * each table starting on a cache line, and go back to the heap together.
+ */
+
+#define HDA_ARENA_CHUNK_SIZE    16384
+
+typedef struct hda_arena_chunk_t
+    {
+    struct hda_arena_chunk_t * next;
+    UINT32              size;           /* usable bytes after the header */
+    UINT32              used;
+    } HDA_ARENA_CHUNK;
+
+typedef struct hda_arena_t
+    {
+    HDA_ARENA_CHUNK *   chunk;          /* newest first, allocated from */
+    UINT32              bytes;          /* handed out */
+    UINT32              reserved;       /* held from the heap */
+    } HDA_ARENA;
+
+/*
+ * The graph passes walk the fields after the list node; the list linkage,
+ * cached parameters and pin state are only read while parsing.  conns
+ * holds nconns nids carved from the codec arena.
+ */
+
 typedef struct widget_t
     {
-    NODE                node;
-    LIST                widgetList;
+    NODE                node;           /* must be first */
     nid_t               nid;
     int                 type;
-
-    VXB_DEVICE_ID       pDev;
+    INT8                enable;
+    INT8                bindas;
+    INT8                selconn;
+    INT8                ossdev;
+    UINT16              bindseqmask;
+    UINT8               nconns;
+    UINT8               waspin;
+    UINT32              connsenable;    /* bit per enabled conns[] entry */
+    nid8_t *            conns;
+    UINT32              pflags;
+    UINT32              ossmask;
     HDCODEC_ID          codec;
-    int                 enable;
-    int                 bindas;
-    int                 bindseqmask;
-    int                 nconns, selconn;
-    nid_t               conns[32];
-    UINT8               connsenable[32];
 
-    int unsol;
+    LIST                widgetList;
+    struct widget_t *   children;       /* function group: subnode array */
+    VXB_DEVICE_ID       pDev;
+    int                 unsol;
 
     struct {
         UINT32 widget_cap;
@@ -225,14 +345,62 @@ typedef struct widget_t
             UINT8   stripecap;
         } conv;
     } wclass;
-    
-    
-    int                 waspin;
-    UINT32              pflags;
-    int                 ossdev;
-    UINT32              ossmask;
     } WIDGET;
 
+#define HDA_CONN_ENABLED(w, j)  (((w)->connsenable >> (j)) & 1)
+#define HDA_CONN_ENABLE(w, j)   ((w)->connsenable |= (1U << (j)))
+#define HDA_CONN_DISABLE(w, j)  ((w)->connsenable &= ~(1U << (j)))
+
+/* consumer <nid> of a widget, reaching it through its conns[<index>] */
+
+typedef struct hda_rconn_t
+    {
+    nid_t               nid;
+    int                 index;
+    } HDA_RCONN;
+
+/*
+ * Worklist for pruning the widget graph.  A widget is queued when one of
+ * its connections, consumers or controls changed; a disabled widget is
+ * propagated to its neighbours once.  Controls are indexed by the nid of
+ * both their widget and child widget.
+ */
+
+typedef struct hda_prune_t
+    {
+    BOOL                seeded;
+    int                 depth;
+    nid_t *             stack;          /* nodecnt entries */
+    UINT32 *            queued;         /* bitmaps, bit per node */
+    UINT32 *            gone;
+    int *               ctl_start;      /* nodecnt + 1 entries */
+    AUDIO_CTL **        ctl_ref;        /* 2 * ctlcnt entries */
+    } HDA_PRUNE;
+
+/*
+ * Association tracing state, only kept while audio_build_tree() runs.
+ * dac_reach and adc_reach hold a node bitmap per widget: the DACs reached
+ * through its inputs and the ADCs reached through its consumers, ignoring
+ * bindings and depth.  A search caches its result per (nid, depth) for as
+ * long as memo entries carry the current generation.
+ */
+
+typedef struct hda_trace_memo_t
+    {
+    UINT32              gen;
+    nid_t               ret;
+    int                 length;
+    } HDA_TRACE_MEMO;
+
+typedef struct hda_trace_t
+    {
+    int                 words;          /* bitmap words per widget */
+    UINT32 *            dac_reach;
+    UINT32 *            adc_reach;
+    UINT32              gen;
+    HDA_TRACE_MEMO *    memo;           /* nodecnt * (MAXDEPTH + 1) */
+    } HDA_TRACE;
+
 typedef struct hdcodec_t
     {
     VXB_DEVICE_ID       pDev;
@@ -242,7 +410,15 @@ typedef struct hdcodec_t
     UINT8               stepping_id;
     int                 pending;
     UINT32              response;
+    UINT32 *            responses;      /* batch response buffer */
+    int                 nresponses;     /* batch responses received */
+    SEM_ID              cmd_sem;        /* given when pending drops to 0 */
+    SEM_ID              cmd_mutex;      /* one verb stream per codec */
+    HDA_PARAM_CACHE *   param_cache;    /* GET_PARAMETER/CONN_LIST results */
+    UINT32              param_hits;
+    UINT32              param_misses;
     WIDGET              root;
+    HDA_ARENA           arena;          /* parse-time tables */
     
     int                 ascnt;
     ASSOC*              assoc_table;
@@ -256,19 +432,81 @@ typedef struct hdcodec_t
     int                 nodecnt;
     int                 startnode;
     int                 endnode;
+    WIDGET *            widgets;        /* nodecnt entries, nid - startnode */
+    HDA_RCONN *         rconn;          /* consumers, grouped by nid */
+    int *               rconn_start;    /* nodecnt + 1 entries into rconn */
+    HDA_PRUNE *         prune;
+    HDA_TRACE *         trace;
     nid_t               nid;
     int                 cad;
 
     int                 ctlcnt;
     AUDIO_CTL           *ctl;
+    int *               ctl_start;      /* nodecnt + 1 entries into ctl_ref */
+    AUDIO_CTL **        ctl_ref;        /* controls grouped by widget nid */
+    UINT32              mix_gen;        /* bumped when a selector moves */
 
     int                 num_devs;
     PCM_DEVINFO         *pcm_dev_table;
 
     int                 num_hdaa_chans;
     CHAN                *hdaa_chan_table;
+
+    HDA_PROF            prof;           /* probe and parse stages */
     } HDCODEC;
 
+/*
+ * Topology cache blob.  The parse results of a codec are saved after
+ * prepare_pcms() and restored on the next boot instead of re-probing.
+ * The header is followed by the pin configuration defaults used to
+ * validate the blob, then by the WIDGET, ASSOC, AUDIO_CTL, PCM_DEVINFO and
+ * CHAN tables with their pointers cleared, the index tables used to
+ * rebuild those pointers, and last the variable length connection lists
+ * of the widgets and format lists of the channels.
+ */
+
+#define HDA_TOPO_MAGIC          0x48444154      /* "HDAT" */
+#define HDA_TOPO_VERSION        5
+#define HDA_TOPO_MAX_SIZE       131072
+
+typedef struct hda_topo_hdr_t
+    {
+    UINT32              magic;
+    UINT16              version;
+    UINT16              hdrsize;
+    UINT32              length;         /* header included */
+    UINT32              checksum;       /* of everything after the header */
+    UINT32              vendorid;       /* raw GET_PARAMETER responses */
+    UINT32              revisionid;
+    UINT32              subsystemid;
+    UINT16              widgetsize;     /* sizeof() of the stored tables */
+    UINT16              assocsize;
+    UINT16              ctlsize;
+    UINT16              devsize;
+    UINT16              chansize;
+    UINT16              npins;
+    UINT32              outamp_cap;
+    UINT32              inamp_cap;
+    UINT32              supp_stream_formats;
+    UINT32              supp_pcm_size_rate;
+    INT16               nid;
+    INT16               fgnid;
+    INT16               fgtype;
+    INT16               nodecnt;
+    INT16               startnode;
+    INT16               ascnt;
+    INT16               ctlcnt;
+    INT16               num_devs;
+    INT16               num_hdaa_chans;
+    UINT16              varsize;        /* connection and format lists */
+    } HDA_TOPO_HDR;
+
+typedef struct hda_topo_pin_t
+    {
+    INT32               nid;
+    UINT32              config;
+    } HDA_TOPO_PIN;
+
 typedef struct stream_t
     {
     HDCODEC_ID          codec;
@@ -279,6 +517,7 @@ typedef struct stream_t
     int                 running;
     int                 stream;
     UINT16              format;
+    UINT16              fifosize;       /* SDFIFOS + 1, valid while running */
     UINT8*              buf;
     DMA_OBJECT          bdl;
     } STREAM;
@@ -309,6 +548,22 @@ typedef struct hdaDrvCtrl
     int                 rirb_size;
     DMA_OBJECT          rirb_dma;
     int                 rirb_rp;
+    spinlockIsr_t       rirb_lock;      /* rirb_rp and unsolq_wp */
+
+    /* Command completion */
+    BOOL                cmd_poll;       /* sleep-poll instead of RIRB irq */
+    SEM_ID              cmd_lock;       /* CORB writes, immediate commands */
+    SEM_ID              unsolq_lock;    /* one task drains the unsolq */
+
+    /* Command transport selection */
+#define HDA_CMD_PATH_AUTO       0       /* immediate for single verbs */
+#define HDA_CMD_PATH_RING       1       /* always use CORB/RIRB */
+#define HDA_CMD_PATH_IMMEDIATE  2       /* always use ICOI/ICII/ICIS */
+    int                 cmd_path;
+    BOOL                corb_running;
+    BOOL                rirb_running;
+    BOOL                corb_stalled;   /* CORB stopped fetching verbs */
+    BOOL                imm_ok;         /* immediate interface works */
 
     DMA_OBJECT          pos_dma;
 
@@ -330,9 +585,12 @@ typedef struct hdaDrvCtrl
     STREAM              *streams;
 
     int                 num_codec;
+    BOOL                probe_tasks;    /* parse each codec in its own task */
     HDCODEC_ID          codec_table[HDAC_CODEC_NUM_MAX];
     VXB_DMA_TAG_ID      sndbuf_dma_tag;
     VXB_DMA_TAG_ID      parentTag;
+
+    HDA_PROF            prof;           /* controller bring-up stages */
     } HDA_DRV_CTRL;
 
 #define device_get_softc(dev)   ((dev)->pDrvCtrl)
@@ -358,6 +616,34 @@ typedef struct hdaDrvCtrl
 /* HD Audio  monitor poll task delay */
 #define HDA_MON_DELAY_SECS    2
 
+/* HD Audio  bring-up task, runs the controller init after connect */
+
+#define HDA_INIT_TASK_NAME    "hdaInit"
+#define HDA_INIT_TASK_PRI     HDA_MON_TASK_PRI
+#define HDA_INIT_TASK_STACK   16384
+
+/* tasks that may ask for an event once the devices are ready */
+
+#define HDA_READY_NOTIFY_MAX  8
+
+/* HD Audio  codec probe tasks, one per codec while attaching */
+
+#define HDA_PROBE_TASK_NAME   "hdaProbe"
+#define HDA_PROBE_TASK_PRI    HDA_MON_TASK_PRI
+#define HDA_PROBE_TASK_STACK  16384
+
+/* polls of the RIRB before a command waiter blocks on its semaphore */
+
+#define HDA_CMD_SPIN_COUNT    50
+
+/* seconds a command waiter waits for the codec to respond */
+
+#define HDA_CMD_TIMEOUT_SECS  10
+
+/* microseconds the Immediate Command interface may take per verb */
+
+#define HDA_IMM_TIMEOUT_US    1000
+
 #define HDA_BAR(p)         ((HDA_DRV_CTRL *)(p)->pDrvCtrl)->regBase
 #define HDA_HANDLE(p)      ((HDA_DRV_CTRL *)(p)->pDrvCtrl)->regHandle
 
@@ -675,6 +961,10 @@ typedef struct hdaDrvCtrl
 #define HDAC_RIRBSTS_RINTFL     0x01
 #define HDAC_RIRBSTS_RIRBOIS        0x04
 
+/* ICIS - Immediate Command Status */
+#define HDAC_ICIS_ICB           0x0001
+#define HDAC_ICIS_IRV           0x0002
+
 /* RIRBSIZE - RIRB Size */
 #define HDAC_RIRBSIZE_RIRBSIZE_MASK 0x03
 #define HDAC_RIRBSIZE_RIRBSIZE_SHIFT    0
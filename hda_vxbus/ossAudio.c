@@ -20,9 +20,12 @@ modification history
 #include <iosLib.h>
 #include <fcntl.h>
 #include <semLib.h>
+#include <errnoLib.h>
+#include <spinLockLib.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sysLib.h>
 
 #include <hwif/vxbus/vxBus.h>
 #include <drv/sound/soundcard.h>
@@ -33,6 +36,12 @@ modification history
 #include "audio/ossAudio.h"
 #include "audio/vxbHdAudio.h"
 
+#ifndef O_ACCMODE
+#define O_ACCMODE   (O_RDONLY | O_WRONLY | O_RDWR)
+#endif
+
+#define OSS_RING_CHANNELS_MAX   8   /* widest format a converter takes */
+
 LOCAL int ossAudioDrvNum = -1;
 
 LOCAL void *  ossAudioOpen (DEV_HDR * pDevHdr, const char * fileName, int flags, int mode);
@@ -42,10 +51,30 @@ LOCAL ssize_t ossAudioWrite (void * pFileDesc, char * buffer, size_t  maxBytes);
 LOCAL int     ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg);
 
 LOCAL PCM_CHANNEL* ossAudioFindChannel (DSP_DEV *pDspDev, int dir);
+LOCAL int ossAudioIdleChannels (DSP_DEV *pDspDev, int dir);
 LOCAL STATUS ossAudioFreeFd(DSP_DEV *pDspDev, DSP_FD *pFd);
 LOCAL DSP_FD * ossAudioAllocFd(DSP_DEV *pDspDev, int flags);
-LOCAL ssize_t ossAudioIo (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, char * buffer, size_t size, int dir);
+LOCAL size_t ossAudioIo (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, char * buffer, size_t frames, int dir, int timeout);
+LOCAL int ossAudioTimeout (DSP_FD *pFd);
+LOCAL void ossAudioStart (DSP_DEV *pDspDev, PCM_CHANNEL * pChan);
+LOCAL size_t ossAudioRingFrame (PCM_CHANNEL * pChan);
+LOCAL UINT32 ossAudioToApp (PCM_CHANNEL * pChan, UINT32 bytes);
+LOCAL int ossAudioRingChannels (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, int hwfmt, int channels);
+LOCAL STATUS ossAudioSetFormat (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, int afmt, int channels);
+LOCAL STATUS ossAudioSetSpeed (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, int rate);
+LOCAL STATUS ossAudioSetup (PCM_CHANNEL * pChan);
+LOCAL void ossAudioReset (PCM_CHANNEL * pChan);
+LOCAL PCM_CHANNEL * ossAudioPlayChannel (DSP_DEV *pDspDev);
+LOCAL STATUS ossAudioTrigger (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, int go);
+LOCAL void ossAudioStop (DSP_DEV *pDspDev, PCM_CHANNEL * pChan);
+LOCAL size_t ossAudioRsPlay (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, char * buffer, size_t frames, int timeout);
+LOCAL size_t ossAudioRsRec (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, char * buffer, size_t frames, int timeout);
+LOCAL STATUS ossAudioGetSpace (PCM_CHANNEL * pChan, audio_buf_info * info);
 LOCAL void ossAudioSync(DSP_DEV *pDspDev, PCM_CHANNEL* pChan);
+LOCAL STATUS ossAudioMap (PCM_CHANNEL * pChan, buffmem_desc * desc);
+LOCAL UINT32 ossAudioPosition (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, UINT32 * pPtr, UINT32 * pBlocks);
+LOCAL STATUS ossAudioGetPtr (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, count_info * info);
+LOCAL STATUS ossAudioGetDelay (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, int * delay);
 
 DEVMETHOD_DEF(pcm_channel_init,         "pcm_channel_init");
 DEVMETHOD_DEF(pcm_channel_setspeed,     "pcm_channel_setspeed");
@@ -55,6 +84,7 @@ DEVMETHOD_DEF(pcm_channel_stop,         "pcm_channel_stop");
 DEVMETHOD_DEF(pcm_channel_trigger,      "pcm_channel_trigger");
 DEVMETHOD_DEF(pcm_channel_getptr,       "pcm_channel_getptr");
 DEVMETHOD_DEF(pcm_channel_getcaps,      "pcm_channel_getcaps");
+DEVMETHOD_DEF(pcm_channel_getfifo,      "pcm_channel_getfifo");
 
 STATUS ossAudioInit ()
     {
@@ -72,11 +102,29 @@ STATUS ossAudioInit ()
 
 void ossDeleteDsp (DSP_DEV* pDspDev)
     {
+    DSP_FD * pFd;
     int j;
     semTake (pDspDev->mutex, NO_WAIT);
 
     iosDevDelete ((DEV_HDR*)pDspDev);
 
+    if (pDspDev->vmix != NULL)
+        ossVmixDelete (pDspDev->vmix);
+
+    /*
+     * Descriptors still open outlive the device: they keep only a detached
+     * virtual channel, which close() frees, and their I/O fails with ENXIO.
+     */
+
+    for (pFd = (DSP_FD *)lstFirst (&pDspDev->fdList); pFd != NULL;
+         pFd = (DSP_FD *)lstNext (&pFd->fdNode))
+        {
+        pFd->pDspDev = NULL;
+        pFd->record = NULL;
+        if ((pFd->play != NULL) && (pFd->play->parent == NULL))
+            pFd->play = NULL;
+        }
+
     for (j = 0; j < pDspDev->num_chan; j++)
         {
         PCM_CHANNEL* pChan;
@@ -84,6 +132,7 @@ void ossDeleteDsp (DSP_DEV* pDspDev)
         pChan = &pDspDev->channel[j];
         semTake (pChan->sem, NO_WAIT);
         sndbuf_destroy (pChan->sndbuf);
+        ossRsDelete (pChan->rs);
         semDelete (pChan->sem);
         }
     
@@ -124,7 +173,7 @@ DSP_DEV * ossCreateDsp (VXB_DEVICE_ID pDev)
         
         pChan = &pDspDev->channel[j];
         pChan->pDev = pDev;
-        pChan->sem = semCCreate (0, SEM_EMPTY);
+        pChan->sem = semBCreate (SEM_Q_FIFO, SEM_EMPTY);
         pChan->msem = semMCreate (SEM_Q_FIFO);
         pChan->sndbuf = sndbuf_create(pChan->pDev, pChan);
         }
@@ -134,23 +183,32 @@ DSP_DEV * ossCreateDsp (VXB_DEVICE_ID pDev)
     return pDspDev;
     }
     
+/*
+ * Claim an idle channel of a direction, or with PCM_DIR_NONE find a free
+ * slot for osschannel_init().  An association whose mixer is fed by more
+ * than one converter has a channel for each, so several opens can each
+ * run a hardware stream of their own.
+ */
+
 LOCAL PCM_CHANNEL* ossAudioFindChannel (DSP_DEV *pDspDev, int dir)
     {
     int i;
     PCM_CHANNEL * pChan;
-    
+
     for (i = 0; i < pDspDev->num_chan; i++)
         {
         pChan = &pDspDev->channel[i];
-        
-        if (pChan->dir == dir)
+
+        if (pChan->dir != dir)
+            continue;
+
+        if (dir == PCM_DIR_NONE)
+            return pChan;
+
+        if (pChan->refcount == 0)
             {
-            if (dir != PCM_DIR_NONE)
-                {
-                if (pChan->refcount == 0)
-                    pChan->flags |= CHAN_FLAG_TRIGGER;
-                pChan->refcount++;
-                }
+            pChan->flags |= CHAN_FLAG_TRIGGER;
+            pChan->refcount++;
             return pChan;
             }
         }
@@ -158,6 +216,20 @@ LOCAL PCM_CHANNEL* ossAudioFindChannel (DSP_DEV *pDspDev, int dir)
     return NULL;
     }
 
+LOCAL int ossAudioIdleChannels (DSP_DEV *pDspDev, int dir)
+    {
+    int i, n = 0;
+
+    for (i = 0; i < pDspDev->num_chan; i++)
+        {
+        if ((pDspDev->channel[i].dir == dir) &&
+            (pDspDev->channel[i].refcount == 0))
+            n++;
+        }
+
+    return n;
+    }
+
 LOCAL STATUS ossAudioFreeFd(DSP_DEV *pDspDev, DSP_FD *pFd)
     {
     if (pFd == NULL)
@@ -167,7 +239,11 @@ LOCAL STATUS ossAudioFreeFd(DSP_DEV *pDspDev, DSP_FD *pFd)
         pFd->record->refcount--;
 
     if (pFd->play)
+        {
         pFd->play->refcount--;
+        if (pFd->play->parent != NULL)
+            ossVchanDelete (pFd->play);
+        }
 
     lstDelete (&pDspDev->fdList, &pFd->fdNode);
 
@@ -179,46 +255,34 @@ LOCAL STATUS ossAudioFreeFd(DSP_DEV *pDspDev, DSP_FD *pFd)
 LOCAL DSP_FD * ossAudioAllocFd(DSP_DEV *pDspDev, int flags)
     {
     DSP_FD *pFd = NULL;
-    DSP_FD *pLocalFd = NULL;
-    NODE * pNode;
-    STATUS rval = OK;
-    
+
+    switch (flags & O_ACCMODE)
+        {
+        case O_RDONLY:
+        case O_WRONLY:
+        case O_RDWR:
+            break;
+
+        default:
+            errnoSet (EINVAL);
+            return NULL;
+        }
+
     pFd = calloc(1, sizeof(DSP_FD));
     if (pFd != NULL)
         {
         pFd->pDspDev = pDspDev;
-        for(pNode = lstFirst(&pDspDev->fdList); pNode != NULL; pNode = lstNext(pNode))
-            {
-            pLocalFd = (DSP_FD *)pNode;
-            switch (flags)
-                {
-                case O_RDONLY:
-                    if (pLocalFd->record)
-                        rval = ERROR;
-                    break;
-
-                case O_WRONLY:
-                    if (pLocalFd->play)
-                        rval = ERROR;
-                    break;
-
-                case O_RDWR:
-                    if ((pLocalFd->play) || (pLocalFd->record))
-                        rval = ERROR;
-                    break;
-
-                default:
-                    rval = ERROR;
-                    break;
-                }
-            }
+        pFd->timeout = WAIT_FOREVER;
+        if (flags & O_NONBLOCK)
+            pFd->flags |= DSP_FD_NONBLOCK;
 
-        /* DSP file descriptor can be opened once concurrently */
-        
-        if(rval == OK)
-            lstAdd (&pDspDev->fdList, &pFd->fdNode);
-        else
-            return NULL;
+        /*
+         * DSP file descriptor can be opened concurrently while a channel is
+         * left for it: an idle hardware channel or, for playback, a virtual
+         * channel unless those are off
+         */
+
+        lstAdd (&pDspDev->fdList, &pFd->fdNode);
         }
 
     return pFd;
@@ -241,7 +305,7 @@ LOCAL void *  ossAudioOpen (DEV_HDR * pDevHdr, const char * filename, int flags,
             return (void*)ERROR;
             }
 
-        switch (flags)
+        switch (flags & O_ACCMODE)
             {
             case O_RDONLY:
                 pFd->record = ossAudioFindChannel (pDspDev, PCM_DIR_REC);
@@ -250,300 +314,958 @@ LOCAL void *  ossAudioOpen (DEV_HDR * pDevHdr, const char * filename, int flags,
                 break;
 
             case O_WRONLY:
-                pFd->play = ossAudioFindChannel (pDspDev, PCM_DIR_PLAY);
+                pFd->play = ossAudioPlayChannel (pDspDev);
                 if (pFd->play)
                     rval = OK;
                 break;
 
             case O_RDWR:
-                pFd->play = ossAudioFindChannel (pDspDev, PCM_DIR_PLAY);
+                pFd->play = ossAudioPlayChannel (pDspDev);
                 pFd->record = ossAudioFindChannel (pDspDev, PCM_DIR_REC);
                 if ((pFd->play) && (pFd->record))
                     rval = OK;
                 break;
 
-            default:
-                rval = ERROR;
-                break;
-            }
+            default:
+                rval = ERROR;
+                break;
+            }
+
+        /* every channel the open asked for is taken */
+
+        if (rval == ERROR)
+            {
+            ossAudioFreeFd (pDspDev, pFd);
+            errnoSet (EBUSY);
+            }
+
+        semGive (pDspDev->mutex);
+        }
+
+    if (rval == ERROR)
+        pFd = (void*)ERROR;
+    
+    return pFd;
+    }
+
+LOCAL int ossAudioClose (void * pFileDesc)
+    {
+    DSP_FD *pFd = (DSP_FD*)pFileDesc;
+    DSP_DEV *pDspDev = pFd->pDspDev;
+
+    /* the device was deleted while this descriptor was open */
+
+    if (pDspDev == NULL)
+        {
+        if (pFd->play != NULL)
+            ossVchanDelete (pFd->play);
+        free (pFd);
+        return OK;
+        }
+
+    if (pDspDev->devHdr.drvNum == ossAudioDrvNum)
+        {
+        semTake (pDspDev->mutex, WAIT_FOREVER);
+    
+        if ((pFd->record) && (pFd->record->refcount == 1))
+            {
+            /* channel stop operation*/
+            METHOD_CALL(pDspDev->pDev, pcm_channel_stop, pFd->record);
+
+            /* channel reset operation */
+
+            ossAudioReset (pFd->record);
+            pFd->record->flags &= ~CHAN_FLAG_MMAP;
+            }
+        
+        if ((pFd->play) && (pFd->play->refcount == 1))
+            {
+            ossAudioSync (pDspDev, pFd->play);
+
+            /* channel reset operation */
+
+            ossAudioReset (pFd->play);
+            pFd->play->flags &= ~CHAN_FLAG_MMAP;
+            }
+
+        ossAudioFreeFd (pDspDev, pFd);
+        
+        /* release wake up list */
+        selWakeupListTerm(&pDspDev->selWakeupList);
+        
+        semGive (pDspDev->mutex);
+        }
+
+	return OK;
+    }
+
+/*
+ * Move up to frames application frames between buffer and the ring.  The
+ * conversion kernels read and write the ring in place, one contiguous
+ * segment at a time; a frame split by the end of the ring goes through a
+ * bounce frame.  Whatever fits is moved at once; when the ring is full
+ * (playback) or empty (capture) the caller waits up to timeout ticks for
+ * osschannel_intr() to signal that a fragment came free.  When the wait
+ * runs out the frames moved so far are returned.
+ */
+
+LOCAL size_t ossAudioIo (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, char * buffer, size_t frames, int dir, int timeout)
+    {
+    SND_BUF * b = pChan->sndbuf;
+    size_t ringFrame = ossAudioRingFrame (pChan);
+    size_t appFrame = ossCvtSampleSize (pChan->afmt) * pChan->channels;
+    INT32 bounce[OSS_RING_CHANNELS_MAX];
+    size_t done = 0;
+    size_t n;
+    caddr_t addr;
+    UINT32 seg, level;
+
+    if (pChan->rs != NULL)
+        {
+        if (dir == PCM_DIR_PLAY)
+            return ossAudioRsPlay (pDspDev, pChan, buffer, frames, timeout);
+        else
+            return ossAudioRsRec (pDspDev, pChan, buffer, frames, timeout);
+        }
+
+    /* capture has nothing to wait for until the engine runs */
+
+    if (dir == PCM_DIR_REC)
+        ossAudioStart (pDspDev, pChan);
+
+    while (done < frames)
+        {
+        seg = sndbuf_getseg (b, dir, &addr, &level);
+        n = MIN(seg / ringFrame, frames - done);
+
+        if (n > 0)
+            {
+            if (dir == PCM_DIR_PLAY)
+                ossCvtRun (pChan->cvt, addr, buffer + done * appFrame,
+                           n * pChan->channels);
+            else
+                ossCapRun (pChan->cap, buffer + done * appFrame, addr, n,
+                           pChan->hwchannels, pChan->channels);
+
+            sndbuf_advance (b, n * ringFrame);
+            }
+        else if (level >= ringFrame)
+            {
+            if (dir == PCM_DIR_PLAY)
+                {
+                ossCvtRun (pChan->cvt, bounce, buffer + done * appFrame,
+                           pChan->channels);
+                sndbuf_copy ((char *)bounce, b, ringFrame);
+                }
+            else
+                {
+                sndbuf_read ((char *)bounce, b, ringFrame);
+                ossCapRun (pChan->cap, buffer + done * appFrame, bounce, 1,
+                           pChan->hwchannels, pChan->channels);
+                }
+            n = 1;
+            }
+
+        done += n;
+
+        /* playback starts once there is something to play */
+
+        if ((dir == PCM_DIR_PLAY) && (n > 0))
+            ossAudioStart (pDspDev, pChan);
+
+        if ((n == 0) &&
+            ((pChan->flags & CHAN_FLAG_GONE) ||
+             (semTake (pChan->sem, timeout) != OK)))
+            break;
+        }
+
+    return done;
+    }
+
+/*
+ * ossAudioIo() for a channel whose rate the codec lacks.  Application
+ * frames are converted to 32 bit into the resampler, one block at a time;
+ * its output is converted into the ring before more input is taken, so it
+ * never holds more than one block.  Frames are reported written once the
+ * resampler has them.  With no buffer only the pending output is flushed.
+ */
+
+LOCAL size_t ossAudioRsPlay (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, char * buffer, size_t frames, int timeout)
+    {
+    SND_BUF * b = pChan->sndbuf;
+    OSS_RS * rs = pChan->rs;
+    size_t ringFrame = ossAudioRingFrame (pChan);
+    size_t appFrame = ossCvtSampleSize (pChan->afmt) * pChan->channels;
+    INT32 bounce[OSS_RING_CHANNELS_MAX];
+    size_t done = 0;
+    size_t n;
+    caddr_t addr;
+    UINT32 seg, level;
+
+    for (;;)
+        {
+        if (rs->outPos < rs->outLen)
+            {
+            seg = sndbuf_getseg (b, PCM_DIR_PLAY, &addr, &level);
+            n = MIN(seg / ringFrame, rs->outLen - rs->outPos);
+
+            if (n > 0)
+                {
+                ossCvtRun (pChan->cvt, addr, rs->out + rs->outPos * rs->channels,
+                           n * rs->channels);
+                sndbuf_advance (b, n * ringFrame);
+                }
+            else if (level >= ringFrame)
+                {
+                ossCvtRun (pChan->cvt, bounce, rs->out + rs->outPos * rs->channels,
+                           rs->channels);
+                sndbuf_copy ((char *)bounce, b, ringFrame);
+                n = 1;
+                }
+
+            rs->outPos += n;
+
+            if (n > 0)
+                ossAudioStart (pDspDev, pChan);
+            else if ((pChan->flags & CHAN_FLAG_GONE) ||
+                     (semTake (pChan->sem, timeout) != OK))
+                break;
+            continue;
+            }
+
+        if (done == frames)
+            break;
+
+        n = MIN(ossRsRoom (rs), frames - done);
+        ossCvtRun (rs->cvt, ossRsTail (rs), buffer + done * appFrame,
+                   n * pChan->channels);
+        ossRsProcess (rs, n);
+        done += n;
+        }
+
+    return done;
+    }
+
+/*
+ * ossAudioIo() for a channel whose rate the codec lacks.  Ring frames are
+ * converted to 32 bit frames of the application's channels and resampled;
+ * resampled frames the caller had no room for are handed out first on the
+ * next read.
+ */
+
+LOCAL size_t ossAudioRsRec (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, char * buffer, size_t frames, int timeout)
+    {
+    SND_BUF * b = pChan->sndbuf;
+    OSS_RS * rs = pChan->rs;
+    size_t ringFrame = ossAudioRingFrame (pChan);
+    size_t appFrame = ossCvtSampleSize (pChan->afmt) * pChan->channels;
+    INT32 bounce[OSS_RING_CHANNELS_MAX];
+    size_t done = 0;
+    size_t n;
+    caddr_t addr;
+    UINT32 seg, level;
+
+    ossAudioStart (pDspDev, pChan);
+
+    while (done < frames)
+        {
+        if (rs->outPos < rs->outLen)
+            {
+            n = MIN(rs->outLen - rs->outPos, frames - done);
+            ossCapRun (rs->cap, buffer + done * appFrame,
+                       rs->out + rs->outPos * rs->channels, n,
+                       rs->channels, rs->channels);
+            rs->outPos += n;
+            done += n;
+            continue;
+            }
+
+        seg = sndbuf_getseg (b, PCM_DIR_REC, &addr, &level);
+        n = MIN(seg / ringFrame, ossRsRoom (rs));
+
+        if (n > 0)
+            {
+            ossCapRun (pChan->cap, ossRsTail (rs), addr, n,
+                       pChan->hwchannels, pChan->channels);
+            sndbuf_advance (b, n * ringFrame);
+            }
+        else if (level >= ringFrame)
+            {
+            sndbuf_read ((char *)bounce, b, ringFrame);
+            ossCapRun (pChan->cap, ossRsTail (rs), bounce, 1,
+                       pChan->hwchannels, pChan->channels);
+            n = 1;
+            }
+
+        if (n > 0)
+            ossRsProcess (rs, n);
+        else if (semTake (pChan->sem, timeout) != OK)
+            break;
+        }
+
+    return done;
+    }
+
+/* start the engine of a channel that is still waiting for its trigger */
+
+LOCAL void ossAudioStart (DSP_DEV *pDspDev, PCM_CHANNEL * pChan)
+    {
+    /* the mixer is woken for every write; it may have gone idle */
+
+    if (pChan->parent != NULL)
+        {
+        ossVchanTrigger (pChan, PCMTRIG_START);
+        return;
+        }
+
+    if ((pChan->flags & CHAN_FLAG_TRIGGER) == 0)
+        return;
+
+    semTake (pDspDev->mutex, WAIT_FOREVER);
+    if ((pChan->flags & CHAN_FLAG_TRIGGER) &&
+        (METHOD_CALL(pDspDev->pDev, pcm_channel_trigger, pChan, PCMTRIG_START) == OK))
+        pChan->flags &= ~CHAN_FLAG_TRIGGER;
+    semGive (pDspDev->mutex);
+    }
+
+/* ticks a transfer on this descriptor may wait for the ring */
+
+LOCAL int ossAudioTimeout (DSP_FD *pFd)
+    {
+    if (pFd->flags & DSP_FD_NONBLOCK)
+        return NO_WAIT;
+
+    return pFd->timeout;
+    }
+
+LOCAL ssize_t ossAudioWrite (void * pFileDesc, char * buffer, size_t  maxBytes)
+    {
+    DSP_FD * pFd = (DSP_FD*)pFileDesc;
+    DSP_DEV *pDspDev = pFd->pDspDev;
+    PCM_CHANNEL * pChan = pFd->play;
+    size_t frame, frames;
+
+    if ((pDspDev == NULL) || (pChan->flags & CHAN_FLAG_GONE))
+        {
+        errnoSet (ENXIO);
+        return ERROR;
+        }
+
+    /* a mapped ring is filled by the application itself */
+
+    if (pChan->flags & CHAN_FLAG_MMAP)
+        {
+        errnoSet (EBUSY);
+        return ERROR;
+        }
+
+    if (pChan->cvt == NULL)
+        {
+        errnoSet (EINVAL);
+        return ERROR;
+        }
+
+    frame = ossCvtSampleSize (pChan->afmt) * pChan->channels;
+
+    semTake (pChan->msem, WAIT_FOREVER);
+
+    frames = ossAudioIo (pDspDev, pChan, buffer, maxBytes / frame,
+                         PCM_DIR_PLAY, ossAudioTimeout (pFd));
+
+    semGive (pChan->msem);
+
+    /* nothing fitted before the wait ran out or the device went away */
+
+    if ((frames == 0) && (maxBytes >= frame))
+        {
+        errnoSet ((pChan->flags & CHAN_FLAG_GONE) ? ENXIO : EAGAIN);
+        return ERROR;
+        }
+
+    return frames * frame;
+    }
+
+LOCAL ssize_t ossAudioRead  (void * pFileDesc, char * buffer, size_t maxBytes)
+    {
+    DSP_FD * pFd = (DSP_FD*)pFileDesc;
+    DSP_DEV *pDspDev = pFd->pDspDev;
+    PCM_CHANNEL * pChan = pFd->record;
+    size_t frame, frames;
+
+    if (pDspDev == NULL)
+        {
+        errnoSet (ENXIO);
+        return ERROR;
+        }
+
+    if (pChan->flags & CHAN_FLAG_MMAP)
+        {
+        errnoSet (EBUSY);
+        return ERROR;
+        }
+
+    if (pChan->cap == NULL)
+        {
+        errnoSet (EINVAL);
+        return ERROR;
+        }
+
+    frame = ossCvtSampleSize (pChan->afmt) * pChan->channels;
+
+    semTake (pChan->msem, WAIT_FOREVER);
+
+    frames = ossAudioIo (pDspDev, pChan, buffer, maxBytes / frame,
+                         PCM_DIR_REC, ossAudioTimeout (pFd));
+
+    semGive (pChan->msem);
+
+    /* nothing was captured before the wait ran out */
+
+    if ((frames == 0) && (maxBytes >= frame))
+        {
+        errnoSet (EAGAIN);
+        return ERROR;
+        }
+
+    return frames * frame;
+    }
+
+LOCAL void ossAudioSync(DSP_DEV *pDspDev, PCM_CHANNEL* pChan)
+    {
+    SND_BUF * b = pChan->sndbuf;
+    caddr_t addr;
+    UINT32 tcount, pad, level;
+
+    /*
+     * Wait for the engine to play everything written; osschannel_intr()
+     * signals when the ring drains.  A mapped ring is not accounted, and a
+     * stalled engine ends the wait.
+     */
+
+    if ((pChan->flags & CHAN_FLAG_MMAP) == 0)
+        {
+        if (pChan->rs != NULL)
+            ossAudioRsPlay (pDspDev, pChan, NULL, 0, sysClkRateGet ());
+
+        /*
+         * The engine plays whole fragments and is stopped on the interrupt
+         * after the last one, so silence the rest of a partial fragment
+         * and, when it is free, the fragment after it; otherwise stale
+         * data from an earlier lap is heard at the end.
+         */
+
+        if ((INT32)(b->hcount - b->tcount) > 0)
+            {
+            pad = (sndbuf_getblksz(b) - (b->head % sndbuf_getblksz(b))) %
+                  sndbuf_getblksz(b);
+            if (sndbuf_getseg (b, PCM_DIR_PLAY, &addr, &level) >= pad)
+                {
+                bzero ((char *)addr, pad);
+                sndbuf_advance (b, pad);
+                }
+            if (sndbuf_getseg (b, PCM_DIR_PLAY, &addr, &level) >=
+                sndbuf_getblksz(b))
+                bzero ((char *)addr, sndbuf_getblksz(b));
+            }
+
+        while (((pChan->flags & CHAN_FLAG_TRIGGER) == 0) &&
+               ((INT32)(b->hcount - b->tcount) > 0))
+            {
+            tcount = b->tcount;
+            if ((semTake (pChan->sem, sysClkRateGet ()) != OK) &&
+                (tcount == b->tcount))
+                break;
+            }
+        }
+
+    /* channel stop operation*/
+    ossAudioStop (pDspDev, pChan);
+
+    /* whatever was left of a partial fragment is gone with the engine */
+
+    ossAudioReset (pChan);
+    pChan->flags |= CHAN_FLAG_TRIGGER;
+    }
+
+/*
+ * Hand the DMA ring of a channel to the application.  The ring holds
+ * interleaved frames in the stream format programmed into the controller,
+ * at least two channels of 16 or 32 bit samples, and is sndbuf_getsize()
+ * bytes long split into sndbuf_getblkcnt() fragments.  From here on read()
+ * and write() are refused and progress is reported through GETIPTR/GETOPTR.
+ */
+
+LOCAL STATUS ossAudioMap (PCM_CHANNEL * pChan, buffmem_desc * desc)
+    {
+    SND_BUF * b;
+
+    if ((pChan == NULL) || (desc == NULL))
+        return ERROR;
+
+    /* a virtual ring is read by the mixer, not the engine */
+
+    if (pChan->parent != NULL)
+        return ERROR;
+
+    b = pChan->sndbuf;
+    if (b->buf_addr == NULL)
+        return ERROR;
+
+    if ((pChan->flags & CHAN_FLAG_MMAP) == 0)
+        {
+        /* the ring can only change hands while the engine is idle */
+
+        if ((pChan->flags & CHAN_FLAG_TRIGGER) == 0)
+            return ERROR;
+
+        bzero ((char *)b->buf_addr, sndbuf_getsize(b));
+        sndbuf_reset (b);
+        pChan->blocks_seen = pChan->blocks;
+        pChan->flags |= CHAN_FLAG_MMAP;
+        }
+
+    pChan->abinfo.fragsize = sndbuf_getblksz(b);
+    pChan->abinfo.fragstotal = sndbuf_getblkcnt(b);
+    pChan->abinfo.fragments = sndbuf_getblkcnt(b);
+    pChan->abinfo.bytes = sndbuf_getsize(b);
+
+    desc->buffer = (unsigned *)b->buf_addr;
+    desc->size = sndbuf_getsize(b);
+
+    return OK;
+    }
+
+/*
+ * Sample the DMA progress of a channel without taking a lock.  Returns the
+ * bytes the engine has moved since the channel was created: the ring's
+ * tcount plus the engine's progress into the current fragment.  The
+ * counters are advanced by osschannel_intr(), so they are read again until
+ * no fragment interrupt slipped in between.
+ */
+
+LOCAL UINT32 ossAudioPosition (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, UINT32 * pPtr, UINT32 * pBlocks)
+    {
+    SND_BUF * b = pChan->sndbuf;
+    UINT32 blocks, bytes, ptr, size, delta;
+    int tail;
+
+    size = sndbuf_getsize(b);
+
+    do
+        {
+        blocks = pChan->blocks;
+        bytes = b->tcount;
+        tail = b->tail;
+
+        if ((pChan->flags & CHAN_FLAG_TRIGGER) || (pChan->parent != NULL))
+            ptr = tail;
+        else
+            ptr = METHOD_CALL(pDev, pcm_channel_getptr, pChan);
+        } while (blocks != pChan->blocks);
+
+    if (pPtr != NULL)
+        *pPtr = ptr;
+    if (pBlocks != NULL)
+        *pBlocks = blocks;
+
+    /*
+     * A position that lands in the last fragment before tail was read
+     * just behind it (the DMA position lags the interrupt slightly), not
+     * almost a whole ring ahead; count it as no progress so the result
+     * never runs backwards on the next call.
+     */
+
+    delta = (ptr + size - tail) % size;
+    if (delta > size - sndbuf_getblksz(b))
+        delta = 0;
+
+    return (bytes + delta);
+    }
+
+/*
+ * GETIPTR/GETOPTR: bytes counts everything the engine has moved, blocks
+ * the fragments completed since the previous call and ptr the engine's
+ * offset in the ring.
+ */
+
+LOCAL STATUS ossAudioGetPtr (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, count_info * info)
+    {
+    UINT32 blocks, ptr;
+
+    if ((pChan == NULL) || (info == NULL) || (sndbuf_getsize(pChan->sndbuf) == 0))
+        return ERROR;
+
+    info->bytes = ossAudioPosition (pDev, pChan, &ptr, &blocks);
+    info->blocks = blocks - pChan->blocks_seen;
+    info->ptr = ptr;
+
+    pChan->blocks_seen = blocks;
+
+    return OK;
+    }
+
+/*
+ * GETODELAY: the bytes written but not yet fetched by the engine, plus
+ * whatever sits in the stream FIFO while it runs, scaled back to the
+ * sample format the application writes.  For a virtual channel the mix
+ * queued in the hardware ring stands in for the FIFO.  Frames held by the
+ * resampler are added on top.  A mapped ring is filled behind the
+ * driver's back, so its fill level is unknown.
+ */
+
+LOCAL STATUS ossAudioGetDelay (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, int * delay)
+    {
+    OSS_RS * rs;
+    INT32 pending;
+    UINT32 frames;
+
+    if ((pChan == NULL) || (delay == NULL) || (sndbuf_getsize(pChan->sndbuf) == 0))
+        return ERROR;
+
+    if (pChan->flags & CHAN_FLAG_MMAP)
+        {
+        errnoSet (EINVAL);
+        return ERROR;
+        }
+
+    pending = (INT32)(pChan->sndbuf->hcount - ossAudioPosition (pDev, pChan, NULL, NULL));
+    if (pending < 0)
+        pending = 0;
+    else if (pChan->parent != NULL)
+        pending += ossVchanDelay (pChan);
+    else if ((pChan->flags & CHAN_FLAG_TRIGGER) == 0)
+        pending += METHOD_CALL(pDev, pcm_channel_getfifo, pChan);
+
+    *delay = ossAudioToApp (pChan, pending);
+
+    /*
+     * Frames still inside the resampler have not reached the ring: input
+     * not yet consumed, at the application rate, and output not yet
+     * copied, at the hardware rate.
+     */
+
+    rs = pChan->rs;
+    if (rs != NULL)
+        {
+        frames = (rs->fill > rs->pos) ? rs->fill - rs->pos : 0;
+        frames += (UINT32)(((UINT64)(rs->outLen - rs->outPos) * pChan->rate) /
+                           pChan->hwrate);
+        *delay += frames * ossCvtSampleSize (pChan->afmt) * pChan->channels;
+        }
+
+    return OK;
+    }
+
+/*
+ * GETOSPACE/GETISPACE: the bytes and whole fragments the application can
+ * write or read right now.  A mapped ring is not accounted, so only its
+ * geometry is reported.
+ */
+
+LOCAL STATUS ossAudioGetSpace (PCM_CHANNEL * pChan, audio_buf_info * info)
+    {
+    SND_BUF * b;
+    UINT32 level;
+
+    if ((pChan == NULL) || (info == NULL) || (sndbuf_getsize(pChan->sndbuf) == 0))
+        return ERROR;
+
+    if (pChan->flags & CHAN_FLAG_MMAP)
+        {
+        memcpy (info, &pChan->abinfo, sizeof(audio_buf_info));
+        return OK;
+        }
+
+    b = pChan->sndbuf;
+    if (pChan->dir == PCM_DIR_PLAY)
+        level = sndbuf_getfree (b);
+    else
+        level = sndbuf_getready (b);
+
+    info->fragments = level / sndbuf_getblksz(b);
+    info->fragstotal = sndbuf_getblkcnt(b);
+    info->fragsize = ossAudioToApp (pChan, sndbuf_getblksz(b));
+    info->bytes = ossAudioToApp (pChan, level);
+
+    return OK;
+    }
+
+/*
+ * The ring holds hwchannels of 16 or 32 bit samples: the bytes of a ring
+ * frame, and ring bytes scaled to the bytes the application reads or
+ * writes at its own rate.
+ */
+
+LOCAL size_t ossAudioRingFrame (PCM_CHANNEL * pChan)
+    {
+    size_t size = (pChan->hwfmt == AFMT_S32_LE) ? 4 : 2;
+
+    return size * pChan->hwchannels;
+    }
+
+LOCAL UINT32 ossAudioToApp (PCM_CHANNEL * pChan, UINT32 bytes)
+    {
+    size_t frame = ossCvtSampleSize (pChan->afmt) * pChan->channels;
+    UINT32 frames = bytes / ossAudioRingFrame (pChan);
+
+    if (pChan->rs != NULL)
+        frames = (UINT32)(((UINT64)frames * pChan->rate) / pChan->hwrate);
+
+    return frames * frame;
+    }
+
+/*
+ * Program a ring format with room for channels, and return its channel
+ * count or 0 if the codec has none.  Capture settles for a ring with more
+ * channels and extracts the ones asked for.  A virtual ring always has the
+ * 32 bit layout of the mix.
+ */
+
+LOCAL int ossAudioRingChannels (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, int hwfmt, int channels)
+    {
+    int hwchannels = MAX(channels, 2);
+    int maxchannels = hwchannels;
+
+    if (pChan->parent != NULL)
+        {
+        if ((hwfmt != AFMT_S32_LE) || (hwchannels != OSS_VMIX_CHANNELS))
+            return 0;
+
+        pChan->hwchannels = hwchannels;
+        return hwchannels;
+        }
+
+    if (pChan->dir == PCM_DIR_REC)
+        maxchannels = OSS_RING_CHANNELS_MAX;
+
+    for (; hwchannels <= maxchannels; hwchannels++)
+        {
+        pChan->hwchannels = hwchannels;
+        if (METHOD_CALL(pDev, pcm_channel_setformat, pChan, hwfmt) == 0)
+            return hwchannels;
+        }
+
+    return 0;
+    }
+
+/*
+ * Select the encoding and channel count of a channel, program the ring
+ * format for them and set up the conversion ossAudioWrite() or
+ * ossAudioRead() runs.  Encodings wider than 16 bit take a 32 bit ring, or
+ * a 16 bit one when the codec has no 32 bit format.  The channel is left
+ * unchanged if the combination is not supported.
+ */
+
+LOCAL STATUS ossAudioSetFormat (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, int afmt, int channels)
+    {
+    int oldhwchannels = pChan->hwchannels;
+    int hwfmt, hwchannels;
 
-        semGive (pDspDev->mutex);
+    if (((pChan->afmts & afmt) == 0) || (channels < 1) ||
+        (channels > OSS_RING_CHANNELS_MAX))
+        return ERROR;
+
+    hwfmt = ossCvtHwFormat (afmt);
+    if (pChan->parent != NULL)
+        hwfmt = AFMT_S32_LE;
+
+    hwchannels = ossAudioRingChannels (pDev, pChan, hwfmt, channels);
+    if ((hwchannels == 0) && (hwfmt == AFMT_S32_LE))
+        {
+        hwfmt = AFMT_S16_LE;
+        hwchannels = ossAudioRingChannels (pDev, pChan, hwfmt, channels);
         }
 
-    if (rval == ERROR)
+    if (hwchannels == 0)
         {
-        ossAudioFreeFd (pDspDev, pFd);
-        pFd = (void*)ERROR;
+        pChan->hwchannels = oldhwchannels;
+        return ERROR;
         }
-    
-    return pFd;
+
+    pChan->afmt = afmt;
+    pChan->channels = channels;
+    pChan->hwfmt = hwfmt;
+
+    return ossAudioSetup (pChan);
     }
 
-LOCAL int ossAudioClose (void * pFileDesc)
-    {
-    DSP_FD *pFd = (DSP_FD*)pFileDesc;
-    DSP_DEV *pDspDev = pFd->pDspDev;
+/*
+ * Program the codec rate closest to rate.  When the codec lacks rate a
+ * resampler makes up the difference; past the ratios it covers the
+ * channel runs at the codec rate instead.  A virtual channel is resampled
+ * to the rate of the mix.
+ */
 
-    if (pDspDev->devHdr.drvNum == ossAudioDrvNum)
-        {
-        semTake (pDspDev->mutex, WAIT_FOREVER);
-    
-        if ((pFd->record) && (pFd->record->refcount == 1))
-            {
-            /* channel stop operation*/
-            METHOD_CALL(pDspDev->pDev, pcm_channel_stop, pFd->record);
+LOCAL STATUS ossAudioSetSpeed (VXB_DEVICE_ID pDev, PCM_CHANNEL * pChan, int rate)
+    {
+    int hwrate;
 
-            /* channel reset operation */
+    if (rate <= 0)
+        return ERROR;
 
-            sndbuf_reset(pFd->record->sndbuf);
-            }
-        
-        if ((pFd->play) && (pFd->play->refcount == 1))
-            {
-            ossAudioSync (pDspDev, pFd->play);
+    /* a virtual channel runs at the rate of the mix */
 
-            /* channel reset operation */
+    if (pChan->parent != NULL)
+        hwrate = pChan->parent->hwrate;
+    else
+        hwrate = METHOD_CALL(pDev, pcm_channel_setspeed, pChan, rate);
+    if (hwrate <= 0)
+        return ERROR;
 
-            sndbuf_reset(pFd->play->sndbuf);
-            }
+    pChan->rate = rate;
+    pChan->hwrate = hwrate;
+    if (ossAudioSetup (pChan) == OK)
+        return OK;
 
-        ossAudioFreeFd (pDspDev, pFd);
-        
-        /* release wake up list */
-        selWakeupListTerm(&pDspDev->selWakeupList);
-        
-        semGive (pDspDev->mutex);
-        }
+    pChan->rate = hwrate;
 
-	return OK;
+    return ossAudioSetup (pChan);
     }
 
-LOCAL ssize_t ossAudioIo (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, char * buffer, size_t size, int dir)
+/*
+ * Look up the conversions for the format and rate of a channel.  When the
+ * codec runs at another rate, a resampler working on 32 bit frames of the
+ * application's channels sits between two conversions: application format
+ * to 32 bit and 32 bit to the ring for playback, the reverse for capture.
+ */
+
+LOCAL STATUS ossAudioSetup (PCM_CHANNEL * pChan)
     {
-    VXB_DEVICE_ID pDev = pDspDev->pDev;
-    signed int remainder = min(size, sndbuf_getsize(pChan->sndbuf));
-    size_t bytes = 0;
-    static int total = 0;
+    int channels = pChan->channels;
+    OSS_RS * rs = NULL;
 
-    while (remainder > 0)
+    if (pChan->rate != pChan->hwrate)
         {
-        if(semTake(pChan->sem, WAIT_FOREVER) != OK)
-            {
-            printf("%s: pChan->sem failed, bytes= x%x\n",__func__,bytes);
-            return bytes;
-            }
-        pChan->semcnt--;
-
-        if (dir == PCM_DIR_PLAY)
-            bytes += sndbuf_copy (buffer + bytes, pChan->sndbuf,
-                                  min (remainder, sndbuf_getblksz(pChan->sndbuf)));
+        if (pChan->dir == PCM_DIR_PLAY)
+            rs = ossRsCreate (pChan->rate, pChan->hwrate, channels, pChan->quality);
         else
-            bytes += sndbuf_read (buffer + bytes, pChan->sndbuf,
-                                  min (remainder, sndbuf_getblksz(pChan->sndbuf)));
-
-        if (pChan->flags & CHAN_FLAG_TRIGGER)
-            {
-            semTake (pDspDev->mutex, WAIT_FOREVER);
-            if (METHOD_CALL(pDev, pcm_channel_trigger, pChan, PCMTRIG_START) == OK)
-                pChan->flags &= ~CHAN_FLAG_TRIGGER;
-            semGive (pDspDev->mutex);
-            }
+            rs = ossRsCreate (pChan->hwrate, pChan->rate, channels, pChan->quality);
 
-        remainder -= bytes;
-        total += bytes;
+        if (rs == NULL)
+            return ERROR;
         }
-    return bytes;
-    }
-
-LOCAL ssize_t ossAudioWrite (void * pFileDesc, char * buffer, size_t  maxBytes)
-    {
-    DSP_FD * pFd = (DSP_FD*)pFileDesc;
-    DSP_DEV *pDspDev = pFd->pDspDev;
-    PCM_CHANNEL * pChan = pFd->play;
-    ssize_t bytes = 0;
 
-    /*icelee, workaround for mono and/or 8bit stream.
-     * 20/24bit is not considered here.*/
-        
-    INT32  val;
-    INT16 *pNewBuffer;
-    INT16 *ptr;
-    int    i;
-    int     newBytes;
-    
-#   define OSS_READ8   {val = ( ( (unsigned char)(buffer[i])-0x80 ) <<8 ),i++;}
-#   define OSS_READ16  {val = (buffer[i] &0xFF) | ((buffer[i+1]<<8)); i+=2;}    
-#   define OSS_WRITE16 {*ptr = val; ptr++;}     
+    ossRsDelete (pChan->rs);
+    pChan->rs = rs;
+    pChan->cvt = NULL;
+    pChan->cap = NULL;
 
-    newBytes = maxBytes;
-    if (pChan->afmt == AFMT_U8 )
-    	newBytes <<= 1;
-    if ( pChan->channels == 1  )
-    	newBytes <<= 1;
+    if (rs == NULL)
+        {
+        if (pChan->dir == PCM_DIR_PLAY)
+            pChan->cvt = ossCvtFind (pChan->afmt, channels, pChan->hwfmt);
+        else
+            pChan->cap = ossCapFind (pChan->hwfmt, pChan->hwchannels,
+                                     pChan->afmt, channels);
+        return OK;
+        }
 
-#if 0
-    ptr = pNewBuffer = (INT16 *)malloc(maxBytes * 4);
+    /* mono is widened by the ring conversion, not ahead of the resampler */
 
-    if (pNewBuffer == NULL)
+    if (pChan->dir == PCM_DIR_PLAY)
         {
-        printf("%s: malloc failed!\n",__func__);
-    	return 0;
-    	}
-#else
-    if(pChan->sndbuf->shadow_buf_addr != NULL)
-        ptr = pNewBuffer = pChan->sndbuf->shadow_buf_addr;
+        rs->cvt = ossCvtFind (pChan->afmt, MAX(channels, 2), AFMT_S32_LE);
+        pChan->cvt = ossCvtFind (AFMT_S32_LE, channels, pChan->hwfmt);
+        }
     else
-        return 0;
-#endif
-    
-    for (i=0; i<maxBytes; )
-        {
-	    if (pChan->afmt == AFMT_U8 )
-	    	OSS_READ8
-	    else
-	    	OSS_READ16;
-	    
-	    OSS_WRITE16;
-    	if ( pChan->channels == 1  )
-            {
-    	    OSS_WRITE16;
-            }
+        {
+        pChan->cap = ossCapFind (pChan->hwfmt, pChan->hwchannels,
+                                 AFMT_S32_LE, channels);
+        rs->cap = ossCapFind (AFMT_S32_LE, channels, pChan->afmt, channels);
         }
 
-#   undef OSS_READ8
-#   undef OSS_READ16
-#   undef OSS_WRITE16
+    return OK;
+    }
 
-    semTake (pChan->msem, WAIT_FOREVER);
+/* drop the ring contents of a channel and whatever its resampler holds */
 
-#if 0
-    bytes = ossAudioIo (pDspDev, pFd->play, (char*)pNewBuffer, newBytes, PCM_DIR_PLAY);
-    if (bytes < newBytes)
-        {
-        printf("%s: one more ossAudioIo\n",__func__);
-        bytes = ossAudioIo (pDspDev, pFd->play, (char*)(pNewBuffer+(bytes/2)), newBytes-bytes, PCM_DIR_PLAY);
-        }
-#else    
-    while(bytes < newBytes)
+LOCAL void ossAudioReset (PCM_CHANNEL * pChan)
     {
-    bytes += ossAudioIo (pDspDev, pChan, (char*)(pNewBuffer+(bytes/2)), newBytes-bytes, PCM_DIR_PLAY);
-    }
-#endif
+    sndbuf_reset (pChan->sndbuf);
 
-    semGive (pChan->msem);
-#if 0
-    free(pNewBuffer);
-#endif
-    selWakeupAll (&pDspDev->selWakeupList, SELWRITE);
-    return bytes;
+    if (pChan->rs != NULL)
+        ossRsReset (pChan->rs);
     }
 
-LOCAL ssize_t ossAudioRead  (void * pFileDesc, char * buffer, size_t maxBytes)
+/*
+ * The playback channel for a new descriptor: an idle hardware channel while
+ * another is left for the mixer, else a virtual channel of the device's
+ * mixer, or only hardware channels when virtual channels are off.  The
+ * first open that needs the mixer hands it a hardware channel, in a 32 bit
+ * stereo ring format (16 bit if the codec has no 32 bit one).  Virtual
+ * channels start out as 16 bit stereo at the rate of the mix.
+ */
+
+LOCAL PCM_CHANNEL * ossAudioPlayChannel (DSP_DEV *pDspDev)
     {
-    DSP_FD * pFd = (DSP_FD*)pFileDesc;
-    DSP_DEV *pDspDev = pFd->pDspDev;
-    ssize_t bytes = 0;
-    PCM_CHANNEL * pChan = pFd->record;
-    int channel, fmt;
-    char * localBuffer = NULL;
-    char * pU8;
-    short * pU16;
-    long * pU32;
-    int i,j;
-    int copyLen;
+    PCM_CHANNEL * hw;
+    PCM_CHANNEL * pChan;
 
-    semTake (pChan->msem, WAIT_FOREVER);
-    
-    fmt = pChan->afmt;
-    channel = pChan->channels;
+    if (ossVchanMax == 0)
+        return ossAudioFindChannel (pDspDev, PCM_DIR_PLAY);
 
-    if(channel == 1)
-        maxBytes <<= 1;
-    if(fmt == AFMT_U8)
-        maxBytes <<= 1;
+    /* a hardware stream costs no CPU; keep the last one for the mixer */
 
-#if 0
-    localBuffer = (char*)malloc(maxBytes);
-    if(localBuffer == NULL)
+    if ((pDspDev->vmix != NULL) ||
+        (ossAudioIdleChannels (pDspDev, PCM_DIR_PLAY) > 1))
         {
-        printf("%s: malloc failed!\n",__func__);
-        return 0;
+        if ((hw = ossAudioFindChannel (pDspDev, PCM_DIR_PLAY)) != NULL)
+            return hw;
         }
-#else
-    if(pChan->sndbuf->shadow_buf_addr != NULL)
-        localBuffer = pChan->sndbuf->shadow_buf_addr;
-    else
-        return 0;
-#endif
 
-    bytes = ossAudioIo (pDspDev, pChan, localBuffer, maxBytes, PCM_DIR_REC);
-    
-    semGive (pChan->msem);
-
-    pU8 = localBuffer;
-    pU16 = (short*)localBuffer;
-    pU32 = (long*)localBuffer;
-    for(i=0, j=0; j < maxBytes/4; j++)
+    if (pDspDev->vmix == NULL)
         {
-        if(fmt == AFMT_U8)
-            {
-            short pcm16 = (short)(pU32[j] & 0xffff);
-            pU8[i] = (pcm16 >> 8) + 128;
-            }
-        else
-            pU16[i] = pU32[j];
-
-        i++;
+        hw = ossAudioFindChannel (pDspDev, PCM_DIR_PLAY);
+        if (hw == NULL)
+            return NULL;
 
-        if(channel == 2)
+        if ((ossAudioSetFormat (pDspDev->pDev, hw, AFMT_S32_LE, OSS_VMIX_CHANNELS) != OK) ||
+            ((pDspDev->vmix = ossVmixCreate (pDspDev, hw)) == NULL))
             {
-            if(fmt == AFMT_U8)
-                {
-                short pcm16 = (short)(pU32[j] & 0xffff);
-                pU8[i] = (pcm16 >> 8) + 128;
-                }
-            else
-                pU16[i] = pU32[j];
-
-            i++;
+            hw->refcount--;
+            return NULL;
             }
-        }    
+        }
 
-    copyLen = bytes;
-    if(channel == 1)
-        copyLen /= 2;
-    if(fmt == AFMT_U8)
-        copyLen /= 2;
-    
-    bcopy(localBuffer, buffer, copyLen);
-#if 0
-    free(localBuffer);
-#endif
-    selWakeupAll (&pDspDev->selWakeupList, SELREAD);
-    return copyLen;
+    if ((pChan = ossVchanCreate (pDspDev->vmix)) == NULL)
+        return NULL;
+
+    pChan->selList = &pDspDev->selWakeupList;
+    pChan->afmts = OSS_CVT_FMTS;
+    pChan->afmt = AFMT_S16_LE;
+    pChan->channels = 2;
+    pChan->hwfmt = AFMT_S32_LE;
+    pChan->hwchannels = OSS_VMIX_CHANNELS;
+    pChan->quality = OSS_RS_QUALITY_DEFAULT;
+    pChan->rate = pChan->hwrate = pChan->parent->hwrate;
+    ossAudioSetup (pChan);
+
+    return pChan;
     }
 
-LOCAL void ossAudioSync(DSP_DEV *pDspDev, PCM_CHANNEL* pChan)
+/* start or stop the engine of a channel, or a virtual channel's mixing */
+
+LOCAL STATUS ossAudioTrigger (DSP_DEV *pDspDev, PCM_CHANNEL * pChan, int go)
     {
-    int count;
+    if (pChan->parent != NULL)
+        return ossVchanTrigger (pChan, go);
 
-    count = sndbuf_getblkcnt(pChan->sndbuf) - pChan->semcnt;
-    while (count > 0)
-        {
-        semTake (pChan->sem, WAIT_FOREVER);
-        count--;
-        }
+    return METHOD_CALL(pDspDev->pDev, pcm_channel_trigger, pChan, go);
+    }
 
-    /* channel stop operation*/
-    METHOD_CALL(pDspDev->pDev, pcm_channel_stop, pChan);
-    
+LOCAL void ossAudioStop (DSP_DEV *pDspDev, PCM_CHANNEL * pChan)
+    {
+    if (pChan->parent != NULL)
+        ossVchanTrigger (pChan, PCMTRIG_STOP);
+    else
+        METHOD_CALL(pDspDev->pDev, pcm_channel_stop, pChan);
     }
 
 LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg)
     {
     DSP_FD * pFd = (DSP_FD*)pFileDesc;
     DSP_DEV * pDspDev = pFd->pDspDev;
-    VXB_DEVICE_ID pDev = pDspDev->pDev;
+    VXB_DEVICE_ID pDev;
     PCM_CHANNEL * pChan = NULL;
 
     /* ioctl code key
@@ -565,12 +1287,53 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
     if (data_direction & (SIOC_IN | SIOC_OUT))
         data_buffer = (unsigned int *)arg;
 
+    if (pDspDev == NULL)
+        {
+        errnoSet (ENXIO);
+        return ERROR;
+        }
+
+    pDev = pDspDev->pDev;
+
     if (ioctl_code == 'P')
-        {        
+        {
+        /* position and space queries are polled at high rate and take no lock */
+
+        switch (function)
+            {
+            case SNDCTL_DSP_GETIPTR:
+                return ossAudioGetPtr (pDev, pFd->record, (count_info *)data_buffer);
+
+            case SNDCTL_DSP_GETOPTR:
+                return ossAudioGetPtr (pDev, pFd->play, (count_info *)data_buffer);
+
+            case SNDCTL_DSP_GETODELAY:
+                return ossAudioGetDelay (pDev, pFd->play, (int *)data_buffer);
+
+            case SNDCTL_DSP_GETOSPACE:
+                return ossAudioGetSpace (pFd->play, (audio_buf_info *)data_buffer);
+
+            case SNDCTL_DSP_GETISPACE:
+                return ossAudioGetSpace (pFd->record, (audio_buf_info *)data_buffer);
+
+            default:
+                break;
+            }
+
         semTake (pDspDev->mutex, WAIT_FOREVER);
         switch (function)
             {
             case SNDCTL_DSP_SETFRAGMENT:
+
+                /* the geometry of a mapped ring is fixed */
+
+                if (((pFd->record) && (pFd->record->flags & CHAN_FLAG_MMAP)) ||
+                    ((pFd->play) && (pFd->play->flags & CHAN_FLAG_MMAP)))
+                    {
+                    semGive (pDspDev->mutex);
+                    return ERROR;
+                    }
+
                 pChan = pFd->record;
                 if (pChan != NULL)
                     {
@@ -582,8 +1345,6 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                     METHOD_CALL(pDev, pcm_channel_setfragments, pChan,
                                 pChan->abinfo.fragsize, pChan->abinfo.fragments);
 
-                    pChan->semcnt = sndbuf_getblkcnt(pChan->sndbuf);
-                    semCInitialize((char*)pChan->sem, SEM_Q_FIFO , pChan->semcnt);
                     }
 
                 pChan = pFd->play;
@@ -594,11 +1355,13 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                     pChan->abinfo.bytes = pChan->abinfo.fragments * pChan->abinfo.fragsize;
                     pChan->abinfo.fragstotal = pChan->abinfo.fragments;
                     
-                    METHOD_CALL(pDev, pcm_channel_setfragments, pChan,
-                                pChan->abinfo.fragsize, pChan->abinfo.fragments);
+                    if (pChan->parent != NULL)
+                        ossVchanSetFragments (pChan, pChan->abinfo.fragsize,
+                                              pChan->abinfo.fragments);
+                    else
+                        METHOD_CALL(pDev, pcm_channel_setfragments, pChan,
+                                    pChan->abinfo.fragsize, pChan->abinfo.fragments);
 
-                    pChan->semcnt = sndbuf_getblkcnt(pChan->sndbuf);
-                    semCInitialize((char*)pChan->sem, SEM_Q_FIFO , pChan->semcnt);
                     }
                 break;
                 
@@ -622,15 +1385,15 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                 pChan = pFd->play;
                 if (pChan != NULL)
                     {
-                    pChan->rate = data_buffer[0];
-                    METHOD_CALL(pDev, pcm_channel_setspeed, pChan, pChan->rate);
+                    ossAudioSetSpeed (pDev, pChan, data_buffer[0]);
+                    data_buffer[0] = pChan->rate;
                     }
 
                 pChan = pFd->record;
                 if (pChan != NULL)
                     {
-                    pChan->rate = data_buffer[0];
-                    METHOD_CALL(pDev, pcm_channel_setspeed, pChan, pChan->rate);
+                    ossAudioSetSpeed (pDev, pChan, data_buffer[0]);
+                    data_buffer[0] = pChan->rate;
                     }
                 break;
 
@@ -638,49 +1401,41 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                 pChan = pFd->play;
                 if (pChan != NULL)
                     {
-                    pChan->afmt = data_buffer[0];
-                    METHOD_CALL(pDev, pcm_channel_setformat, pChan, pChan->afmt);
+                    ossAudioSetFormat (pDev, pChan, data_buffer[0], pChan->channels);
+                    data_buffer[0] = pChan->afmt;
                     }
 
                 pChan = pFd->record;
                 if (pChan != NULL)
                     {
-                    pChan->afmt = data_buffer[0];
-                    METHOD_CALL(pDev, pcm_channel_setformat, pChan, pChan->afmt);
+                    ossAudioSetFormat (pDev, pChan, data_buffer[0], pChan->channels);
+                    data_buffer[0] = pChan->afmt;
                     }
                 break;
                 
             case SNDCTL_DSP_STEREO:
                 pChan = pFd->play;
-                if (pChan != NULL)
-                    {
-                    if (data_buffer[0] == 1)
-                        pChan->channels = 2;
-                    else if (data_buffer[0] == 0)
-                        pChan->channels = 1;
-                    }
+                if ((pChan != NULL) && ((data_buffer[0] == 0) || (data_buffer[0] == 1)))
+                    ossAudioSetFormat (pDev, pChan, pChan->afmt, data_buffer[0] + 1);
                 
                 pChan = pFd->record;
-                if (pChan != NULL)
-                    {
-                    if (data_buffer[0] == 1)
-                        pChan->channels = 2;
-                    else if (data_buffer[0] == 0)
-                        pChan->channels = 1;
-                    }
+                if ((pChan != NULL) && ((data_buffer[0] == 0) || (data_buffer[0] == 1)))
+                    ossAudioSetFormat (pDev, pChan, pChan->afmt, data_buffer[0] + 1);
                 break;
 
             case SNDCTL_DSP_CHANNELS:
                 pChan = pFd->play;
                 if (pChan != NULL)
                     {
-                    pChan->channels = data_buffer[0];
+                    ossAudioSetFormat (pDev, pChan, pChan->afmt, data_buffer[0]);
+                    data_buffer[0] = pChan->channels;
                     }
                 
                 pChan = pFd->record;
                 if (pChan != NULL)
                     {
-                    pChan->channels = data_buffer[0];
+                    ossAudioSetFormat (pDev, pChan, pChan->afmt, data_buffer[0]);
+                    data_buffer[0] = pChan->channels;
                     }
                 break;
             
@@ -690,41 +1445,28 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                     data_buffer[0] = pChan->afmts;
                 break;
 
-            case SNDCTL_DSP_GETOSPACE:
-                pChan = pFd->play;
-                if ((pChan != NULL) && (data_buffer != NULL))
+            case SNDCTL_DSP_MAPINBUF:
+                if (ossAudioMap (pFd->record, (buffmem_desc *)data_buffer) != OK)
                     {
-                    struct audio_buf_info* info = (struct audio_buf_info*)data_buffer;
-                    memcpy (info, &pChan->abinfo, sizeof(struct audio_buf_info));
+                    semGive (pDspDev->mutex);
+                    return ERROR;
                     }
                 break;
-        
-            case SNDCTL_DSP_GETISPACE:
-                pChan = pFd->record;
-                if ((pChan != NULL) && (data_buffer != NULL))
+
+            case SNDCTL_DSP_MAPOUTBUF:
+                if (ossAudioMap (pFd->play, (buffmem_desc *)data_buffer) != OK)
                     {
-                    struct audio_buf_info* info = (struct audio_buf_info*)data_buffer;
-                    memcpy (info, &pChan->abinfo, sizeof(struct audio_buf_info));
+                    semGive (pDspDev->mutex);
+                    return ERROR;
                     }
                 break;
-            
-            case SNDCTL_DSP_GETIPTR:
-                pChan = pFd->record;
-                if (pChan != NULL)
-                    data_buffer[0] = METHOD_CALL(pDev, pcm_channel_getptr, pChan);
-                break;
-
-            case SNDCTL_DSP_GETOPTR:
-                pChan = pFd->record;
-                if (pChan != NULL)
-                    data_buffer[0] = METHOD_CALL(pDev, pcm_channel_getptr, pChan);
-                break;
 
             case SNDCTL_DSP_GETCAPS:
                 pChan = ((pFd->play == NULL) ? pFd->record : pFd->play);
                 if (pChan != NULL)
                     {
-                    PCMCHAN_CAPS *caps = (PCMCHAN_CAPS*) METHOD_CALL(pDev, pcm_channel_getcaps, pChan);
+                    PCMCHAN_CAPS *caps = (PCMCHAN_CAPS*) METHOD_CALL(pDev, pcm_channel_getcaps,
+                                                    (pChan->parent != NULL) ? pChan->parent : pChan);
                     data_buffer[0] = caps->caps;
                     }
                 break;
@@ -733,7 +1475,7 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                 if ((pFd->play) && (~pFd->play->flags & CHAN_FLAG_TRIGGER))
                     data_buffer[0] |= PCM_ENABLE_OUTPUT;
             
-                if ((pFd->record) && (~pFd->play->flags & CHAN_FLAG_TRIGGER))
+                if ((pFd->record) && (~pFd->record->flags & CHAN_FLAG_TRIGGER))
                     data_buffer[0] |= PCM_ENABLE_INPUT;
                 break;
 
@@ -743,13 +1485,18 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                     {
                     if (data_buffer[0] & PCM_ENABLE_OUTPUT)
                         {
-                        METHOD_CALL(pDev, pcm_channel_trigger, pChan, PCMTRIG_START);
-                        pChan->flags |= CHAN_FLAG_TRIGGER;
+                        if ((pChan->flags & CHAN_FLAG_TRIGGER) &&
+                            (ossAudioTrigger (pDspDev, pChan, PCMTRIG_START) == OK))
+                            pChan->flags &= ~CHAN_FLAG_TRIGGER;
                         }
                     else
                         {
-                        METHOD_CALL(pDev, pcm_channel_trigger, pChan, PCMTRIG_ABORT);
-                        pChan->flags &= ~CHAN_FLAG_TRIGGER;
+                        ossAudioTrigger (pDspDev, pChan, PCMTRIG_ABORT);
+                        pChan->flags |= CHAN_FLAG_TRIGGER;
+
+                        /* the engine restarts from the top of the ring */
+
+                        ossAudioReset (pChan);
                         }
                     }
 
@@ -758,13 +1505,18 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                     {
                     if (data_buffer[0] & PCM_ENABLE_INPUT)
                         {
-                        METHOD_CALL(pDev, pcm_channel_trigger, pChan, PCMTRIG_START);
-                        pChan->flags |= CHAN_FLAG_TRIGGER;
+                        if ((pChan->flags & CHAN_FLAG_TRIGGER) &&
+                            (METHOD_CALL(pDev, pcm_channel_trigger, pChan, PCMTRIG_START) == OK))
+                            pChan->flags &= ~CHAN_FLAG_TRIGGER;
                         }
                     else
                         {
                         METHOD_CALL(pDev, pcm_channel_trigger, pChan, PCMTRIG_ABORT);
-                        pChan->flags &= ~CHAN_FLAG_TRIGGER;
+                        pChan->flags |= CHAN_FLAG_TRIGGER;
+
+                        /* the engine restarts from the top of the ring */
+
+                        ossAudioReset (pChan);
                         }
                     }
                 break;
@@ -773,20 +1525,18 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                 pChan = pFd->play;
                 if (pChan)
                     {
-                    METHOD_CALL(pDspDev->pDev, pcm_channel_stop, pChan);
+                    ossAudioStop (pDspDev, pChan);
                     /* channel reset operation */
-                    sndbuf_reset(pChan->sndbuf);
-                    pChan->semcnt = sndbuf_getblkcnt(pChan->sndbuf);
-                    semCInitialize((char*)pChan->sem, SEM_Q_FIFO , pChan->semcnt);
+                    ossAudioReset (pChan);
+                    pChan->flags |= CHAN_FLAG_TRIGGER;
                     }
                 pChan = pFd->record;
                 if (pChan)
                     {
                     METHOD_CALL(pDspDev->pDev, pcm_channel_stop, pChan);
                     /* channel reset operation */
-                    sndbuf_reset(pChan->sndbuf);
-                    pChan->semcnt = sndbuf_getblkcnt(pChan->sndbuf);
-                    semCInitialize((char*)pChan->sem, SEM_Q_FIFO , pChan->semcnt);
+                    ossAudioReset (pChan);
+                    pChan->flags |= CHAN_FLAG_TRIGGER;
                     }
                 break;
 
@@ -795,22 +1545,76 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
                 if (pChan)
                     ossAudioSync(pDspDev, pFd->play);
                 break;
+
+            case SNDCTL_DSP_NONBLOCK:
+                pFd->flags |= DSP_FD_NONBLOCK;
+                break;
+
+            case SNDCTL_DSP_SETTIMEOUT:
+                if ((int)data_buffer[0] < 0)
+                    pFd->timeout = WAIT_FOREVER;
+                else
+                    pFd->timeout = ((int)data_buffer[0] * sysClkRateGet() + 999) / 1000;
+                break;
+
+            case SNDCTL_DSP_SRCQUALITY:
+                if (((int)data_buffer[0] < OSS_RS_LOW) ||
+                    ((int)data_buffer[0] > OSS_RS_HIGH))
+                    {
+                    semGive (pDspDev->mutex);
+                    return ERROR;
+                    }
+
+                pChan = pFd->play;
+                if (pChan != NULL)
+                    {
+                    pChan->quality = data_buffer[0];
+                    ossAudioSetup (pChan);
+                    }
+
+                pChan = pFd->record;
+                if (pChan != NULL)
+                    {
+                    pChan->quality = data_buffer[0];
+                    ossAudioSetup (pChan);
+                    }
+                break;
+
+            /* volume of a virtual channel: left | right << 8, 0..100 each */
+
+            case SNDCTL_DSP_SETOUTVOL:
+                pChan = pFd->play;
+                if ((pChan == NULL) || (pChan->parent == NULL))
+                    {
+                    semGive (pDspDev->mutex);
+                    return ERROR;
+                    }
+
+                pChan->volume = (MIN(data_buffer[0] & 0xff, 100)) |
+                                (MIN((data_buffer[0] >> 8) & 0xff, 100) << 8);
+                data_buffer[0] = pChan->volume;
+                break;
+
+            case SNDCTL_DSP_GETOUTVOL:
+                pChan = pFd->play;
+                if ((pChan == NULL) || (pChan->parent == NULL))
+                    {
+                    semGive (pDspDev->mutex);
+                    return ERROR;
+                    }
+
+                data_buffer[0] = pChan->volume;
+                break;
                 
                 /* list of unsupported ioctls so far */                    
             case SNDCTL_DSP_POST:
             case SNDCTL_DSP_PROFILE:
             case SNDCTL_DSP_SETDUPLEX:
-            case SNDCTL_DSP_NONBLOCK:
-            case SNDCTL_DSP_GETODELAY:
-            case SNDCTL_DSP_MAPINBUF:	
-            case SNDCTL_DSP_MAPOUTBUF:	
             case SNDCTL_DSP_SETSYNCRO:
             case SOUND_PCM_READ_RATE:
             case SOUND_PCM_READ_BITS:
             case SOUND_PCM_WRITE_FILTER:
             case SOUND_PCM_READ_FILTER:
-            case SNDCTL_DSP_SETOUTVOL:
-            case SNDCTL_DSP_GETOUTVOL:
             default:
                 semGive (pDspDev->mutex);
                 return ERROR;
@@ -827,22 +1631,33 @@ LOCAL int ossAudioIoctl (void * pFileDesc, UINT32 function,  _Vx_ioctl_arg_t arg
         {
         case FIOSELECT:
             selNodeAdd (&pDspDev->selWakeupList, (SEL_WAKEUP_NODE *)arg);
+
+            /* ready once a fragment can be moved; a mapped ring waits for the next one */
+
             if(selWakeupType ((SEL_WAKEUP_NODE *) arg) == SELREAD)
                 {
                 pChan = pFd->record;
-                if(pChan->semcnt == 0)
+                if ((pChan != NULL) && ((pChan->flags & CHAN_FLAG_MMAP) == 0) &&
+                    (sndbuf_getready(pChan->sndbuf) >= sndbuf_getblksz(pChan->sndbuf)))
                     selWakeup ((SEL_WAKEUP_NODE *) arg);
                 }
             else if(selWakeupType ((SEL_WAKEUP_NODE *) arg) == SELWRITE)
                 {
                 pChan = pFd->play;
-                if(pChan->semcnt == 0)
+                if ((pChan != NULL) && ((pChan->flags & CHAN_FLAG_MMAP) == 0) &&
+                    (sndbuf_getfree(pChan->sndbuf) >= sndbuf_getblksz(pChan->sndbuf)))
                     selWakeup ((SEL_WAKEUP_NODE *) arg);
                 }
             break;
         case FIOUNSELECT:
             selNodeDelete (&pDspDev->selWakeupList, (SEL_WAKEUP_NODE *)arg);
             break;
+        case FIONBIO:
+            if (*(int *)arg)
+                pFd->flags |= DSP_FD_NONBLOCK;
+            else
+                pFd->flags &= ~DSP_FD_NONBLOCK;
+            break;
         default:
             break;
         }
@@ -860,12 +1675,21 @@ int osschannel_init (VXB_DEVICE_ID pDev, DSP_DEV * pDspDev, int dir, void * devi
     pChan->dir = dir;
 
     pChan->stream = devinfo;
-    pChan->afmts = (AFMT_U8 | AFMT_S16_LE | AFMT_S32_LE);
+    pChan->afmts = OSS_CVT_FMTS;
+
+    pChan->selList = &pDspDev->selWakeupList;
 
     METHOD_CALL(pChan->pDev, pcm_channel_init, devinfo, pChan->sndbuf, pChan, dir);
 
-    pChan->semcnt = sndbuf_getblkcnt(pChan->sndbuf);
-    semCInitialize((char*)pChan->sem, SEM_Q_FIFO, pChan->semcnt);
+    /* 16 bit stereo at 48 kHz until the application selects a format */
+
+    pChan->afmt = AFMT_S16_LE;
+    pChan->channels = 2;
+    pChan->hwfmt = AFMT_S16_LE;
+    pChan->hwchannels = 2;
+    pChan->quality = OSS_RS_QUALITY_DEFAULT;
+    pChan->rate = pChan->hwrate = METHOD_CALL(pChan->pDev, pcm_channel_setspeed, pChan, 48000);
+    ossAudioSetup (pChan);
 
     return 0;
     }
@@ -875,19 +1699,44 @@ int osschannel_init (VXB_DEVICE_ID pDev, DSP_DEV * pDspDev, int dir, void * devi
 void osschannel_intr (PCM_CHANNEL* pChan)
     {
     SND_BUF * b = pChan->sndbuf;
-
-    b->tail += sndbuf_getblksz(b);
-    b->tail = b->tail % sndbuf_getsize(b);
-    pChan->semcnt++;
-    semGive(pChan->sem);
-
-#if 0
-    if(pChan->dir == 1)
-        logMsg("%s: b->tail= x%x, semcnt= %d\n", (int)__func__,(int)b->tail,pChan->semcnt,4,5,6);
-    
-    if (pChan->semcnt > sndbuf_getblkcnt(pChan->sndbuf))
+    INT32 blksz = sndbuf_getblksz(b);
+    INT32 fill, level;
+    BOOL wake;
+
+    /* sndbuf_engine() relies on tail moving before tcount */
+
+    b->tail = (b->tail + blksz) % sndbuf_getsize(b);
+    b->tcount += blksz;
+    pChan->blocks++;
+
+    /*
+     * Signal only when the level crosses a threshold the application side
+     * may be waiting on: a fragment of room or of data, or, for playback,
+     * the ring running dry.  A mapped ring is not accounted, so select()
+     * is woken for every fragment.
+     */
+
+    if (pChan->flags & CHAN_FLAG_MMAP)
+        wake = TRUE;
+    else if (pChan->dir == PCM_DIR_PLAY)
         {
-        logMsg("Problem, semcnt is %d\n", pChan->semcnt, 2,3,4,5,6);
+        fill = (INT32)(b->hcount - b->tcount);
+        level = sndbuf_getsize(b) - fill;
+        wake = ((level >= blksz) && (level - blksz < blksz)) ||
+               ((fill <= 0) && (fill + blksz > 0));
         }
-#endif
+    else
+        {
+        level = (INT32)(b->tcount - b->hcount);
+        wake = (level >= blksz) && (level - blksz < blksz);
+        }
+
+    if (!wake)
+        return;
+
+    semGive (pChan->sem);
+
+    if (pChan->selList != NULL)
+        selWakeupAll (pChan->selList,
+                      (pChan->dir == PCM_DIR_PLAY) ? SELWRITE : SELREAD);
     }
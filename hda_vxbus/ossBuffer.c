@@ -33,6 +33,9 @@ modification history
 
 #include "audio/ossAudio.h"
 
+LOCAL UINT32 sndbuf_engine (SND_BUF *b, int *tail);
+LOCAL void sndbuf_resync (SND_BUF *b, int dir);
+
 STATUS sndbuf_alloc (SND_BUF *b, VXB_DMA_TAG_ID dmatag, int dmaflags, unsigned int size)
     {
     STATUS status = ERROR;
@@ -60,15 +63,6 @@ STATUS sndbuf_alloc (SND_BUF *b, VXB_DMA_TAG_ID dmatag, int dmaflags, unsigned i
         return status;
         }
 
-    /* Create shadow buffer for audio format convertion */
-    
-#define HDA_BUFSZ_DEFAULT       (65536*2)
-
-    if ((b->shadow_buf_addr = (void*)malloc(HDA_BUFSZ_DEFAULT)) == NULL)
-        return status;
-
-#undef HDA_BUFSZ_DEFAULT
-
     status = sndbuf_resize (b, 2, b->maxsize / 2);
     return status;
     }
@@ -83,10 +77,16 @@ SND_BUF * sndbuf_create(VXB_DEVICE_ID dev, struct pcm_channel *channel)
 	return b;
     }
 
+/*
+ * The engine restarts from the top of the ring.  tcount keeps counting so
+ * the byte totals reported to applications never go backwards.
+ */
+
 void sndbuf_reset(SND_BUF *b)
     {
     b->tail = 0;
     b->head = 0;
+    b->hcount = b->tcount;
     }
 
 void sndbuf_free(SND_BUF *b)
@@ -99,9 +99,6 @@ void sndbuf_free(SND_BUF *b)
         if (b->dma_tag)
             vxbDmaBufMemFree (b->dma_tag, b->buf_addr, b->dma_map);
         }
-    if(b->shadow_buf_addr)
-        free(b->shadow_buf_addr);
-    
     b->bufsize = 0;
 	b->maxsize = 0;
 	b->buf_addr = NULL;
@@ -125,84 +122,161 @@ STATUS sndbuf_resize(SND_BUF *b, unsigned int blkcnt, unsigned int blksz)
     b->bufsize = b->blksz * b->blkcnt;
     b->head = 0;
     b->tail = 0;
+    b->hcount = b->tcount;
     
     return status;
     }
 
+/*
+ * Sample the engine side of the ring.  osschannel_intr() moves tail before
+ * tcount, so the pair is read again until tcount held still.
+ */
+
+LOCAL UINT32 sndbuf_engine (SND_BUF *b, int *tail)
+    {
+    UINT32 count;
+
+    do
+        {
+        count = b->tcount;
+        *tail = b->tail;
+        } while (count != b->tcount);
+
+    return count;
+    }
+
+/*
+ * Bytes the application may write into a playback ring.  Once the engine
+ * has run past the data, the fragment it is playing is lost and the rest
+ * of the ring is free again.
+ */
+
+UINT32 sndbuf_getfree (SND_BUF *b)
+    {
+    INT32 fill = (INT32)(b->hcount - b->tcount);
+
+    if (fill < 0)
+        fill = sndbuf_getblksz(b);
+
+    return sndbuf_getsize(b) - fill;
+    }
+
+/*
+ * Bytes the application may read from a capture ring.  At most one
+ * fragment short of the ring: the engine is filling the last one.
+ */
+
+UINT32 sndbuf_getready (SND_BUF *b)
+    {
+    UINT32 ready = b->tcount - b->hcount;
+
+    return min (ready, sndbuf_getsize(b) - sndbuf_getblksz(b));
+    }
+
+/*
+ * Move the application side one fragment ahead of the engine after an
+ * underrun (playback) or overrun (capture), matching what sndbuf_getfree()
+ * and sndbuf_getready() report.  Only the task doing the I/O calls this.
+ */
+
+LOCAL void sndbuf_resync (SND_BUF *b, int dir)
+    {
+    UINT32 tcount;
+    int tail;
+
+    tcount = sndbuf_engine (b, &tail);
+    b->head = (tail + sndbuf_getblksz(b)) % sndbuf_getsize(b);
+    if (dir == PCM_DIR_PLAY)
+        b->hcount = tcount + sndbuf_getblksz(b);
+    else
+        b->hcount = tcount - (sndbuf_getsize(b) - sndbuf_getblksz(b));
+    }
+
 size_t sndbuf_copy (const char *source, SND_BUF * b, size_t nbytes)
     {
     caddr_t bufaddr;
-    signed int limit, delta, size, len, len2;
-    signed int h,t;
-    
+    UINT32 size, len;
+
     bufaddr = (caddr_t)(UINT32)sndbuf_getbufaddr(b);
     size = sndbuf_getsize (b);
 
-    h = b->head;
-    t = b->tail;
-    
-    delta = h - t;
-    limit = 0;
-
-    if (delta > 0)
-        {
-        len = size - h;
-        len = min(len, nbytes);
+    if ((INT32)(b->hcount - b->tcount) < 0)
+        sndbuf_resync (b, PCM_DIR_PLAY);
 
-        bcopy (source, bufaddr + h, len);
-        limit += len;
-        }
-    else if (delta < 0)
-        {
-        len = t - h;
-        len = min(len, nbytes);
+    nbytes = min (nbytes, sndbuf_getfree (b));
 
-        bcopy (source, bufaddr + h, len);
-        limit += len;
-        }
-    else /* delta == 0 */
-        {
-        len = sndbuf_getsize(b) - h;
-        len = min(len, nbytes);
-        bcopy (source, bufaddr + h, len);
-        limit += len;
-
-        len2 = min(h, nbytes - len);
-        if (len2 > 0)
-            {
-            bcopy (source + len, bufaddr, len2);
-            limit += len2;
-            }
-        }
+    len = min (size - b->head, nbytes);
+    bcopy (source, bufaddr + b->head, len);
+    if (nbytes > len)
+        bcopy (source + len, bufaddr, nbytes - len);
 
-    h = h + limit;
-    h = h % size;
-    b->head = h;
+    b->head = (b->head + nbytes) % size;
+    b->hcount += nbytes;
 
-    return limit;
+    return nbytes;
     }
 
 size_t sndbuf_read (char *dest, SND_BUF * b, size_t nbytes)
     {
     caddr_t bufaddr;
-    signed int limit, bufsize, len;
-    signed int h,t;
-    
+    UINT32 size, len;
+
     bufaddr = (caddr_t)(UINT32)sndbuf_getbufaddr(b);
-    bufsize = sndbuf_getsize (b);
+    size = sndbuf_getsize (b);
 
-    h = b->head;
-    t = b->tail;
+    if ((b->tcount - b->hcount) > (size - sndbuf_getblksz(b)))
+        sndbuf_resync (b, PCM_DIR_REC);
 
-    len = min (nbytes, sndbuf_getblksz(b));
-    limit = sndbuf_getblksz(b);
+    nbytes = min (nbytes, sndbuf_getready (b));
 
-    bcopy (bufaddr + h, dest, len);
+    len = min (size - b->head, nbytes);
+    bcopy (bufaddr + b->head, dest, len);
+    if (nbytes > len)
+        bcopy (bufaddr, dest + len, nbytes - len);
 
-    h = h + limit;
-    h = h % bufsize;
-    b->head = h;
+    b->head = (b->head + nbytes) % size;
+    b->hcount += nbytes;
 
-    return len;
+    return nbytes;
     }
 
+/*
+ * The part of the ring the application side can touch in place: the room
+ * (playback) or the data (capture) from head up to the end of the ring.
+ * *pAddr is set to head and *pLevel to the whole free or ready level,
+ * which continues at the start of the ring.  Underruns and overruns are
+ * resolved first, as in sndbuf_copy() and sndbuf_read().
+ */
+
+UINT32 sndbuf_getseg (SND_BUF *b, int dir, caddr_t *pAddr, UINT32 *pLevel)
+    {
+    UINT32 size, level;
+
+    size = sndbuf_getsize (b);
+
+    if (dir == PCM_DIR_PLAY)
+        {
+        if ((INT32)(b->hcount - b->tcount) < 0)
+            sndbuf_resync (b, PCM_DIR_PLAY);
+        level = sndbuf_getfree (b);
+        }
+    else
+        {
+        if ((b->tcount - b->hcount) > (size - sndbuf_getblksz(b)))
+            sndbuf_resync (b, PCM_DIR_REC);
+        level = sndbuf_getready (b);
+        }
+
+    *pAddr = (caddr_t)(UINT32)sndbuf_getbufaddr(b) + b->head;
+    *pLevel = level;
+
+    return min (level, size - b->head);
+    }
+
+/* account bytes filled or consumed in place after sndbuf_getseg() */
+
+void sndbuf_advance (SND_BUF *b, UINT32 nbytes)
+    {
+    b->head = (b->head + nbytes) % sndbuf_getsize (b);
+    b->hcount += nbytes;
+    }
@@ -0,0 +1,630 @@
+/* ossConvert.c - OSS Audio sample format conversion */
+
+/*
+ * Copyright (c) 2012 Wind River Systems, Inc.
+ *
+ * The right to copy, distribute, modify or otherwise make use
+ * of this software may be licensed only pursuant to the terms
+ * of an applicable Wind River license agreement.
+ */
+
+/*
+  DESCRIPTION
+
+  This file converts the samples an application writes into the format of
+  the DMA ring, and the samples captured into the ring into the format an
+  application reads.  The ring always holds 16 or 32 bit samples and at
+  least two channels, so 8 bit input is widened, 24 bit, 32 bit and float
+  input is narrowed when the codec has no 32 bit format, and mono input is
+  written to both channels.
+
+  8 and 16 bit input also has 32 bit kernels, for the resampler of
+  ossResample.c, which works on 32 bit frames.
+
+  Every supported (application format, mono) -> ring format pair has its
+  own kernel in ossCvtTab[], and every capture pair in ossCapTab[], so the
+  per sample loop carries no format tests.  The kernels are plain C; see
+  ossConvert.h for why they stay clear of the vector registers.
+
+  The kernels access samples in native byte order and need the application
+  buffer aligned to the sample size.  ossCvtGeneric() and ossCapGeneric()
+  go byte by byte and serve big endian targets and unaligned buffers.
+
+  Defining OSS_CVT_HOST builds the file without the VxWorks headers, so
+  hda_test/cvtBench.c can time the kernels on a development host.
+*/
+
+#ifndef OSS_CVT_HOST
+#include <vxWorks.h>
+#include <string.h>
+
+#include "audio/ossAudio.h"
+#else
+#include "audio/ossConvert.h"
+#endif
+
+/* full scale float to left justified 32 bit, clipped */
+
+LOCAL INT32 ossCvtFloat32 (float v)
+    {
+    if (v >= 1.0f)
+        return 0x7fffffff;
+    if (v <= -1.0f)
+        return (INT32)0x80000000;
+
+    return (INT32)(v * 2147483648.0f);
+    }
+
+LOCAL INT16 ossCvtFloat16 (float v)
+    {
+    if (v >= 1.0f)
+        return 0x7fff;
+    if (v <= -1.0f)
+        return (INT16)0x8000;
+
+    return (INT16)(v * 32768.0f);
+    }
+
+#define OSS_CVT_U8(s)       ((INT16)(((s) ^ 0x80) << 8))
+#define OSS_CVT_U8W(s)      ((INT32)((UINT32)((s) ^ 0x80) << 24))
+#define OSS_CVT_S16W(s)     ((INT32)((UINT32)(s) << 16))
+#define OSS_CVT_SAME(s)     (s)
+#define OSS_CVT_S24H(s)     ((INT16)((UINT32)(s) >> 8))
+#define OSS_CVT_S24W(s)     ((INT32)((UINT32)(s) << 8))
+#define OSS_CVT_S32H(s)     ((INT16)((s) >> 16))
+#define OSS_CVT_F16(s)      ossCvtFloat16 (s)
+#define OSS_CVT_F32(s)      ossCvtFloat32 (s)
+
+/* a kernel for interleaved input, and one that duplicates mono input */
+
+#define OSS_CVT_KERNEL(name, stype, dtype, conv)                        \
+LOCAL void name (void * dst, const void * src, UINT32 samples)          \
+    {                                                                   \
+    const stype * s = (const stype *)src;                               \
+    dtype * d = (dtype *)dst;                                           \
+    UINT32 i;                                                           \
+                                                                        \
+    for (i = 0; i < samples; i++)                                       \
+        d[i] = conv (s[i]);                                             \
+    }
+
+#define OSS_CVT_KERNEL_MONO(name, stype, dtype, conv)                   \
+LOCAL void name (void * dst, const void * src, UINT32 samples)          \
+    {                                                                   \
+    const stype * s = (const stype *)src;                               \
+    dtype * d = (dtype *)dst;                                           \
+    dtype v;                                                            \
+    UINT32 i;                                                           \
+                                                                        \
+    for (i = 0; i < samples; i++)                                       \
+        {                                                               \
+        v = conv (s[i]);                                                \
+        d[2 * i] = v;                                                   \
+        d[2 * i + 1] = v;                                               \
+        }                                                               \
+    }
+
+OSS_CVT_KERNEL(ossCvtU8S16,       UINT8, INT16, OSS_CVT_U8)
+OSS_CVT_KERNEL(ossCvtS24S16,      INT32, INT16, OSS_CVT_S24H)
+OSS_CVT_KERNEL(ossCvtS32S16,      INT32, INT16, OSS_CVT_S32H)
+OSS_CVT_KERNEL(ossCvtF32S16,      float, INT16, OSS_CVT_F16)
+OSS_CVT_KERNEL(ossCvtU8S32,       UINT8, INT32, OSS_CVT_U8W)
+OSS_CVT_KERNEL(ossCvtS16S32,      INT16, INT32, OSS_CVT_S16W)
+OSS_CVT_KERNEL(ossCvtS24S32,      INT32, INT32, OSS_CVT_S24W)
+OSS_CVT_KERNEL(ossCvtF32S32,      float, INT32, OSS_CVT_F32)
+
+OSS_CVT_KERNEL_MONO(ossCvtU8S16_mono,   UINT8, INT16, OSS_CVT_U8)
+OSS_CVT_KERNEL_MONO(ossCvtS16S16_mono,  INT16, INT16, OSS_CVT_SAME)
+OSS_CVT_KERNEL_MONO(ossCvtS24S16_mono,  INT32, INT16, OSS_CVT_S24H)
+OSS_CVT_KERNEL_MONO(ossCvtS32S16_mono,  INT32, INT16, OSS_CVT_S32H)
+OSS_CVT_KERNEL_MONO(ossCvtF32S16_mono,  float, INT16, OSS_CVT_F16)
+OSS_CVT_KERNEL_MONO(ossCvtU8S32_mono,   UINT8, INT32, OSS_CVT_U8W)
+OSS_CVT_KERNEL_MONO(ossCvtS16S32_mono,  INT16, INT32, OSS_CVT_S16W)
+OSS_CVT_KERNEL_MONO(ossCvtS24S32_mono,  INT32, INT32, OSS_CVT_S24W)
+OSS_CVT_KERNEL_MONO(ossCvtS32S32_mono,  INT32, INT32, OSS_CVT_SAME)
+OSS_CVT_KERNEL_MONO(ossCvtF32S32_mono,  float, INT32, OSS_CVT_F32)
+
+/* packed 24 bit has no C type; the bytes are picked up one by one */
+
+LOCAL void ossCvtS24PS16 (void * dst, const void * src, UINT32 samples)
+    {
+    const UINT8 * s = (const UINT8 *)src;
+    INT16 * d = (INT16 *)dst;
+    UINT32 i;
+
+    for (i = 0; i < samples; i++, s += 3)
+        d[i] = (INT16)(s[1] | (s[2] << 8));
+    }
+
+LOCAL void ossCvtS24PS16_mono (void * dst, const void * src, UINT32 samples)
+    {
+    const UINT8 * s = (const UINT8 *)src;
+    INT16 * d = (INT16 *)dst;
+    UINT32 i;
+
+    for (i = 0; i < samples; i++, s += 3)
+        d[2 * i] = d[2 * i + 1] = (INT16)(s[1] | (s[2] << 8));
+    }
+
+LOCAL void ossCvtS24PS32 (void * dst, const void * src, UINT32 samples)
+    {
+    const UINT8 * s = (const UINT8 *)src;
+    INT32 * d = (INT32 *)dst;
+    UINT32 i;
+
+    for (i = 0; i < samples; i++, s += 3)
+        d[i] = (INT32)((s[0] << 8) | (s[1] << 16) | ((UINT32)s[2] << 24));
+    }
+
+LOCAL void ossCvtS24PS32_mono (void * dst, const void * src, UINT32 samples)
+    {
+    const UINT8 * s = (const UINT8 *)src;
+    INT32 * d = (INT32 *)dst;
+    UINT32 i;
+
+    for (i = 0; i < samples; i++, s += 3)
+        d[2 * i] = d[2 * i + 1] =
+            (INT32)((s[0] << 8) | (s[1] << 16) | ((UINT32)s[2] << 24));
+    }
+
+/* same format on both sides: a plain copy */
+
+LOCAL void ossCvtCopy16 (void * dst, const void * src, UINT32 samples)
+    {
+    memcpy (dst, src, samples * sizeof(INT16));
+    }
+
+LOCAL void ossCvtCopy32 (void * dst, const void * src, UINT32 samples)
+    {
+    memcpy (dst, src, samples * sizeof(INT32));
+    }
+
+LOCAL const OSS_CVT ossCvtTab[] =
+    {
+    { AFMT_U8,         FALSE, AFMT_S16_LE, ossCvtU8S16,         "u8-s16"      },
+    { AFMT_U8,         TRUE,  AFMT_S16_LE, ossCvtU8S16_mono,    "u8m-s16"     },
+    { AFMT_S16_LE,     FALSE, AFMT_S16_LE, ossCvtCopy16,        "s16-s16"     },
+    { AFMT_S16_LE,     TRUE,  AFMT_S16_LE, ossCvtS16S16_mono,   "s16m-s16"    },
+    { AFMT_U8,         FALSE, AFMT_S32_LE, ossCvtU8S32,         "u8-s32"      },
+    { AFMT_U8,         TRUE,  AFMT_S32_LE, ossCvtU8S32_mono,    "u8m-s32"     },
+    { AFMT_S16_LE,     FALSE, AFMT_S32_LE, ossCvtS16S32,        "s16-s32"     },
+    { AFMT_S16_LE,     TRUE,  AFMT_S32_LE, ossCvtS16S32_mono,   "s16m-s32"    },
+    { AFMT_S24_LE,     FALSE, AFMT_S32_LE, ossCvtS24S32,        "s24-s32"     },
+    { AFMT_S24_LE,     TRUE,  AFMT_S32_LE, ossCvtS24S32_mono,   "s24m-s32"    },
+    { AFMT_S24_LE,     FALSE, AFMT_S16_LE, ossCvtS24S16,        "s24-s16"     },
+    { AFMT_S24_LE,     TRUE,  AFMT_S16_LE, ossCvtS24S16_mono,   "s24m-s16"    },
+    { AFMT_S24_PACKED, FALSE, AFMT_S32_LE, ossCvtS24PS32,       "s24p-s32"    },
+    { AFMT_S24_PACKED, TRUE,  AFMT_S32_LE, ossCvtS24PS32_mono,  "s24pm-s32"   },
+    { AFMT_S24_PACKED, FALSE, AFMT_S16_LE, ossCvtS24PS16,       "s24p-s16"    },
+    { AFMT_S24_PACKED, TRUE,  AFMT_S16_LE, ossCvtS24PS16_mono,  "s24pm-s16"   },
+    { AFMT_S32_LE,     FALSE, AFMT_S32_LE, ossCvtCopy32,        "s32-s32"     },
+    { AFMT_S32_LE,     TRUE,  AFMT_S32_LE, ossCvtS32S32_mono,   "s32m-s32"    },
+    { AFMT_S32_LE,     FALSE, AFMT_S16_LE, ossCvtS32S16,        "s32-s16"     },
+    { AFMT_S32_LE,     TRUE,  AFMT_S16_LE, ossCvtS32S16_mono,   "s32m-s16"    },
+    { AFMT_FLOAT,      FALSE, AFMT_S32_LE, ossCvtF32S32,        "f32-s32"     },
+    { AFMT_FLOAT,      TRUE,  AFMT_S32_LE, ossCvtF32S32_mono,   "f32m-s32"    },
+    { AFMT_FLOAT,      FALSE, AFMT_S16_LE, ossCvtF32S16,        "f32-s16"     },
+    { AFMT_FLOAT,      TRUE,  AFMT_S16_LE, ossCvtF32S16_mono,   "f32m-s16"    },
+    { 0 }
+    };
+
+/*******************************************************************************
+ *
+ * ossCvtFind - look up the kernel for an application format
+ *
+ * RETURNS: the conversion, or NULL if the pair is not supported
+ */
+
+const OSS_CVT * ossCvtFind (int afmt, int channels, int hwfmt)
+    {
+    const OSS_CVT * cvt;
+    BOOL mono = (channels == 1);
+
+    for (cvt = ossCvtTab; cvt->afmt != 0; cvt++)
+        {
+        if ((cvt->afmt == afmt) && (cvt->mono == mono) && (cvt->hwfmt == hwfmt))
+            return cvt;
+        }
+
+    return NULL;
+    }
+
+/* entry <index> of the table, NULL past its end */
+
+const OSS_CVT * ossCvtTable (int index)
+    {
+    if ((index < 0) || (index >= (int)NELEMENTS(ossCvtTab) - 1))
+        return NULL;
+
+    return &ossCvtTab[index];
+    }
+
+/* ring format that keeps the resolution of an application format */
+
+int ossCvtHwFormat (int afmt)
+    {
+    if ((afmt == AFMT_U8) || (afmt == AFMT_S16_LE))
+        return AFMT_S16_LE;
+
+    return AFMT_S32_LE;
+    }
+
+/* bytes per sample of an encoding, 0 if unknown */
+
+int ossCvtSampleSize (int afmt)
+    {
+    switch (afmt)
+        {
+        case AFMT_U8:
+            return 1;
+        case AFMT_S16_LE:
+            return 2;
+        case AFMT_S24_PACKED:
+            return 3;
+        case AFMT_S24_LE:
+        case AFMT_S32_LE:
+        case AFMT_FLOAT:
+            return 4;
+        default:
+            return 0;
+        }
+    }
+
+/*******************************************************************************
+ *
+ * ossCvtGeneric - convert sample by sample from little endian bytes
+ *
+ * Every sample is widened to a left justified 32 bit value and then stored
+ * in the ring format.  Float samples are in native byte order.
+ *
+ * RETURNS: N/A
+ */
+
+void ossCvtGeneric (const OSS_CVT * cvt, void * dst, const void * src, UINT32 samples)
+    {
+    const UINT8 * s = (const UINT8 *)src;
+    int size = ossCvtSampleSize (cvt->afmt);
+    int copies = cvt->mono ? 2 : 1;
+    INT16 * d16 = (INT16 *)dst;
+    INT32 * d32 = (INT32 *)dst;
+    UINT32 i;
+    INT32 v;
+    float f = 0.0f;
+    int j;
+
+    for (i = 0; i < samples; i++, s += size)
+        {
+        switch (cvt->afmt)
+            {
+            case AFMT_U8:
+                v = (INT32)((UINT32)(s[0] ^ 0x80) << 24);
+                break;
+            case AFMT_S16_LE:
+                v = (INT32)(((UINT32)s[0] << 16) | ((UINT32)s[1] << 24));
+                break;
+            case AFMT_S24_PACKED:
+            case AFMT_S24_LE:
+                v = (INT32)(((UINT32)s[0] << 8) | ((UINT32)s[1] << 16) |
+                            ((UINT32)s[2] << 24));
+                break;
+            case AFMT_FLOAT:
+                memcpy (&f, s, sizeof(f));
+                v = ossCvtFloat32 (f);
+                break;
+            default:
+                v = (INT32)((UINT32)s[0] | ((UINT32)s[1] << 8) |
+                            ((UINT32)s[2] << 16) | ((UINT32)s[3] << 24));
+                break;
+            }
+
+        /* narrow float by itself so it rounds the way the kernel does */
+
+        for (j = 0; j < copies; j++)
+            {
+            if (cvt->hwfmt == AFMT_S32_LE)
+                *d32++ = v;
+            else if (cvt->afmt == AFMT_FLOAT)
+                *d16++ = ossCvtFloat16 (f);
+            else
+                *d16++ = (INT16)(v >> 16);
+            }
+        }
+    }
+
+/*******************************************************************************
+ *
+ * ossCvtRun - convert samples with the fastest usable routine
+ *
+ * The table kernel is used when it can load the input directly: on a
+ * little endian target with both buffers aligned to their sample size.
+ *
+ * RETURNS: N/A
+ */
+
+void ossCvtRun (const OSS_CVT * cvt, void * dst, const void * src, UINT32 samples)
+    {
+#if _BYTE_ORDER == _LITTLE_ENDIAN
+    ULONG align = ossCvtSampleSize (cvt->afmt);
+    ULONG hwalign = (cvt->hwfmt == AFMT_S32_LE) ? 4 : 2;
+
+    if (align == 3)
+        align = 1;
+
+    if ((((ULONG)src & (align - 1)) == 0) && (((ULONG)dst & (hwalign - 1)) == 0))
+        {
+        cvt->func (dst, src, samples);
+        return;
+        }
+#endif
+
+    ossCvtGeneric (cvt, dst, src, samples);
+    }
+
+/*
+ * Capture runs the other way: ring samples are widened to left justified
+ * 32 bit and stored in the application format.  The ring carries at least
+ * two channels; a mono application gets the average of the first two, and
+ * one that asks for fewer channels than the ring carries gets the first
+ * ones of every frame.
+ */
+
+#define OSS_CAP_LD16(p, i)      ((INT32)((UINT32)((const INT16 *)(p))[i] << 16))
+#define OSS_CAP_LD32(p, i)      (((const INT32 *)(p))[i])
+
+#define OSS_CAP_ST_U8(d, i, v)  (((UINT8 *)(d))[i] = (UINT8)(((v) >> 24) ^ 0x80))
+#define OSS_CAP_ST_S16(d, i, v) (((INT16 *)(d))[i] = (INT16)((v) >> 16))
+#define OSS_CAP_ST_S24(d, i, v) (((INT32 *)(d))[i] = (v) >> 8)
+#define OSS_CAP_ST_S32(d, i, v) (((INT32 *)(d))[i] = (v))
+#define OSS_CAP_ST_F32(d, i, v) (((float *)(d))[i] = (float)(v) * (1.0f / 2147483648.0f))
+#define OSS_CAP_ST_S24P(d, i, v)                                        \
+    (((UINT8 *)(d))[3 * (i)] = (UINT8)((v) >> 8),                       \
+     ((UINT8 *)(d))[3 * (i) + 1] = (UINT8)((v) >> 16),                  \
+     ((UINT8 *)(d))[3 * (i) + 2] = (UINT8)((v) >> 24))
+
+/* a kernel that keeps every ring channel */
+
+#define OSS_CAP_KERNEL(name, load, store)                               \
+LOCAL void name (void * dst, const void * src, UINT32 frames,           \
+                 int hwchannels, int channels)                          \
+    {                                                                   \
+    UINT32 samples = frames * hwchannels;                               \
+    UINT32 i;                                                           \
+    INT32 v;                                                            \
+                                                                        \
+    (void)channels;                                                     \
+                                                                        \
+    for (i = 0; i < samples; i++)                                       \
+        {                                                               \
+        v = load (src, i);                                              \
+        store (dst, i, v);                                              \
+        }                                                               \
+    }
+
+/* kernels that average the first two channels, or pick the first ones */
+
+#define OSS_CAP_KERNEL_MIX(name, load, store)                           \
+LOCAL void name##_mono (void * dst, const void * src, UINT32 frames,    \
+                        int hwchannels, int channels)                   \
+    {                                                                   \
+    UINT32 i, j;                                                        \
+    INT32 v;                                                            \
+                                                                        \
+    (void)channels;                                                     \
+                                                                        \
+    for (i = 0, j = 0; i < frames; i++, j += hwchannels)                \
+        {                                                               \
+        v = (load (src, j) >> 1) + (load (src, j + 1) >> 1);            \
+        store (dst, i, v);                                              \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+LOCAL void name##_extract (void * dst, const void * src, UINT32 frames, \
+                           int hwchannels, int channels)                \
+    {                                                                   \
+    UINT32 i, j, k;                                                     \
+    INT32 v;                                                            \
+    int c;                                                              \
+                                                                        \
+    for (i = 0, j = 0, k = 0; i < frames; i++, j += hwchannels)         \
+        {                                                               \
+        for (c = 0; c < channels; c++, k++)                             \
+            {                                                           \
+            v = load (src, j + c);                                      \
+            store (dst, k, v);                                          \
+            }                                                           \
+        }                                                               \
+    }
+
+OSS_CAP_KERNEL(ossCapS16U8,         OSS_CAP_LD16, OSS_CAP_ST_U8)
+OSS_CAP_KERNEL(ossCapS16S24,        OSS_CAP_LD16, OSS_CAP_ST_S24)
+OSS_CAP_KERNEL(ossCapS16S24P,       OSS_CAP_LD16, OSS_CAP_ST_S24P)
+OSS_CAP_KERNEL(ossCapS16S32,        OSS_CAP_LD16, OSS_CAP_ST_S32)
+OSS_CAP_KERNEL(ossCapS16F32,        OSS_CAP_LD16, OSS_CAP_ST_F32)
+OSS_CAP_KERNEL(ossCapS32U8,         OSS_CAP_LD32, OSS_CAP_ST_U8)
+OSS_CAP_KERNEL(ossCapS32S16,        OSS_CAP_LD32, OSS_CAP_ST_S16)
+OSS_CAP_KERNEL(ossCapS32S24,        OSS_CAP_LD32, OSS_CAP_ST_S24)
+OSS_CAP_KERNEL(ossCapS32S24P,       OSS_CAP_LD32, OSS_CAP_ST_S24P)
+OSS_CAP_KERNEL(ossCapS32F32,        OSS_CAP_LD32, OSS_CAP_ST_F32)
+
+OSS_CAP_KERNEL_MIX(ossCapS16U8,     OSS_CAP_LD16, OSS_CAP_ST_U8)
+OSS_CAP_KERNEL_MIX(ossCapS16S16,    OSS_CAP_LD16, OSS_CAP_ST_S16)
+OSS_CAP_KERNEL_MIX(ossCapS16S24,    OSS_CAP_LD16, OSS_CAP_ST_S24)
+OSS_CAP_KERNEL_MIX(ossCapS16S24P,   OSS_CAP_LD16, OSS_CAP_ST_S24P)
+OSS_CAP_KERNEL_MIX(ossCapS16S32,    OSS_CAP_LD16, OSS_CAP_ST_S32)
+OSS_CAP_KERNEL_MIX(ossCapS16F32,    OSS_CAP_LD16, OSS_CAP_ST_F32)
+OSS_CAP_KERNEL_MIX(ossCapS32U8,     OSS_CAP_LD32, OSS_CAP_ST_U8)
+OSS_CAP_KERNEL_MIX(ossCapS32S16,    OSS_CAP_LD32, OSS_CAP_ST_S16)
+OSS_CAP_KERNEL_MIX(ossCapS32S24,    OSS_CAP_LD32, OSS_CAP_ST_S24)
+OSS_CAP_KERNEL_MIX(ossCapS32S24P,   OSS_CAP_LD32, OSS_CAP_ST_S24P)
+OSS_CAP_KERNEL_MIX(ossCapS32S32,    OSS_CAP_LD32, OSS_CAP_ST_S32)
+OSS_CAP_KERNEL_MIX(ossCapS32F32,    OSS_CAP_LD32, OSS_CAP_ST_F32)
+
+LOCAL void ossCapCopy16 (void * dst, const void * src, UINT32 frames,
+                         int hwchannels, int channels)
+    {
+    (void)channels;
+    memcpy (dst, src, frames * hwchannels * sizeof(INT16));
+    }
+
+LOCAL void ossCapCopy32 (void * dst, const void * src, UINT32 frames,
+                         int hwchannels, int channels)
+    {
+    (void)channels;
+    memcpy (dst, src, frames * hwchannels * sizeof(INT32));
+    }
+
+#define OSS_CAP_ROWS(hwfmt, afmt, same, name, str)                      \
+    { hwfmt, afmt, OSS_CAP_SAME,    same,           str       },        \
+    { hwfmt, afmt, OSS_CAP_MONO,    name##_mono,    str "m"   },        \
+    { hwfmt, afmt, OSS_CAP_EXTRACT, name##_extract, str "x"   }
+
+LOCAL const OSS_CAP ossCapTab[] =
+    {
+    OSS_CAP_ROWS(AFMT_S16_LE, AFMT_U8,         ossCapS16U8,   ossCapS16U8,   "s16-u8"),
+    OSS_CAP_ROWS(AFMT_S16_LE, AFMT_S16_LE,     ossCapCopy16,  ossCapS16S16,  "s16-s16"),
+    OSS_CAP_ROWS(AFMT_S16_LE, AFMT_S24_LE,     ossCapS16S24,  ossCapS16S24,  "s16-s24"),
+    OSS_CAP_ROWS(AFMT_S16_LE, AFMT_S24_PACKED, ossCapS16S24P, ossCapS16S24P, "s16-s24p"),
+    OSS_CAP_ROWS(AFMT_S16_LE, AFMT_S32_LE,     ossCapS16S32,  ossCapS16S32,  "s16-s32"),
+    OSS_CAP_ROWS(AFMT_S16_LE, AFMT_FLOAT,      ossCapS16F32,  ossCapS16F32,  "s16-f32"),
+    OSS_CAP_ROWS(AFMT_S32_LE, AFMT_U8,         ossCapS32U8,   ossCapS32U8,   "s32-u8"),
+    OSS_CAP_ROWS(AFMT_S32_LE, AFMT_S16_LE,     ossCapS32S16,  ossCapS32S16,  "s32-s16"),
+    OSS_CAP_ROWS(AFMT_S32_LE, AFMT_S24_LE,     ossCapS32S24,  ossCapS32S24,  "s32-s24"),
+    OSS_CAP_ROWS(AFMT_S32_LE, AFMT_S24_PACKED, ossCapS32S24P, ossCapS32S24P, "s32-s24p"),
+    OSS_CAP_ROWS(AFMT_S32_LE, AFMT_S32_LE,     ossCapCopy32,  ossCapS32S32,  "s32-s32"),
+    OSS_CAP_ROWS(AFMT_S32_LE, AFMT_FLOAT,      ossCapS32F32,  ossCapS32F32,  "s32-f32"),
+    { 0 }
+    };
+
+/*******************************************************************************
+ *
+ * ossCapFind - look up the capture kernel for an application format
+ *
+ * RETURNS: the conversion, or NULL if the ring cannot supply the channels
+ */
+
+const OSS_CAP * ossCapFind (int hwfmt, int hwchannels, int afmt, int channels)
+    {
+    const OSS_CAP * cap;
+    int mode;
+
+    if ((channels < 1) || (channels > hwchannels))
+        return NULL;
+
+    if (channels == hwchannels)
+        mode = OSS_CAP_SAME;
+    else if (channels == 1)
+        mode = OSS_CAP_MONO;
+    else
+        mode = OSS_CAP_EXTRACT;
+
+    for (cap = ossCapTab; cap->hwfmt != 0; cap++)
+        {
+        if ((cap->hwfmt == hwfmt) && (cap->afmt == afmt) && (cap->mode == mode))
+            return cap;
+        }
+
+    return NULL;
+    }
+
+/* entry <index> of the capture table, NULL past its end */
+
+const OSS_CAP * ossCapTable (int index)
+    {
+    if ((index < 0) || (index >= (int)NELEMENTS(ossCapTab) - 1))
+        return NULL;
+
+    return &ossCapTab[index];
+    }
+
+/*******************************************************************************
+ *
+ * ossCapGeneric - convert captured frames to little endian bytes
+ *
+ * The ring is read in native order; the application samples are stored
+ * byte by byte, float samples in native byte order.
+ *
+ * RETURNS: N/A
+ */
+
+void ossCapGeneric (const OSS_CAP * cap, void * dst, const void * src, UINT32 frames,
+                    int hwchannels, int channels)
+    {
+    UINT8 * d = (UINT8 *)dst;
+    int size = ossCvtSampleSize (cap->afmt);
+    UINT32 i, j;
+    INT32 v;
+    float f;
+    int c;
+
+    for (i = 0, j = 0; i < frames; i++, j += hwchannels)
+        {
+        for (c = 0; c < channels; c++, d += size)
+            {
+            if (cap->hwfmt == AFMT_S32_LE)
+                v = OSS_CAP_LD32 (src, j + c);
+            else
+                v = OSS_CAP_LD16 (src, j + c);
+
+            if (cap->mode == OSS_CAP_MONO)
+                {
+                if (cap->hwfmt == AFMT_S32_LE)
+                    v = (v >> 1) + (OSS_CAP_LD32 (src, j + 1) >> 1);
+                else
+                    v = (v >> 1) + (OSS_CAP_LD16 (src, j + 1) >> 1);
+                }
+
+            switch (cap->afmt)
+                {
+                case AFMT_U8:
+                    d[0] = (UINT8)((v >> 24) ^ 0x80);
+                    break;
+                case AFMT_S16_LE:
+                    d[0] = (UINT8)(v >> 16);
+                    d[1] = (UINT8)(v >> 24);
+                    break;
+                case AFMT_S24_PACKED:
+                    OSS_CAP_ST_S24P (d, 0, v);
+                    break;
+                case AFMT_S24_LE:
+                    v >>= 8;
+                    /* fall through */
+                case AFMT_S32_LE:
+                    d[0] = (UINT8)v;
+                    d[1] = (UINT8)(v >> 8);
+                    d[2] = (UINT8)(v >> 16);
+                    d[3] = (UINT8)(v >> 24);
+                    break;
+                case AFMT_FLOAT:
+                    f = (float)v * (1.0f / 2147483648.0f);
+                    memcpy (d, &f, sizeof(f));
+                    break;
+                }
+            }
+        }
+    }
+
+/*******************************************************************************
+ *
+ * ossCapRun - convert captured frames with the fastest usable routine
+ *
+ * RETURNS: N/A
+ */
+
+void ossCapRun (const OSS_CAP * cap, void * dst, const void * src, UINT32 frames,
+                int hwchannels, int channels)
+    {
+#if _BYTE_ORDER == _LITTLE_ENDIAN
+    ULONG align = ossCvtSampleSize (cap->afmt);
+
+    if (align == 3)
+        align = 1;
+
+    if (((ULONG)dst & (align - 1)) == 0)
+        {
+        cap->func (dst, src, frames, hwchannels, channels);
+        return;
+        }
+#endif
+
+    ossCapGeneric (cap, dst, src, frames, hwchannels, channels);
+    }
@@ -0,0 +1,315 @@
+/* ossResample.c - OSS Audio sample rate converter */
+
+/*
+ * Copyright (c) 2012 Wind River Systems, Inc.
+ *
+ * The right to copy, distribute, modify or otherwise make use
+ * of this software may be licensed only pursuant to the terms
+ * of an applicable Wind River license agreement.
+ */
+
+/*
+  DESCRIPTION
+
+  This file converts between an application sample rate and the rate the
+  codec runs at, for rates the codec does not support itself.  It is a
+  polyphase FIR resampler: the rate ratio is reduced to phases / step, and
+  every output frame is the dot product of taps input frames with one of
+  phases filters cut from a Blackman windowed sinc.  Ratios that need more
+  than OSS_RS_PHASES_MAX phases are rounded to that many, which bends the
+  pitch by well under a cent.
+
+  The quality selects 8, 16 or 32 taps.  The cutoff is placed just below
+  the lower of the two Nyquist rates, so downsampling does not alias; the
+  filter is made longer by the decimation factor to keep its transition
+  band as narrow relative to the cutoff.
+
+  Everything is fixed point: samples are left justified 32 bit, the filter
+  is Q24 and the sums are 64 bit.  The filter design uses an integer sine,
+  and the dot product is plain C, so neither touches the floating point
+  or vector registers (see ossConvert.h).
+
+  Defining OSS_CVT_HOST builds the file without the VxWorks headers, so
+  hda_test/srcBench.c can time it on a development host.
+*/
+
+#ifndef OSS_CVT_HOST
+#include <vxWorks.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio/ossAudio.h"
+#endif
+
+#include "audio/ossResample.h"
+
+/* sine series coefficients (pi/2)^n/n! in Q30 */
+
+#define OSS_RS_S1       1686629713LL
+#define OSS_RS_S3       693598668LL
+#define OSS_RS_S5       85569306LL
+#define OSS_RS_S7       5026995LL
+#define OSS_RS_S9       172272LL
+
+#define OSS_RS_PI_Q16   205887LL
+#define OSS_RS_ROLLOFF  60293           /* cutoff at 0.92 of Nyquist, Q16 */
+
+LOCAL const int ossRsTaps[] = { 8, 16, 32 };
+
+/*******************************************************************************
+ *
+ * ossRsSin - integer sine
+ *
+ * <turn> is the angle in units of 2^-32 of a full turn.  A ninth order
+ * series over a quarter wave keeps the error below 4e-6.
+ *
+ * RETURNS: the sine in Q30
+ */
+
+LOCAL INT32 ossRsSin (UINT32 turn)
+    {
+    UINT32 quadrant = turn >> 30;
+    INT64 x = turn & 0x3fffffff;
+    INT64 x2, r;
+
+    if (quadrant & 1)
+        x = 0x40000000 - x;
+
+    x2 = (x * x) >> 30;
+    r = OSS_RS_S7 - ((OSS_RS_S9 * x2) >> 30);
+    r = OSS_RS_S5 - ((r * x2) >> 30);
+    r = OSS_RS_S3 - ((r * x2) >> 30);
+    r = OSS_RS_S1 - ((r * x2) >> 30);
+    r = (r * x) >> 30;
+
+    return (INT32)((quadrant & 2) ? -r : r);
+    }
+
+/*
+ * Windowed sinc at t (Q16 input frames from the filter center) for a
+ * cutoff fc (Q16 of the input Nyquist rate), in Q30.
+ */
+
+LOCAL INT32 ossRsTap (INT32 t, INT32 fc, int half)
+    {
+    INT64 prod = (INT64)fc * t;             /* fc * t, Q32 */
+    INT64 sinc, win;
+    UINT32 turn;
+
+    if (prod == 0)
+        sinc = 1 << 30;
+    else
+        sinc = ((INT64)ossRsSin ((UINT32)(prod >> 1)) << 32) /
+               ((OSS_RS_PI_Q16 * prod) >> 16);
+
+    /* Blackman: 0.42 + 0.5 cos(pi u) + 0.08 cos(2 pi u), u = t / half */
+
+    turn = (UINT32)(((INT64)t << 15) / half);
+    win = 450971566 + (ossRsSin (turn + 0x40000000) >> 1) +
+          (((INT64)ossRsSin (2 * turn + 0x40000000) * 5243) >> 16);
+
+    return (INT32)((sinc * win) >> 30);
+    }
+
+LOCAL UINT32 ossRsGcd (UINT32 a, UINT32 b)
+    {
+    UINT32 t;
+
+    while (b != 0)
+        {
+        t = a % b;
+        a = b;
+        b = t;
+        }
+
+    return a;
+    }
+
+/*******************************************************************************
+ *
+ * ossRsCreate - create a resampler
+ *
+ * RETURNS: the resampler, or NULL if the ratio is out of range or memory is
+ * short
+ */
+
+OSS_RS * ossRsCreate (int inRate, int outRate, int channels, int quality)
+    {
+    OSS_RS * rs;
+    UINT32 phases, step, g;
+    INT32 * raw;
+    INT32 fc, t;
+    INT64 sum;
+    int half, i, j;
+
+    if ((inRate <= 0) || (outRate <= 0) || (channels < 1) ||
+        (inRate > outRate * OSS_RS_RATIO_MAX) ||
+        (outRate > inRate * OSS_RS_RATIO_MAX))
+        return NULL;
+
+    if ((quality < OSS_RS_LOW) || (quality > OSS_RS_HIGH))
+        quality = OSS_RS_QUALITY_DEFAULT;
+
+    g = ossRsGcd (inRate, outRate);
+    phases = outRate / g;
+    step = inRate / g;
+    if (phases > OSS_RS_PHASES_MAX)
+        {
+        step = (UINT32)(((UINT64)inRate * OSS_RS_PHASES_MAX + outRate / 2) / outRate);
+        phases = OSS_RS_PHASES_MAX;
+        }
+
+    if ((rs = calloc (1, sizeof(OSS_RS))) == NULL)
+        return NULL;
+
+    rs->channels = channels;
+    rs->taps = ossRsTaps[quality];
+    if (inRate > outRate)
+        rs->taps *= (inRate + outRate - 1) / outRate;
+    rs->phases = phases;
+    rs->step = step;
+    rs->outCap = (UINT32)(((UINT64)(OSS_RS_BLOCK + rs->taps) * phases) / step) + 2;
+
+    rs->coef = malloc (phases * rs->taps * sizeof(INT32));
+    rs->in = malloc ((OSS_RS_BLOCK + rs->taps) * channels * sizeof(INT32));
+    rs->out = malloc (rs->outCap * channels * sizeof(INT32));
+    raw = malloc (rs->taps * sizeof(INT32));
+    if ((rs->coef == NULL) || (rs->in == NULL) || (rs->out == NULL) ||
+        (raw == NULL))
+        {
+        free (raw);
+        ossRsDelete (rs);
+        return NULL;
+        }
+
+    /* cut off below the lower Nyquist rate, relative to the input one */
+
+    fc = OSS_RS_ROLLOFF;
+    if (outRate < inRate)
+        fc = (INT32)(((INT64)fc * outRate) / inRate);
+
+    /* phase p sits p / phases of an input frame past tap half - 1 */
+
+    half = rs->taps / 2;
+    for (i = 0; i < (int)phases; i++)
+        {
+        sum = 0;
+        for (j = 0; j < rs->taps; j++)
+            {
+            t = ((j - (half - 1)) << 16) - (INT32)(((UINT32)i << 16) / phases);
+            raw[j] = ossRsTap (t, fc, half);
+            sum += raw[j];
+            }
+
+        for (j = 0; j < rs->taps; j++)
+            rs->coef[i * rs->taps + j] =
+                (INT32)((((INT64)raw[j] << 24) + sum / 2) / sum);
+        }
+
+    free (raw);
+    ossRsReset (rs);
+
+    return rs;
+    }
+
+void ossRsDelete (OSS_RS * rs)
+    {
+    if (rs == NULL)
+        return;
+
+    free (rs->coef);
+    free (rs->in);
+    free (rs->out);
+    free (rs);
+    }
+
+/*
+ * Forget the stream; the history restarts as silence.  With half - 1
+ * frames of it the first output frame lines up with the first input frame.
+ */
+
+void ossRsReset (OSS_RS * rs)
+    {
+    rs->fill = rs->taps / 2 - 1;
+    memset (rs->in, 0, rs->fill * rs->channels * sizeof(INT32));
+    rs->pos = 0;
+    rs->phase = 0;
+    rs->outLen = 0;
+    rs->outPos = 0;
+    }
+
+/* input frames that can be appended at ossRsTail() */
+
+UINT32 ossRsRoom (OSS_RS * rs)
+    {
+    return (OSS_RS_BLOCK + rs->taps) - rs->fill;
+    }
+
+INT32 * ossRsTail (OSS_RS * rs)
+    {
+    return rs->in + rs->fill * rs->channels;
+    }
+
+/*******************************************************************************
+ *
+ * ossRsProcess - resample frames appended at ossRsTail()
+ *
+ * Accounts <frames> new input frames, replaces out[] with every output
+ * frame they complete and drops the input frames no output needs again.
+ *
+ * RETURNS: the frames now in out[]
+ */
+
+UINT32 ossRsProcess (OSS_RS * rs, UINT32 frames)
+    {
+    int channels = rs->channels;
+    int taps = rs->taps;
+    const INT32 * c;
+    const INT32 * x;
+    INT32 * y = rs->out;
+    UINT32 n = 0;
+    UINT32 drop;
+    INT64 acc;
+    int ch, j;
+
+    rs->fill += frames;
+
+    while ((rs->pos + taps <= rs->fill) && (n < rs->outCap))
+        {
+        c = rs->coef + rs->phase * taps;
+        x = rs->in + rs->pos * channels;
+
+        for (ch = 0; ch < channels; ch++, y++)
+            {
+            acc = 0;
+            for (j = 0; j < taps; j++)
+                acc += (INT64)x[j * channels + ch] * c[j];
+
+            acc >>= 24;
+            if (acc > 0x7fffffff)
+                acc = 0x7fffffff;
+            else if (acc < -0x7fffffffLL - 1)
+                acc = -0x7fffffffLL - 1;
+            *y = (INT32)acc;
+            }
+
+        n++;
+        rs->phase += rs->step;
+        rs->pos += rs->phase / rs->phases;
+        rs->phase %= rs->phases;
+        }
+
+    drop = MIN(rs->pos, rs->fill);
+    if (drop > 0)
+        {
+        memmove (rs->in, rs->in + drop * channels,
+                 (rs->fill - drop) * channels * sizeof(INT32));
+        rs->fill -= drop;
+        rs->pos -= drop;
+        }
+
+    rs->outLen = n;
+    rs->outPos = 0;
+
+    return n;
+    }
@@ -0,0 +1,582 @@
+/* ossVchan.c - OSS Audio virtual playback channels */
+
+/*
+ * Copyright (c) 2012 Wind River Systems, Inc.
+ *
+ * The right to copy, distribute, modify or otherwise make use
+ * of this software may be licensed only pursuant to the terms
+ * of an applicable Wind River license agreement.
+ */
+
+/*
+  DESCRIPTION
+
+  This file lets several descriptors play through one /dev/dsp at once.
+  Playback opens first take the device's spare hardware channels, which
+  the codec mixes itself.  Once one hardware channel is left, every
+  further open gets a virtual channel: a PCM_CHANNEL of its own with its
+  own format, rate, volume and a ring in memory, filled by write() exactly
+  like a DMA ring.  A mixer task per device plays the part of the DMA
+  engine for all of them: it sums the virtual rings into that last
+  hardware playback channel, which it owns from then on.
+
+  Virtual rings hold OSS_VMIX_CHANNELS channels of left justified 32 bit
+  samples at the rate of the hardware channel, so format conversion and
+  resampling are done by the writing task in ossAudioIo(), and the mixer
+  only scales and adds.  The sums saturate rather than wrap.  The mixer
+  task is spawned with VX_FP_TASK, so the scale and add uses SSE2 or NEON
+  when the compiler targets them, four samples at a time.
+
+  The mixer is woken by the hardware channel's fragment interrupt and
+  whenever a virtual channel is written.  It fills the hardware ring as
+  far as the virtual channels have data.  If they run dry while the engine
+  is running, it queues silence one fragment ahead, and it stops the
+  engine once a ring's worth of silence has been queued.
+
+  Mixing is off by default: ossVchanMax is 0, so each open gets a hardware
+  channel to itself, with mmap() support and no mixer task in the path,
+  and an open finding none idle fails with EBUSY.  A stream that already
+  owns the hardware channel cannot be moved into a virtual one while its
+  writer may be blocked on that ring or has it mapped, so the mixer has to
+  own the channel from the start.  Setting ossVchanMax, up to
+  OSS_VCHAN_MAX, before the first open enables the mixer; a virtual ring
+  cannot be mapped.
+*/
+
+#include <vxWorks.h>
+#include <semLib.h>
+#include <taskLib.h>
+#include <selectLib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <hwif/vxbus/vxBus.h>
+
+#include "audio/ossAudio.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* frames mixed per pass */
+
+#define OSS_VMIX_FRAMES         256
+
+/* shortest fragment of a virtual ring */
+
+#define OSS_VCHAN_BLK_MIN       256
+
+/* full volume of a virtual channel: 100 left, 100 right */
+
+#define OSS_VCHAN_VOLUME_MAX    (100 | (100 << 8))
+
+#define OSS_VMIX_FRAME          (OSS_VMIX_CHANNELS * sizeof(INT32))
+
+/* virtual channels per device, 0 (the default) disables them */
+
+int ossVchanMax = 0;
+
+typedef struct oss_vmix
+    {
+    DSP_DEV *           pDspDev;
+    PCM_CHANNEL *       hw;     /* hardware channel mixed into */
+    SEM_ID              mutex;  /* guards vchan[] and the virtual rings' tails */
+    int                 tid;    /* mixer task */
+    UINT32              idle;   /* bytes of silence queued since the last sound */
+    PCM_CHANNEL *       vchan[OSS_VCHAN_MAX];
+    INT32               mix[OSS_VMIX_FRAMES * OSS_VMIX_CHANNELS];
+    } OSS_VMIX;
+
+LOCAL void ossVmixTask (OSS_VMIX * vmix);
+LOCAL void ossVmixRun (OSS_VMIX * vmix);
+LOCAL UINT32 ossVmixTake (OSS_VMIX * vmix, PCM_CHANNEL * pChan, UINT32 frames);
+LOCAL void ossVmixAdd (INT32 * d, const INT32 * s, UINT32 samples, const INT32 * gain);
+
+/*******************************************************************************
+ *
+ * ossVmixCreate - start the mixer of a device
+ *
+ * <hw> is the hardware playback channel, already set to a ring format that
+ * takes OSS_VMIX_CHANNELS channels of 32 bit samples through hw->cvt.
+ *
+ * RETURNS: the mixer, or NULL if it could not be started
+ */
+
+OSS_VMIX * ossVmixCreate (DSP_DEV * pDspDev, PCM_CHANNEL * hw)
+    {
+    OSS_VMIX * vmix;
+
+    if ((vmix = calloc (1, sizeof(OSS_VMIX))) == NULL)
+        return NULL;
+
+    vmix->pDspDev = pDspDev;
+    vmix->hw = hw;
+    vmix->mutex = semMCreate (SEM_Q_PRIORITY | SEM_DELETE_SAFE | SEM_INVERSION_SAFE);
+    if (vmix->mutex == NULL)
+        {
+        free (vmix);
+        return NULL;
+        }
+
+    vmix->tid = taskSpawn (OSS_VMIX_TASK_NAME, OSS_VMIX_TASK_PRI, VX_FP_TASK,
+                           OSS_VMIX_TASK_STACK, (void*)ossVmixTask, (int)vmix,
+                           0, 0, 0, 0, 0, 0, 0, 0, 0);
+    if (vmix->tid == ERROR)
+        {
+        semDelete (vmix->mutex);
+        free (vmix);
+        return NULL;
+        }
+
+    return vmix;
+    }
+
+/*******************************************************************************
+ *
+ * ossVmixDelete - stop the mixer of a device
+ *
+ * Every virtual channel belongs to an open descriptor, so none is freed
+ * here: each is detached from the mix and marked CHAN_FLAG_GONE, and a
+ * writer blocked on it is woken.  I/O on the descriptor then fails with
+ * ENXIO, and close() frees the channel.
+ *
+ * RETURNS: N/A
+ */
+
+void ossVmixDelete (OSS_VMIX * vmix)
+    {
+    PCM_CHANNEL * pChan;
+    int i;
+
+    semTake (vmix->mutex, WAIT_FOREVER);
+    taskDelete (vmix->tid);
+
+    METHOD_CALL(vmix->pDspDev->pDev, pcm_channel_stop, vmix->hw);
+
+    for (i = 0; i < OSS_VCHAN_MAX; i++)
+        {
+        if ((pChan = vmix->vchan[i]) != NULL)
+            {
+            vmix->vchan[i] = NULL;
+            pChan->stream = NULL;
+            pChan->selList = NULL;
+            pChan->flags |= CHAN_FLAG_GONE | CHAN_FLAG_TRIGGER;
+            semGive (pChan->sem);
+            }
+        }
+
+    semDelete (vmix->mutex);
+    free (vmix);
+    }
+
+/*******************************************************************************
+ *
+ * ossVchanCreate - add a virtual channel to a mixer
+ *
+ * The channel is stopped, with a ring as long in time as the hardware one
+ * and full volume.  The caller selects its format.
+ *
+ * RETURNS: the channel, or NULL if all are in use or memory is short
+ */
+
+PCM_CHANNEL * ossVchanCreate (OSS_VMIX * vmix)
+    {
+    SND_BUF * hb = vmix->hw->sndbuf;
+    PCM_CHANNEL * pChan;
+    UINT32 size;
+    int i;
+
+    semTake (vmix->mutex, WAIT_FOREVER);
+
+    for (i = 0; (i < ossVchanMax) && (i < OSS_VCHAN_MAX); i++)
+        {
+        if (vmix->vchan[i] == NULL)
+            break;
+        }
+
+    if ((i == ossVchanMax) || (i == OSS_VCHAN_MAX) ||
+        ((pChan = calloc (1, sizeof(PCM_CHANNEL))) == NULL))
+        {
+        semGive (vmix->mutex);
+        return NULL;
+        }
+
+    pChan->pDev = vmix->hw->pDev;
+    pChan->dir = PCM_DIR_PLAY;
+    pChan->refcount = 1;
+    pChan->stream = vmix;
+    pChan->parent = vmix->hw;
+    pChan->volume = OSS_VCHAN_VOLUME_MAX;
+    pChan->flags = CHAN_FLAG_TRIGGER;
+    pChan->sem = semBCreate (SEM_Q_FIFO, SEM_EMPTY);
+    pChan->msem = semMCreate (SEM_Q_FIFO);
+    pChan->sndbuf = sndbuf_create (pChan->pDev, pChan);
+
+    /* as many frames as the hardware ring, in two fragments */
+
+    size = (sndbuf_getmaxsize(hb) /
+            ((vmix->hw->hwfmt == AFMT_S32_LE ? 4 : 2) * vmix->hw->hwchannels)) *
+           OSS_VMIX_FRAME;
+
+    if ((pChan->sem == NULL) || (pChan->msem == NULL) ||
+        (pChan->sndbuf == NULL) ||
+        ((pChan->sndbuf->buf_addr = malloc (size)) == NULL))
+        {
+        semGive (vmix->mutex);
+        ossVchanDelete (pChan);
+        return NULL;
+        }
+
+    pChan->sndbuf->maxsize = size;
+    sndbuf_resize (pChan->sndbuf, 2, size / 2);
+
+    pChan->abinfo.fragsize = sndbuf_getblksz(pChan->sndbuf);
+    pChan->abinfo.fragments = sndbuf_getblkcnt(pChan->sndbuf);
+    pChan->abinfo.fragstotal = pChan->abinfo.fragments;
+    pChan->abinfo.bytes = size;
+
+    vmix->vchan[i] = pChan;
+
+    semGive (vmix->mutex);
+
+    return pChan;
+    }
+
+/* take a virtual channel out of the mix and free it */
+
+void ossVchanDelete (PCM_CHANNEL * pChan)
+    {
+    OSS_VMIX * vmix = pChan->stream;
+    int i;
+
+    if (vmix != NULL)
+        {
+        semTake (vmix->mutex, WAIT_FOREVER);
+        for (i = 0; i < OSS_VCHAN_MAX; i++)
+            {
+            if (vmix->vchan[i] == pChan)
+                vmix->vchan[i] = NULL;
+            }
+        semGive (vmix->mutex);
+        }
+
+    if (pChan->sndbuf != NULL)
+        {
+        free (pChan->sndbuf->buf_addr);
+        pChan->sndbuf->buf_addr = NULL;
+        sndbuf_destroy (pChan->sndbuf);
+        }
+
+    if (pChan->sem != NULL)
+        semDelete (pChan->sem);
+    if (pChan->msem != NULL)
+        semDelete (pChan->msem);
+
+    ossRsDelete (pChan->rs);
+    free (pChan);
+    }
+
+/*******************************************************************************
+ *
+ * ossVchanTrigger - start or stop mixing a virtual channel
+ *
+ * Starting also wakes the mixer, so the caller does it after every write:
+ * the mixer may have stopped the engine while the channel was quiet.  A
+ * stopped channel is left alone by the mixer once this returns.
+ *
+ * RETURNS: OK
+ */
+
+STATUS ossVchanTrigger (PCM_CHANNEL * pChan, int go)
+    {
+    OSS_VMIX * vmix = pChan->stream;
+
+    if (vmix == NULL)
+        return ERROR;
+
+    semTake (vmix->mutex, WAIT_FOREVER);
+    if (go == PCMTRIG_START)
+        pChan->flags &= ~CHAN_FLAG_TRIGGER;
+    else
+        pChan->flags |= CHAN_FLAG_TRIGGER;
+    semGive (vmix->mutex);
+
+    if (go == PCMTRIG_START)
+        semGive (vmix->hw->sem);
+
+    return OK;
+    }
+
+/* SNDCTL_DSP_SETFRAGMENT for a virtual ring, within the memory it has */
+
+int ossVchanSetFragments (PCM_CHANNEL * pChan, UINT32 blksz, UINT32 blkcnt)
+    {
+    OSS_VMIX * vmix = pChan->stream;
+    SND_BUF * b = pChan->sndbuf;
+
+    if (vmix == NULL)
+        return -1;
+
+    blksz -= blksz % OSS_VMIX_FRAME;
+
+    if (blksz > sndbuf_getmaxsize(b) / 2)
+        blksz = sndbuf_getmaxsize(b) / 2;
+    if (blksz < OSS_VCHAN_BLK_MIN)
+        blksz = OSS_VCHAN_BLK_MIN;
+    if (blkcnt < 2)
+        blkcnt = 2;
+    if (blkcnt > sndbuf_getmaxsize(b) / blksz)
+        blkcnt = sndbuf_getmaxsize(b) / blksz;
+
+    semTake (vmix->mutex, WAIT_FOREVER);
+    sndbuf_resize (b, blkcnt, blksz);
+    semGive (vmix->mutex);
+
+    pChan->abinfo.fragsize = blksz;
+    pChan->abinfo.fragments = blkcnt;
+    pChan->abinfo.fragstotal = blkcnt;
+    pChan->abinfo.bytes = blksz * blkcnt;
+
+    return 0;
+    }
+
+/*
+ * Bytes of a virtual ring the mix still has to play: what the mixer has
+ * queued in the hardware ring, counted in whole fragments as the hardware
+ * ring is accounted, and scaled to the virtual ring's frames.
+ */
+
+UINT32 ossVchanDelay (PCM_CHANNEL * pChan)
+    {
+    PCM_CHANNEL * hw = pChan->parent;
+    INT32 fill = (INT32)(hw->sndbuf->hcount - hw->sndbuf->tcount);
+
+    if ((fill <= 0) || (hw->flags & CHAN_FLAG_TRIGGER))
+        return 0;
+
+    return (fill / ((hw->hwfmt == AFMT_S32_LE ? 4 : 2) * hw->hwchannels)) *
+           OSS_VMIX_FRAME;
+    }
+
+/* the mixer task: one pass per fragment interrupt or write */
+
+LOCAL void ossVmixTask (OSS_VMIX * vmix)
+    {
+    FOREVER
+        {
+        semTake (vmix->hw->sem, WAIT_FOREVER);
+
+        semTake (vmix->mutex, WAIT_FOREVER);
+        ossVmixRun (vmix);
+        semGive (vmix->mutex);
+        }
+    }
+
+/*******************************************************************************
+ *
+ * ossVmixRun - fill the hardware ring from the virtual channels
+ *
+ * Mixes OSS_VMIX_FRAMES at a time until the hardware ring is full or the
+ * virtual channels have nothing more.  A virtual channel short of data
+ * adds silence for the rest of the pass.
+ *
+ * RETURNS: N/A
+ */
+
+LOCAL void ossVmixRun (OSS_VMIX * vmix)
+    {
+    PCM_CHANNEL * hw = vmix->hw;
+    SND_BUF * b = hw->sndbuf;
+    UINT32 frame = (hw->hwfmt == AFMT_S32_LE ? 4 : 2) * hw->hwchannels;
+    PCM_CHANNEL * pChan;
+    caddr_t addr;
+    UINT32 seg, level, n, got;
+    int i;
+
+    for (;;)
+        {
+        seg = sndbuf_getseg (b, PCM_DIR_PLAY, &addr, &level);
+        n = MIN(seg / frame, OSS_VMIX_FRAMES);
+        if (n == 0)
+            break;
+
+        memset (vmix->mix, 0, n * OSS_VMIX_FRAME);
+
+        got = 0;
+        for (i = 0; i < OSS_VCHAN_MAX; i++)
+            {
+            pChan = vmix->vchan[i];
+            if ((pChan != NULL) && ((pChan->flags & CHAN_FLAG_TRIGGER) == 0))
+                got = MAX(got, ossVmixTake (vmix, pChan, n));
+            }
+
+        if (got > 0)
+            vmix->idle = 0;
+        else
+            {
+            /*
+             * Nothing to play.  An idle engine stays idle; a running one
+             * gets silence once no more than the fragment it is playing
+             * is queued, and is stopped when only silence is left.
+             */
+
+            if ((hw->flags & CHAN_FLAG_TRIGGER) ||
+                ((INT32)(b->hcount - b->tcount) > (INT32)sndbuf_getblksz(b)))
+                break;
+
+            if (vmix->idle >= sndbuf_getsize(b))
+                {
+                METHOD_CALL(vmix->pDspDev->pDev, pcm_channel_stop, hw);
+                sndbuf_reset (b);
+                hw->flags |= CHAN_FLAG_TRIGGER;
+                vmix->idle = 0;
+                break;
+                }
+
+            got = n;
+            vmix->idle += n * frame;
+            }
+
+        ossCvtRun (hw->cvt, addr, vmix->mix, got * OSS_VMIX_CHANNELS);
+        sndbuf_advance (b, got * frame);
+
+        if ((hw->flags & CHAN_FLAG_TRIGGER) &&
+            (METHOD_CALL(vmix->pDspDev->pDev, pcm_channel_trigger, hw, PCMTRIG_START) == OK))
+            hw->flags &= ~CHAN_FLAG_TRIGGER;
+        }
+    }
+
+/*******************************************************************************
+ *
+ * ossVmixTake - add up to frames of a virtual ring to the mix
+ *
+ * The samples are scaled by the channel's volume and added with
+ * saturation.  The ring is consumed like osschannel_intr() consumes a DMA
+ * ring, and the writer is woken.
+ *
+ * RETURNS: the frames taken
+ */
+
+LOCAL UINT32 ossVmixTake (OSS_VMIX * vmix, PCM_CHANNEL * pChan, UINT32 frames)
+    {
+    SND_BUF * b = pChan->sndbuf;
+    UINT32 size = sndbuf_getsize(b);
+    INT32 gain[2];
+    INT32 * d = vmix->mix;
+    UINT32 fill, taken, k;
+
+    fill = (UINT32)(b->hcount - b->tcount) / OSS_VMIX_FRAME;
+    frames = MIN(frames, fill);
+    if (frames == 0)
+        return 0;
+
+    /* volume 0..100 per side, as a Q31 gain; 100 is just short of 1.0 */
+
+    gain[0] = (INT32)MIN(((UINT64)(pChan->volume & 0xff) << 31) / 100,
+                         0x7fffffff);
+    gain[1] = (INT32)MIN(((UINT64)((pChan->volume >> 8) & 0xff) << 31) / 100,
+                         0x7fffffff);
+
+    for (taken = 0; taken < frames; taken += k)
+        {
+        k = MIN(frames - taken, (size - b->tail) / OSS_VMIX_FRAME);
+
+        ossVmixAdd (d, (const INT32 *)((caddr_t)b->buf_addr + b->tail),
+                    k * OSS_VMIX_CHANNELS, gain);
+        d += k * OSS_VMIX_CHANNELS;
+
+        b->tail = (b->tail + k * OSS_VMIX_FRAME) % size;
+        b->tcount += k * OSS_VMIX_FRAME;
+        }
+
+    semGive (pChan->sem);
+    if (pChan->selList != NULL)
+        selWakeupAll (pChan->selList, SELWRITE);
+
+    return frames;
+    }
+
+/*******************************************************************************
+ *
+ * ossVmixAdd - scale samples and add them to the mix with saturation
+ *
+ * Adds (s * gain) >> 31 to d for <samples> interleaved samples; gain[0]
+ * applies to the even ones (left), gain[1] to the odd ones (right).  The
+ * vector paths do four samples at a time and produce the same result as
+ * the C loop, which finishes the remainder.
+ *
+ * RETURNS: N/A
+ */
+
+LOCAL void ossVmixAdd
+    (
+    INT32 *         d,
+    const INT32 *   s,
+    UINT32          samples,
+    const INT32 *   gain
+    )
+    {
+    UINT32 i = 0;
+    INT64 v;
+
+#if defined(__SSE2__)
+    {
+    __m128i g = _mm_set_epi32 (gain[1], gain[0], gain[1], gain[0]);
+    __m128i g1 = _mm_srli_epi64 (g, 32);
+    __m128i g2 = _mm_add_epi32 (g, g);
+    __m128i lo = _mm_set_epi32 (0, -1, 0, -1);
+    __m128i max = _mm_set1_epi32 (0x7fffffff);
+    __m128i a, x, p, sum, ovf;
+
+    for (; i + 4 <= samples; i += 4)
+        {
+        a = _mm_loadu_si128 ((const __m128i *)(d + i));
+        x = _mm_loadu_si128 ((const __m128i *)(s + i));
+
+        /*
+         * SSE2 multiplies unsigned only.  The gain is positive, so a
+         * negative sample read as unsigned adds 2^32 * gain to the product,
+         * which is 2 * gain once shifted; take it back off.
+         */
+
+        p = _mm_or_si128 (
+                _mm_and_si128 (_mm_srli_epi64 (_mm_mul_epu32 (x, g), 31), lo),
+                _mm_slli_epi64 (_mm_srli_epi64 (
+                    _mm_mul_epu32 (_mm_srli_epi64 (x, 32), g1), 31), 32));
+        p = _mm_sub_epi32 (p, _mm_and_si128 (_mm_srai_epi32 (x, 31), g2));
+
+        /* a lane overflowed when both inputs differ in sign from the sum */
+
+        sum = _mm_add_epi32 (a, p);
+        ovf = _mm_srai_epi32 (_mm_and_si128 (_mm_xor_si128 (a, sum),
+                                             _mm_xor_si128 (p, sum)), 31);
+        sum = _mm_or_si128 (_mm_andnot_si128 (ovf, sum),
+                            _mm_and_si128 (ovf, _mm_xor_si128 (
+                                _mm_srai_epi32 (a, 31), max)));
+
+        _mm_storeu_si128 ((__m128i *)(d + i), sum);
+        }
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    {
+    int32x4_t g = vcombine_s32 (vld1_s32 (gain), vld1_s32 (gain));
+
+    /* vqdmulh is (2 * s * g) >> 32, the Q31 product */
+
+    for (; i + 4 <= samples; i += 4)
+        vst1q_s32 (d + i, vqaddq_s32 (vld1q_s32 (d + i),
+                                      vqdmulhq_s32 (vld1q_s32 (s + i), g)));
+    }
+#endif
+
+    for (; i < samples; i++)
+        {
+        v = (INT64)d[i] + (((INT64)s[i] * gain[i & 1]) >> 31);
+        if (v > 0x7fffffff)
+            v = 0x7fffffff;
+        else if (v < -0x7fffffffLL - 1)
+            v = -0x7fffffffLL - 1;
+        d[i] = (INT32)v;
+        }
+    }
@@ -43,9 +43,15 @@
 
 #include <vxWorks.h>
 #include <stdio.h>
+#include <memLib.h>
 #include <semLib.h>
+#include <spinLockLib.h>
+#include <vxAtomicLib.h>
 #include <sysLib.h>
 #include <taskLib.h>
+#include <tickLib.h>
+#include <logLib.h>
+#include <eventLib.h>
 #include <vxBusLib.h>
 #include <cacheLib.h>
 #include <rebootLib.h>
@@ -73,12 +79,11 @@
 #define HDA_DBG_ON
 #ifdef  HDA_DBG_ON
 
-#include <logLib.h>
-
 HDCODEC_ID global_codec;
 HDA_DRV_CTRL* global_controller;
 PCM_DEVINFO * global_pcmdev;
 BOOL    global_poll = FALSE;
+
 #ifdef  LOCAL
 #undef  LOCAL
 #define LOCAL
@@ -109,6 +114,57 @@ void HDA_DBG(unsigned int mask, const char *string, ...)
 #endif
 
 
+/*
+ * Bring-up completion.  The gate semaphore starts open, is closed when the
+ * first controller connects and is given again once every connected
+ * controller has finished its background init; waiters pass through it
+ * and give it back.  With no controller present it never closes.
+ */
+
+LOCAL SEM_ID hdaReadySem = NULL;
+LOCAL SEM_ID hdaReadyMutex = NULL;
+LOCAL int    hdaInitPending = 0;
+LOCAL struct
+    {
+    int     tid;
+    UINT32  events;
+    } hdaReadyNotify[HDA_READY_NOTIFY_MAX];
+
+/*
+ * Bring-up profile clock.  The debug build has the BSP timestamp driver
+ * linked in for the benchmarks; otherwise stages are timed in ticks.
+ */
+
+#ifdef  HDA_DBG_ON
+IMPORT STATUS sysTimestampEnable (void);
+LOCAL UINT64 hdaBenchUsec (void);
+#define HDA_PROF_USEC()         hdaBenchUsec ()
+#else
+#define HDA_PROF_USEC()         ((tick64Get () * 1000000) / sysClkRateGet ())
+#endif
+
+#define HDA_PROF_RUN(prof, name, call)  \
+    do                                  \
+        {                               \
+        prof_begin (prof);              \
+        call;                           \
+        prof_end (prof, name);          \
+        } while (0)
+
+/*
+ * Topology cache storage.  vxbHdAudioTopoPath is a file name format taking
+ * the controller unit and codec address, e.g. "/tffs0/hdaTopo%d_%d.bin";
+ * NULL disables the cache.  A BSP may instead store the blob in NVRAM by
+ * setting the read and write routines, called as
+ * rtn (VXB_DEVICE_ID pDev, int cad, void * buf, int len) and returning the
+ * number of bytes transferred or ERROR.
+ */
+
+char *  vxbHdAudioTopoPath = NULL;
+FUNCPTR vxbHdAudioTopoReadRtn = NULL;
+FUNCPTR vxbHdAudioTopoWriteRtn = NULL;
+
+
 /* forward declarations */
 
 LOCAL void vxbHdAudioInstInit (VXB_DEVICE_ID);
@@ -127,6 +183,7 @@ LOCAL void vxbHdAudioWidgetDiscovery(HDA_DRV_CTRL* pDrvCtrl, cad_t cad);
 LOCAL void vxbHdAudioPinDiscovery(HDA_DRV_CTRL* pDrvCtrl, cad_t cad);
 #endif
 LOCAL WIDGET* vxbHdAudioWidgetFind (HDCODEC_ID codec, cad_t cad, nid_t nid);
+LOCAL WIDGET* vxbHdAudioWidgetListFind (HDCODEC_ID codec, cad_t cad, nid_t nid);
 LOCAL WIDGET* vxbHdAudioWidgetNum (HDCODEC_ID codec, int num);
 
 void vxbHdAudioSetPinCtrl (HDA_DRV_CTRL* pDrvCtrl, cad_t cad, nid_t nid, int val);
@@ -151,6 +208,7 @@ LOCAL int channel_setformat(PCM_CHANNEL *chan, UINT32 format);
 LOCAL int channel_setfragments(PCM_CHANNEL* chan, UINT32 blksz, UINT32 blkcnt);
 LOCAL int channel_trigger(PCM_CHANNEL* chan, int go);
 LOCAL UINT32 channel_getptr(PCM_CHANNEL* chan);
+LOCAL UINT32 channel_getfifo(PCM_CHANNEL* chan);
 LOCAL PCMCHAN_CAPS * channel_getcaps(PCM_CHANNEL* chan);
 
 LOCAL int audio_ctl_ossmixer_set(SND_MIXER *m, unsigned dev, unsigned left, unsigned right);
@@ -172,7 +230,11 @@ LOCAL int  reset(HDA_DRV_CTRL *, BOOL);
 LOCAL void dma_free(HDA_DRV_CTRL *sc, DMA_OBJECT *dma);
 LOCAL int  unsolq_flush(HDA_DRV_CTRL *sc);
 LOCAL int  rirb_flush(HDA_DRV_CTRL *sc);
+LOCAL BOOL command_wait(HDA_DRV_CTRL *, HDCODEC_ID);
 LOCAL UINT32 send_command(HDA_DRV_CTRL *, int cad, UINT32);
+LOCAL UINT32 send_command_path(HDA_DRV_CTRL *, int cad, UINT32, int path);
+LOCAL int send_command_batch(HDA_DRV_CTRL *, int cad, UINT32 *, UINT32 *, int);
+LOCAL STATUS immediate_command(HDA_DRV_CTRL *, int cad, UINT32, UINT32 *);
 
 
 LOCAL int audio_ctl_dest_amp(HDCODEC_ID codec, nid_t nid, int index, int ossdev, int depth, int *minamp, int *maxamp);
@@ -181,6 +243,8 @@ LOCAL void presence_handler(WIDGET *w);
 
 LOCAL WIDGET* widget_get (HDCODEC* codec, nid_t nid);
 LOCAL UINT32 hda_command (HDCODEC* codec, UINT32 verb);
+LOCAL int hda_command_batch (HDCODEC* codec, UINT32 *verbs, UINT32 *responses, int n);
+LOCAL UINT32 cached_command (HDA_DRV_CTRL *, HDCODEC *, UINT32 verb);
 LOCAL void widget_parse(WIDGET *w);
 LOCAL UINT32 audio_ctl_recsel_comm(PCM_DEVINFO *pdevinfo, UINT32 src, nid_t nid, int depth);
 LOCAL AUDIO_CTL* audio_ctl_each(HDCODEC_ID codec, int *index);
@@ -190,8 +254,13 @@ LOCAL void audio_build_tree(HDCODEC_ID codec);
 LOCAL void create_pcms(HDCODEC_ID codec);
 LOCAL void delete_pcms(HDCODEC_ID codec);
 LOCAL void audio_ctl_parse (HDCODEC_ID codec);
+LOCAL void audio_ctl_index(HDCODEC_ID codec);
 LOCAL void audio_disable_nonaudio(HDCODEC_ID codec);
 LOCAL void audio_disable_useless(HDCODEC_ID codec);
+LOCAL void widget_rconn_build(HDCODEC_ID codec);
+LOCAL void prune_free(HDCODEC_ID codec);
+LOCAL void audio_ctl_plan_build(HDCODEC_ID codec);
+LOCAL void mix_plan_free(PCM_DEVINFO *pdevinfo);
 LOCAL void audio_disable_unas(HDCODEC_ID codec);
 LOCAL void audio_disable_notselected(HDCODEC_ID codec);
 LOCAL void audio_disable_crossas(HDCODEC_ID codec);
@@ -210,6 +279,10 @@ LOCAL void audio_ctl_set_defaults(PCM_DEVINFO *pcm_dev_table);
 LOCAL UINT32 vxbHdAudioCommand (HDA_DRV_CTRL* pDrvCtrl, cad_t cad, UINT32 verb);
 LOCAL WIDGET* vxbHdAudioGetRootWidget (HDA_DRV_CTRL* pDrvCtrl, cad_t cad);
 LOCAL WIDGET* vxbHdAudioWidgetCreate (HDA_DRV_CTRL* pDrvCtrl, cad_t cad, nid_t nid);
+LOCAL void * arena_carve(HDA_ARENA *arena, size_t size, size_t align);
+LOCAL void * arena_alloc(HDA_ARENA *arena, size_t size);
+LOCAL void arena_release(HDA_ARENA *arena);
+LOCAL void vxbHdAudioWidgetDeleteAll(HDA_DRV_CTRL* pDrvCtrl, HDCODEC_ID codec);
 
 LOCAL nid_t audio_trace_dac (HDCODEC_ID codec, int, int, int, int, int, int, int);
 LOCAL int audio_trace_as_out(HDCODEC_ID codec, int as, int seq);
@@ -221,6 +294,14 @@ LOCAL void vxbHdAudioWidgetTraverse(HDA_DRV_CTRL* pDrvCtrl, cad_t cad);
 #endif
 
 LOCAL STATUS vxbHdAudioUnlink (VXB_DEVICE_ID pDev, void * unused);
+LOCAL void vxbHdAudioCodecProbe (HDA_DRV_CTRL *, cad_t, STATUS *, SEM_ID);
+LOCAL void vxbHdAudioInitTask (VXB_DEVICE_ID);
+LOCAL STATUS topo_load (HDA_DRV_CTRL *, HDCODEC_ID, UINT32, UINT32);
+LOCAL void topo_save (HDA_DRV_CTRL *, HDCODEC_ID, UINT32, UINT32);
+LOCAL void prof_begin (HDA_PROF *);
+LOCAL void prof_end (HDA_PROF *, const char *);
+LOCAL void prof_ctrl_begin (HDA_DRV_CTRL *);
+LOCAL void prof_ctrl_end (HDA_DRV_CTRL *, const char *);
 
 IMPORT void vxbUsDelay (int);
 IMPORT void vxbMsDelay (int);
@@ -303,6 +384,14 @@ IMPORT void vxbMsDelay (int);
 #define HDA_MAX_CONNS   32
 #define HDA_MAX_NAMELEN 32
 
+/* GET_CONN_LIST_ENTRY verbs needed for a 127 entry long form list */
+
+#define HDA_CONN_LIST_VERBS_MAX 64
+
+/* verbs queued per batch while committing widget state */
+
+#define HDA_COMMIT_BATCH_MAX    48
+
 #define CHN_RUNNING    0x00000001
 #define CHN_SUSPEND    0x00000002
 
@@ -399,6 +488,31 @@ UINT16    div;
     { 176400, 1, 0x4000, 0x1800, 0x0000 },  /* (44100 * 4) / 1 */
 };
 
+/* rates a channel can offer, one bit each in CHAN pcmrates */
+
+LOCAL const UINT32 hda_pcm_rates[] = {
+    8000, 11025, 16000, 22050, 32000, 44100, 48000,
+    88200, 96000, 176400, 192000
+};
+
+#define HDA_PCM_RATE_8K         (1 << 0)
+#define HDA_PCM_RATE_11K        (1 << 1)
+#define HDA_PCM_RATE_16K        (1 << 2)
+#define HDA_PCM_RATE_22K        (1 << 3)
+#define HDA_PCM_RATE_32K        (1 << 4)
+#define HDA_PCM_RATE_44K        (1 << 5)
+#define HDA_PCM_RATE_48K        (1 << 6)
+#define HDA_PCM_RATE_88K        (1 << 7)
+#define HDA_PCM_RATE_96K        (1 << 8)
+#define HDA_PCM_RATE_176K       (1 << 9)
+#define HDA_PCM_RATE_192K       (1 << 10)
+
+/* longest format list pcmchannel_setup() builds, terminator included */
+
+#define HDA_CHAN_FMTS_MAX       32
+
+LOCAL UINT32 hda_fmt_none[] = { 0 };
+
 
 /* externs */
 
@@ -412,6 +526,7 @@ LOCAL struct vxbDeviceMethod vxbHdAudioMethods[] =
     DEVMETHOD(pcm_channel_trigger,      channel_trigger),
     DEVMETHOD(pcm_channel_getptr,       channel_getptr),
     DEVMETHOD(pcm_channel_getcaps,      channel_getcaps),
+    DEVMETHOD(pcm_channel_getfifo,      channel_getfifo),
     DEVMETHOD(mixer_init,               audio_ctl_ossmixer_init),
     DEVMETHOD(mixer_set,                audio_ctl_ossmixer_set),
     DEVMETHOD(mixer_setrecsrc,          audio_ctl_ossmixer_setrecsrc),
@@ -468,9 +583,135 @@ LOCAL PCI_DRIVER_REGISTRATION hdaPciRegistration =
 
 void vxbHdAudioRegister (void)
     {
+    hdaReadySem = semBCreate (SEM_Q_PRIORITY, SEM_FULL);
+    hdaReadyMutex = semMCreate (SEM_Q_PRIORITY|SEM_INVERSION_SAFE);
+
     vxbDevRegister ((void*)&hdaPciRegistration);
     }
 
+/*******************************************************************************
+ *
+ * vxbHdAudioWaitReady - wait until the audio devices are registered
+ *
+ * Controller bring-up runs in the background after the vxBus connect phase.
+ * This routine blocks the caller for up to <timeout> ticks (WAIT_FOREVER
+ * or NO_WAIT may be used) until every connected controller has registered
+ * its /dev/dsp and /dev/mixer devices.  If no controller was found it
+ * returns at once.
+ *
+ * RETURNS: OK, or ERROR if the devices are not ready within the timeout
+ *
+ * ERRNO: S_objLib_OBJ_TIMEOUT, S_objLib_OBJ_UNAVAILABLE
+ */
+
+STATUS vxbHdAudioWaitReady
+    (
+    int timeout
+    )
+    {
+    if (hdaReadySem == NULL)
+        return (ERROR);
+
+    if (semTake (hdaReadySem, timeout) != OK)
+        return (ERROR);
+
+    semGive (hdaReadySem);
+    return (OK);
+    }
+
+/*******************************************************************************
+ *
+ * vxbHdAudioReadyEventRegister - request an event when the devices are ready
+ *
+ * This routine arranges for <events> to be sent to task <tid> (0 for the
+ * calling task) with eventSend() once bring-up completes.  If the devices
+ * are already registered the events are sent immediately.
+ *
+ * RETURNS: OK, or ERROR if the notification table is full
+ *
+ * ERRNO: N/A
+ */
+
+STATUS vxbHdAudioReadyEventRegister
+    (
+    int tid,
+    UINT32 events
+    )
+    {
+    STATUS status = ERROR;
+    int i;
+
+    if (hdaReadyMutex == NULL)
+        return (ERROR);
+
+    if (tid == 0)
+        tid = taskIdSelf ();
+
+    semTake (hdaReadyMutex, WAIT_FOREVER);
+
+    if (hdaInitPending == 0 && semTake (hdaReadySem, NO_WAIT) == OK)
+        {
+        semGive (hdaReadySem);
+        status = eventSend (tid, events);
+        }
+    else
+        {
+        for (i = 0; i < HDA_READY_NOTIFY_MAX; i++)
+            {
+            if (hdaReadyNotify[i].tid == 0)
+                {
+                hdaReadyNotify[i].tid = tid;
+                hdaReadyNotify[i].events = events;
+                status = OK;
+                break;
+                }
+            }
+        }
+
+    semGive (hdaReadyMutex);
+    return (status);
+    }
+
+/*******************************************************************************
+ *
+ * vxbHdAudioInitTask - background bring-up of one controller
+ *
+ * This routine runs vxbHdAudioDevInit() outside the vxBus connect phase and
+ * opens the readiness gate once the last pending controller is done.
+ *
+ * RETURNS: N/A
+ *
+ * ERRNO: N/A
+ */
+
+LOCAL void vxbHdAudioInitTask
+    (
+    VXB_DEVICE_ID pInst
+    )
+    {
+    int i;
+
+    vxbHdAudioDevInit (pInst);
+
+    semTake (hdaReadyMutex, WAIT_FOREVER);
+
+    if (--hdaInitPending == 0)
+        {
+        semGive (hdaReadySem);
+
+        for (i = 0; i < HDA_READY_NOTIFY_MAX; i++)
+            {
+            if (hdaReadyNotify[i].tid != 0)
+                {
+                eventSend (hdaReadyNotify[i].tid, hdaReadyNotify[i].events);
+                hdaReadyNotify[i].tid = 0;
+                }
+            }
+        }
+
+    semGive (hdaReadyMutex);
+    }
+
 /*******************************************************************************
  *
  * vxbHdAudioInstInitInit - first level initialization routine of HD Audio device
@@ -524,6 +765,12 @@ LOCAL void vxbHdAudioInstInit2
     pDrvCtrl->pDev = pInst;
     pInst->pDrvCtrl = pDrvCtrl;
 
+    SPIN_LOCK_ISR_INIT (&pDrvCtrl->rirb_lock, 0);
+
+    pDrvCtrl->cmd_path = HDA_CMD_PATH_AUTO;
+    pDrvCtrl->imm_ok = TRUE;
+    pDrvCtrl->probe_tasks = TRUE;
+
     pDrvCtrl->regBase = pInst->pRegBase[bar];
     vxbRegMap (pInst, bar, &pDrvCtrl->regHandle);
 
@@ -587,15 +834,23 @@ LOCAL void vxbHdAudioInstInit2
                        NULL,
                        NULL);
 
+#ifdef  HDA_DBG_ON
+    sysTimestampEnable ();
+#endif
+
+    prof_begin (&pDrvCtrl->prof);
     reset(pDrvCtrl, TRUE);
     corb_stop(pDrvCtrl);
     rirb_stop(pDrvCtrl);
+    prof_end (&pDrvCtrl->prof, "reset");
 
     /* Initialize the CORB and RIRB */
+    prof_begin (&pDrvCtrl->prof);
     corb_init(pDrvCtrl);
     rirb_init(pDrvCtrl);
 
     dmapos_init(pDrvCtrl);
+    prof_end (&pDrvCtrl->prof, "corb/rirb init");
 
     return;
     }
@@ -645,6 +900,21 @@ LOCAL void vxbHdAudioInstConnect
         return;
         }
 
+    /*
+     * Codecs are probed concurrently, so the CORB write pointer, the
+     * immediate command registers and the unsolicited queue are shared
+     * between tasks.
+     */
+
+    pDrvCtrl->cmd_lock = semMCreate (SEM_Q_PRIORITY|SEM_INVERSION_SAFE);
+    pDrvCtrl->unsolq_lock = semMCreate (SEM_Q_PRIORITY|SEM_INVERSION_SAFE);
+    if (pDrvCtrl->cmd_lock == NULL || pDrvCtrl->unsolq_lock == NULL)
+        {
+        HDA_DBG (HDA_DBG_ERR, "semMCreate failed for command locks\n",
+                 0, 0, 0, 0, 0, 0);
+        return;
+        }
+
     pDrvCtrl->unsolq_msgQ = msgQCreate(10, sizeof(VXB_HDA_MSG), MSG_Q_FIFO);
 #if 0
     rebootHookAdd((FUNCPTR)vxbHdAudioReboot);
@@ -660,9 +930,21 @@ LOCAL void vxbHdAudioInstConnect
     vxbIntConnect (pInst, 0, vxbHdAudioIsr, pInst);
     vxbIntEnable (pInst, 0, vxbHdAudioIsr, pInst);
     
-    /* per-device init */
+    /*
+     * Per-device init runs in the background so reset delays, codec
+     * enumeration and parsing do not hold up the rest of boot; the
+     * devices are registered when it completes.
+     */
 
-    vxbHdAudioDevInit (pInst);
+    semTake (hdaReadyMutex, WAIT_FOREVER);
+    if (hdaInitPending++ == 0)
+        semTake (hdaReadySem, NO_WAIT);
+    semGive (hdaReadyMutex);
+
+    if (taskSpawn (HDA_INIT_TASK_NAME, HDA_INIT_TASK_PRI, 0,
+                   HDA_INIT_TASK_STACK, (void*)vxbHdAudioInitTask, (int)pInst,
+                   0, 0, 0, 0, 0, 0, 0, 0, 0) == ERROR)
+        vxbHdAudioInitTask (pInst);
 
     return;
     }
@@ -689,7 +971,9 @@ LOCAL void vxbHdAudioDevInit
     UINT16 corbrp, corbwp,rintcnt,rirbwp;
     UINT16 statests;
     UINT32 gctl, intcl;
-    UINT32 vendorid, revisionid;
+    STATUS probeStatus[HDAC_CODEC_NUM_MAX];
+    SEM_ID doneSem;
+    int nspawned;
     HDA_DRV_CTRL * pDrvCtrl = (HDA_DRV_CTRL *)pInst->pDrvCtrl;
 
     HDA_DBG(HDA_DBG_INFO, "Starting CORB Engine...\n");
@@ -703,12 +987,16 @@ LOCAL void vxbHdAudioDevInit
     corbctl = READ_1(HDAC_CORBCTL);
     rirbctl = READ_1(HDAC_RIRBCTL);
 
+    prof_begin (&pDrvCtrl->prof);
     corb_start(pDrvCtrl);
     HDA_DBG(HDA_DBG_INFO, "Starting RIRB Engine...\n");
 
     rirb_start(pDrvCtrl);
+    prof_end (&pDrvCtrl->prof, "corb/rirb start");
     HDA_DBG(HDA_DBG_INFO, "Enabling controller interrupt...\n");
 
+    prof_begin (&pDrvCtrl->prof);
+
     WRITE_4(HDAC_GCTL,
                  (READ_4(HDAC_GCTL)) | HDAC_GCTL_UNSOL);
 
@@ -732,7 +1020,6 @@ LOCAL void vxbHdAudioDevInit
 
     for (cad = 0; cad < HDAC_CODEC_NUM_MAX; cad++)
         {
-        UINT32 verb;
         HDCODEC_ID codec;
 
         if (HDAC_STATESTS_SDIWAKE(statests, cad))
@@ -741,198 +1028,1042 @@ LOCAL void vxbHdAudioDevInit
             pDrvCtrl->codec_table[cad] = calloc(1, sizeof(HDCODEC));
 
             codec = pDrvCtrl->codec_table[cad];
+            codec->cmd_sem = semBCreate (SEM_Q_FIFO, SEM_EMPTY);
+            codec->cmd_mutex = semMCreate (SEM_Q_PRIORITY|SEM_INVERSION_SAFE);
+            codec->param_cache = calloc(HDA_PARAM_CACHE_SIZE,
+                                        sizeof(HDA_PARAM_CACHE));
+            codec->cad = cad;
+            codec->pDev = pDrvCtrl->pDev;
 
 #ifdef  HDA_DBG_ON
             global_codec = codec;
 #endif
-            verb = HDA_CMD_GET_PARAMETER(cad, 0, HDA_PARAM_VENDOR_ID);
-            vendorid = vxbHdAudioCommand(pDrvCtrl, cad, verb);
-
-            verb = HDA_CMD_GET_PARAMETER(cad, 0, HDA_PARAM_REVISION_ID);
-            revisionid = vxbHdAudioCommand(pDrvCtrl, cad, verb);
-
-            if (vendorid == HDA_INVALID && revisionid == HDA_INVALID)
-                {
-                HDA_DBG(HDA_DBG_ERR, "CODEC is not responding!\n");
-                continue;
-                }
-
-            codec->vendor_id = HDA_PARAM_VENDOR_ID_VENDOR_ID(vendorid);
-            codec->device_id = HDA_PARAM_VENDOR_ID_DEVICE_ID(vendorid);
-            codec->revision_id = HDA_PARAM_REVISION_ID_REVISION_ID(revisionid);
-            codec->stepping_id = HDA_PARAM_REVISION_ID_STEPPING_ID(revisionid);
-
-            codec->pDev = pDrvCtrl->pDev;
-
-            vxbHdAudioWidgetDiscovery (pDrvCtrl, cad);
-
-            powerup(codec);
-#if 0
-            /* set port A headphone output */
-            
-            vxbHdAudioSetPinCtrl(pDrvCtrl, cad, 0xa, 0xc4);
-
-            /* set port B input */
-            
-            vxbHdAudioSetPinCtrl(pDrvCtrl, cad, 0xb, 0x20);
-#endif
-            audio_parse(codec);
+            }
+        }
 
-            audio_ctl_parse(codec);
-            
-            audio_disable_nonaudio(codec);
+    prof_end (&pDrvCtrl->prof, "codec scan");
 
-            audio_disable_useless(codec);
+    /*
+     * Probe and parse the codecs concurrently.  Their verbs interleave in
+     * the CORB and are routed back by the RIRB SDATA_IN field, so attach
+     * time follows the slowest codec instead of the sum of all of them.
+     */
 
-            audio_as_parse(codec);
+    prof_ctrl_begin (pDrvCtrl);
 
-            audio_build_tree(codec);
+    doneSem = NULL;
+    if (pDrvCtrl->probe_tasks && pDrvCtrl->num_codec > 1)
+        doneSem = semCCreate (SEM_Q_FIFO, 0);
 
-            audio_disable_unas(codec);
+    nspawned = 0;
+    for (cad = 0; cad < HDAC_CODEC_NUM_MAX; cad++)
+        {
+        probeStatus[cad] = ERROR;
 
-            audio_disable_notselected(codec);
+        if (pDrvCtrl->codec_table[cad] == NULL)
+            continue;
 
-            audio_disable_useless(codec);
+        if (doneSem != NULL &&
+            taskSpawn (HDA_PROBE_TASK_NAME, HDA_PROBE_TASK_PRI, 0,
+                       HDA_PROBE_TASK_STACK, (void*)vxbHdAudioCodecProbe,
+                       (int)pDrvCtrl, cad, (int)&probeStatus[cad],
+                       (int)doneSem, 0, 0, 0, 0, 0, 0) != ERROR)
+            {
+            nspawned++;
+            continue;
+            }
 
-            audio_disable_crossas(codec);
+        vxbHdAudioCodecProbe (pDrvCtrl, cad, &probeStatus[cad], NULL);
+        }
 
-            audio_disable_useless(codec);
+    while (nspawned-- > 0)
+        semTake (doneSem, WAIT_FOREVER);
 
-            audio_bind_as(codec);
+    if (doneSem != NULL)
+        semDelete (doneSem);
 
-            audio_assign_names(codec);
+    prof_ctrl_end (pDrvCtrl, "codec probe");
 
-            prepare_pcms(codec);
+    /* register devices in codec order so their names stay stable */
 
-            audio_assign_mixers(codec);
+    prof_ctrl_begin (pDrvCtrl);
 
-            audio_prepare_pin_ctrl(codec);
+    for (cad = 0; cad < HDAC_CODEC_NUM_MAX; cad++)
+        {
+        HDCODEC_ID codec = pDrvCtrl->codec_table[cad];
 
-            audio_commit(codec);
+        if (probeStatus[cad] != OK)
+            continue;
 
-            create_pcms(codec);
+        HDA_PROF_RUN(&codec->prof, "create_pcms", create_pcms(codec));
 
-            sense_init(codec);
-            }
+        HDA_PROF_RUN(&codec->prof, "sense_init", sense_init(codec));
         }
+
+    prof_ctrl_end (pDrvCtrl, "device create");
     }
 
 /*******************************************************************************
  *
- * vxbHdAudioIsr - interrupt service routine
+ * vxbHdAudioCodecProbe - identify one codec and parse its topology
  *
- * This routine handles interrupts of the HD Audio controller
+ * This routine reads the codec IDs, discovers its widgets and runs the parse
+ * passes up to committing the widget state.  It runs either inline or as
+ * one of several probe tasks, in which case <doneSem> is given on exit.
  *
  * RETURNS: N/A
  *
  * ERRNO: N/A
  */
 
-LOCAL void vxbHdAudioIsr
+LOCAL void vxbHdAudioCodecProbe
     (
-    VXB_DEVICE_ID pDev
+    HDA_DRV_CTRL * pDrvCtrl,
+    cad_t cad,
+    STATUS * pStatus,
+    SEM_ID doneSem
     )
     {
-    HDA_DRV_CTRL * pDrvCtrl = (HDA_DRV_CTRL *)pDev->pDrvCtrl;
-    UINT8 rirbsts;
-    UINT32 intsts;
+    HDCODEC_ID codec = pDrvCtrl->codec_table[cad];
+    UINT32 vendorid, revisionid;
+    UINT32 verb;
+    STATUS status;
 
-    intsts = READ_4(HDAC_INTSTS);
-    if (intsts & HDAC_INTSTS_GIS)
-        {
-        if (intsts & HDAC_INTSTS_CIS)
-            {
-            rirbsts = READ_1(HDAC_RIRBSTS);
+    *pStatus = ERROR;
 
-            while (rirbsts & HDAC_RIRBSTS_RINTFL)
-                {
-                WRITE_1(HDAC_RIRBSTS, rirbsts);
-                rirb_flush(pDrvCtrl);
-                rirbsts = READ_1(HDAC_RIRBSTS);
-                }
+    prof_begin (&codec->prof);
 
-            if (pDrvCtrl->unsolq_rp != pDrvCtrl->unsolq_wp)
-                {
-                VXB_HDA_MSG msg;
-                msg.pDev = pDev;
-                msg.type = VXB_HDA_MSG_TYPE_UNSOLQ;
-                msgQSend(pDrvCtrl->unsolq_msgQ, (char*)&msg,
-                         VXB_HDA_MSG_SIZE, NO_WAIT, MSG_PRI_NORMAL);
-                }
-            }
+    verb = HDA_CMD_GET_PARAMETER(cad, 0, HDA_PARAM_VENDOR_ID);
+    vendorid = vxbHdAudioCommand(pDrvCtrl, cad, verb);
 
-        if (intsts & HDAC_INTSTS_SIS_MASK)
-            {
-            int i;
-            HDCODEC* codec;
-       
-            for (i = 0; i < pDrvCtrl->num_ss; i++)
-                {
-                if ((intsts & (1 << i)) == 0)
-                    continue;
+    verb = HDA_CMD_GET_PARAMETER(cad, 0, HDA_PARAM_REVISION_ID);
+    revisionid = vxbHdAudioCommand(pDrvCtrl, cad, verb);
 
-                WRITE_1((i << 5) + HDAC_SDSTS,
-                             READ_1((i << 5) + HDAC_SDSTS));
+    prof_end (&codec->prof, "identify");
 
-                if ((codec = pDrvCtrl->streams[i].codec) != NULL)
-                    {
-                    stream_intr(pDrvCtrl->streams[i].codec, pDrvCtrl->streams[i].dir, pDrvCtrl->streams[i].stream);
-                    }
-                }
-            }
-        WRITE_4(HDAC_INTSTS, intsts);
+    if (vendorid == HDA_INVALID && revisionid == HDA_INVALID)
+        {
+        HDA_DBG(HDA_DBG_ERR, "CODEC is not responding!\n");
+        if (doneSem != NULL)
+            semGive (doneSem);
+        return;
         }
-    }
 
-LOCAL void stream_intr
-    (
-    HDCODEC_ID codec,
-    int dir,
-    int stream
-    )
-    {
-    int i;
-    CHAN *ch;
+    codec->vendor_id = HDA_PARAM_VENDOR_ID_VENDOR_ID(vendorid);
+    codec->device_id = HDA_PARAM_VENDOR_ID_DEVICE_ID(vendorid);
+    codec->revision_id = HDA_PARAM_REVISION_ID_REVISION_ID(revisionid);
+    codec->stepping_id = HDA_PARAM_REVISION_ID_STEPPING_ID(revisionid);
 
-    for (i = 0; i < codec->num_hdaa_chans; i++)
-        {
-        ch = &codec->hdaa_chan_table[i];
-        if (!(ch->flags & CHN_RUNNING))
-            continue;
+    /* an unchanged codec is restored from the topology cache */
 
-        if (((ch->sid == stream) && (dir == 1) && (ch->dir == CTL_OUT)) ||
-            ((ch->sid == stream) && (dir == 0) && (ch->dir == CTL_IN)))
-            {
-            osschannel_intr(ch->c);
-            }
+    prof_begin (&codec->prof);
+    status = topo_load(pDrvCtrl, codec, vendorid, revisionid);
+    prof_end (&codec->prof, "topo_load");
+
+    if (status == OK)
+        {
+        HDA_PROF_RUN(&codec->prof, "powerup", powerup(codec));
+        goto parse_done;
         }
-    }
 
-/*******************************************************************************
- *
- * vxbHdAudioMonTask - status monitor task
- *
- * This routine is the task loop to handle jack insertion/removal
- *
- * RETURN: N/A
- *
- * ERRNO: N/A
- */
+    HDA_PROF_RUN(&codec->prof, "discovery",
+                 vxbHdAudioWidgetDiscovery (pDrvCtrl, cad));
 
-LOCAL void vxbHdAudioMonTask
-    (
-    MSG_Q_ID    msgQ
-    )
-    {
+    HDA_PROF_RUN(&codec->prof, "powerup", powerup(codec));
+#if 0
+    /* set port A headphone output */
+    
+    vxbHdAudioSetPinCtrl(pDrvCtrl, cad, 0xa, 0xc4);
 
-    FOREVER
-        {
-        VXB_HDA_MSG msg;
-        
-        if (msgQReceive (msgQ, (char*)&msg, sizeof(msg), NO_WAIT) != ERROR)
-            {
-            HDA_DRV_CTRL * pDrvCtrl;
-            VXB_DEVICE_ID pDev;
+    /* set port B input */
+    
+    vxbHdAudioSetPinCtrl(pDrvCtrl, cad, 0xb, 0x20);
+#endif
+    HDA_PROF_RUN(&codec->prof, "audio_parse", audio_parse(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_ctl_parse", audio_ctl_parse(codec));
+    
+    HDA_PROF_RUN(&codec->prof, "audio_disable_nonaudio",
+                 audio_disable_nonaudio(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_disable_useless",
+                 audio_disable_useless(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_as_parse", audio_as_parse(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_build_tree", audio_build_tree(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_disable_unas",
+                 audio_disable_unas(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_disable_notselected",
+                 audio_disable_notselected(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_disable_useless",
+                 audio_disable_useless(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_disable_crossas",
+                 audio_disable_crossas(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_disable_useless",
+                 audio_disable_useless(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_bind_as", audio_bind_as(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_assign_names",
+                 audio_assign_names(codec));
+
+    HDA_PROF_RUN(&codec->prof, "prepare_pcms", prepare_pcms(codec));
+
+    HDA_PROF_RUN(&codec->prof, "topo_save",
+                 topo_save(pDrvCtrl, codec, vendorid, revisionid));
+
+    parse_done:
+    HDA_PROF_RUN(&codec->prof, "audio_assign_mixers",
+                 audio_assign_mixers(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_prepare_pin_ctrl",
+                 audio_prepare_pin_ctrl(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_commit", audio_commit(codec));
+
+    HDA_PROF_RUN(&codec->prof, "audio_ctl_plan_build",
+                 audio_ctl_plan_build(codec));
+
+    *pStatus = OK;
+
+    if (doneSem != NULL)
+        semGive (doneSem);
+    }
+
+/****************************************************************************
+ * Parse-time arena
+ *
+ * Everything a codec parse produces lives until the codec is detached, so
+ * it is carved from chunks of HDA_ARENA_CHUNK_SIZE bytes rather than being
+ * allocated and freed piece by piece.  A table larger than a chunk gets a
+ * chunk of its own.  Scratch space dropped during the parse (the pruning
+ * worklist, the trace bitmaps) stays on the heap.
+ ****************************************************************************/
+
+#ifdef  _CACHE_ALIGN_SIZE
+#define HDA_ARENA_ALIGN         _CACHE_ALIGN_SIZE
+#else
+#define HDA_ARENA_ALIGN         32
+#endif
+
+#define HDA_ARENA_HDR           ROUND_UP(sizeof(HDA_ARENA_CHUNK), HDA_ARENA_ALIGN)
+
+LOCAL void * arena_carve
+    (
+    HDA_ARENA *arena,
+    size_t size,
+    size_t align
+    )
+    {
+    HDA_ARENA_CHUNK *chunk = arena->chunk;
+    size_t len;
+    void *p;
+
+    if (chunk != NULL)
+        chunk->used = ROUND_UP(chunk->used, align);
+    size = max(size, 1);
+
+    if (chunk == NULL || chunk->used > chunk->size ||
+        chunk->size - chunk->used < size)
+        {
+        len = max(size, HDA_ARENA_CHUNK_SIZE - HDA_ARENA_HDR);
+        chunk = memalign(HDA_ARENA_ALIGN, HDA_ARENA_HDR + len);
+        if (chunk == NULL)
+            return (NULL);
+        chunk->size = len;
+        chunk->used = 0;
+
+        /* an oversize chunk is used up at once; keep allocating behind it */
+
+        if (arena->chunk != NULL && len > HDA_ARENA_CHUNK_SIZE - HDA_ARENA_HDR)
+            {
+            chunk->next = arena->chunk->next;
+            arena->chunk->next = chunk;
+            }
+        else
+            {
+            chunk->next = arena->chunk;
+            arena->chunk = chunk;
+            }
+        arena->reserved += HDA_ARENA_HDR + len;
+        }
+
+    p = (UINT8 *)chunk + HDA_ARENA_HDR + chunk->used;
+    chunk->used += size;
+    arena->bytes += size;
+    memset (p, 0, size);
+    return (p);
+    }
+
+/* tables start on a cache line; small lists are packed */
+
+LOCAL void * arena_alloc
+    (
+    HDA_ARENA *arena,
+    size_t size
+    )
+    {
+    return (arena_carve (arena, ROUND_UP(max(size, 1), HDA_ARENA_ALIGN),
+                         HDA_ARENA_ALIGN));
+    }
+
+LOCAL void arena_release
+    (
+    HDA_ARENA *arena
+    )
+    {
+    HDA_ARENA_CHUNK *chunk, *next;
+
+    for (chunk = arena->chunk; chunk != NULL; chunk = next)
+        {
+        next = chunk->next;
+        free (chunk);
+        }
+    memset (arena, 0, sizeof(HDA_ARENA));
+    }
+
+/****************************************************************************
+ * Bring-up profile
+ *
+ * Each codec counts the verbs it sends and the widget lookups made on it.
+ * A stage records the wall time and the counter deltas between
+ * prof_begin() and prof_end(); vxbHdAudioBootProfileShow() prints them.
+ * Controller stages span all codecs, whose counters are summed in.
+ ****************************************************************************/
+
+LOCAL void prof_begin
+    (
+    HDA_PROF *prof
+    )
+    {
+    prof->t0 = HDA_PROF_USEC();
+    prof->verbs0 = prof->verbs;
+    prof->lookups0 = prof->lookups;
+    }
+
+LOCAL void prof_end
+    (
+    HDA_PROF *prof,
+    const char *name
+    )
+    {
+    HDA_PROF_STAGE *stage;
+
+    if (prof->nstages >= HDA_PROF_STAGES_MAX)
+        return;
+
+    stage = &prof->stage[prof->nstages++];
+    stage->name = name;
+    stage->usec = (UINT32)(HDA_PROF_USEC() - prof->t0);
+    stage->verbs = prof->verbs - prof->verbs0;
+    stage->lookups = prof->lookups - prof->lookups0;
+    }
+
+LOCAL void prof_ctrl_sum
+    (
+    HDA_DRV_CTRL *pDrvCtrl
+    )
+    {
+    HDCODEC_ID codec;
+    int cad;
+
+    pDrvCtrl->prof.verbs = 0;
+    pDrvCtrl->prof.lookups = 0;
+
+    for (cad = 0; cad < HDAC_CODEC_NUM_MAX; cad++)
+        {
+        codec = pDrvCtrl->codec_table[cad];
+        if (codec == NULL)
+            continue;
+
+        pDrvCtrl->prof.verbs += codec->prof.verbs;
+        pDrvCtrl->prof.lookups += codec->prof.lookups;
+        }
+    }
+
+LOCAL void prof_ctrl_begin
+    (
+    HDA_DRV_CTRL *pDrvCtrl
+    )
+    {
+    prof_ctrl_sum(pDrvCtrl);
+    prof_begin(&pDrvCtrl->prof);
+    }
+
+LOCAL void prof_ctrl_end
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    const char *name
+    )
+    {
+    prof_ctrl_sum(pDrvCtrl);
+    prof_end(&pDrvCtrl->prof, name);
+    }
+
+/****************************************************************************
+ * Topology cache
+ *
+ * The parse pipeline from widget discovery to prepare_pcms() only reads
+ * the codec, so its result is fully determined by the codec IDs and pin
+ * configuration defaults.  It is saved as a blob after a full parse and
+ * restored on later boots once a few verbs confirm the codec is unchanged.
+ ****************************************************************************/
+
+LOCAL UINT32 topo_checksum
+    (
+    const UINT8 *p,
+    int len
+    )
+    {
+    UINT32 h = 0x811c9dc5;
+
+    while (len-- > 0)
+        {
+        h ^= *p++;
+        h *= 0x01000193;
+        }
+
+    return (h);
+    }
+
+LOCAL int topo_io
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    cad_t cad,
+    void *buf,
+    int len,
+    BOOL store
+    )
+    {
+    char name[MAX_FILENAME_LENGTH];
+    int fd, n;
+
+    if (store && vxbHdAudioTopoWriteRtn != NULL)
+        return (vxbHdAudioTopoWriteRtn (pDrvCtrl->pDev, cad, buf, len));
+    if (!store && vxbHdAudioTopoReadRtn != NULL)
+        return (vxbHdAudioTopoReadRtn (pDrvCtrl->pDev, cad, buf, len));
+    if (vxbHdAudioTopoPath == NULL)
+        return (ERROR);
+
+    snprintf (name, sizeof(name), vxbHdAudioTopoPath,
+              pDrvCtrl->pDev->unitNumber, cad);
+
+    if (store)
+        fd = open (name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    else
+        fd = open (name, O_RDONLY, 0);
+    if (fd < 0)
+        return (ERROR);
+
+    n = store ? (int)write (fd, buf, len) : (int)read (fd, buf, len);
+    close (fd);
+
+    return (n);
+    }
+
+LOCAL int topo_size
+    (
+    int npins, int nodecnt, int ascnt, int ctlcnt, int num_devs, int nchans,
+    int varsize
+    )
+    {
+    return (sizeof(HDA_TOPO_HDR) +
+            npins * sizeof(HDA_TOPO_PIN) +
+            nodecnt * sizeof(WIDGET) +
+            ascnt * (sizeof(ASSOC) + sizeof(INT32)) +
+            ctlcnt * (sizeof(AUDIO_CTL) + 2 * sizeof(INT32)) +
+            num_devs * sizeof(PCM_DEVINFO) +
+            nchans * (sizeof(CHAN) + sizeof(INT32)) +
+            varsize);
+    }
+
+/* bytes of the channel format lists and the widget connection lists */
+
+LOCAL int topo_varsize
+    (
+    HDCODEC_ID codec
+    )
+    {
+    int i, j, len = 0;
+
+    for (i = 0; i < codec->num_hdaa_chans; i++)
+        {
+        for (j = 0; codec->hdaa_chan_table[i].caps.fmtlist[j] != 0; j++)
+            ;
+        len += (j + 1) * sizeof(UINT32);
+        }
+    for (i = 0; i < codec->nodecnt; i++)
+        len += codec->widgets[i].nconns * sizeof(nid8_t);
+
+    return (len);
+    }
+
+LOCAL WIDGET * topo_fg
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    HDCODEC_ID codec
+    )
+    {
+    WIDGET *fg;
+
+    /* the function group that owns the widget array */
+
+    fg = (WIDGET*)lstFirst(&vxbHdAudioGetRootWidget(pDrvCtrl, codec->cad)->widgetList);
+    while (fg != NULL && fg->children != codec->widgets)
+        fg = (WIDGET*)lstNext((NODE*)fg);
+
+    return (fg);
+    }
+
+/****************************************************************************
+ * void topo_save
+ *
+ * Serialize the parse result of a codec and hand it to the cache storage.
+ * Called right after prepare_pcms(), before anything is committed to the
+ * codec.
+ ****************************************************************************/
+
+LOCAL void topo_save
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    HDCODEC_ID codec,
+    UINT32 vendorid,
+    UINT32 revisionid
+    )
+    {
+    HDA_TOPO_HDR *hdr;
+    HDA_TOPO_PIN *pins;
+    WIDGET *fg, *w;
+    ASSOC *as;
+    AUDIO_CTL *ctl;
+    PCM_DEVINFO *dev;
+    CHAN *ch;
+    INT32 *ref;
+    UINT32 *fmt;
+    UINT8 *buf, *p;
+    int i, j, npins, len, varsize;
+
+    if (vxbHdAudioTopoPath == NULL && vxbHdAudioTopoWriteRtn == NULL)
+        return;
+
+    if (codec->widgets == NULL || (fg = topo_fg(pDrvCtrl, codec)) == NULL)
+        return;
+
+    npins = 0;
+    for (i = 0; i < codec->nodecnt; i++)
+        {
+        if (codec->widgets[i].type ==
+            HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX)
+            npins++;
+        }
+
+    varsize = topo_varsize(codec);
+    len = topo_size(npins, codec->nodecnt, codec->ascnt, codec->ctlcnt,
+                    codec->num_devs, codec->num_hdaa_chans, varsize);
+
+    if (varsize > 0xffff || len > HDA_TOPO_MAX_SIZE ||
+        (buf = calloc(1, len)) == NULL)
+        return;
+
+    hdr = (HDA_TOPO_HDR *)buf;
+    hdr->magic = HDA_TOPO_MAGIC;
+    hdr->version = HDA_TOPO_VERSION;
+    hdr->hdrsize = sizeof(HDA_TOPO_HDR);
+    hdr->length = len;
+    hdr->vendorid = vendorid;
+    hdr->revisionid = revisionid;
+    hdr->subsystemid = hda_command(codec,
+                                   HDA_CMD_GET_SUBSYSTEM_ID(0, fg->nid));
+    hdr->widgetsize = sizeof(WIDGET);
+    hdr->assocsize = sizeof(ASSOC);
+    hdr->ctlsize = sizeof(AUDIO_CTL);
+    hdr->devsize = sizeof(PCM_DEVINFO);
+    hdr->chansize = sizeof(CHAN);
+    hdr->npins = npins;
+    hdr->outamp_cap = codec->outamp_cap;
+    hdr->inamp_cap = codec->inamp_cap;
+    hdr->supp_stream_formats = codec->supp_stream_formats;
+    hdr->supp_pcm_size_rate = codec->supp_pcm_size_rate;
+    hdr->nid = codec->nid;
+    hdr->fgnid = fg->nid;
+    hdr->fgtype = fg->type;
+    hdr->nodecnt = codec->nodecnt;
+    hdr->startnode = codec->startnode;
+    hdr->ascnt = codec->ascnt;
+    hdr->ctlcnt = codec->ctlcnt;
+    hdr->num_devs = codec->num_devs;
+    hdr->num_hdaa_chans = codec->num_hdaa_chans;
+    hdr->varsize = varsize;
+
+    p = buf + sizeof(HDA_TOPO_HDR);
+
+    pins = (HDA_TOPO_PIN *)p;
+    for (i = 0; i < codec->nodecnt; i++)
+        {
+        w = &codec->widgets[i];
+        if (w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX)
+            continue;
+        pins->nid = w->nid;
+        pins->config = w->wclass.pin.original;
+        pins++;
+        }
+    p = (UINT8 *)pins;
+
+    /* tables, with every pointer cleared */
+
+    w = (WIDGET *)p;
+    memcpy (w, codec->widgets, codec->nodecnt * sizeof(WIDGET));
+    for (i = 0; i < codec->nodecnt; i++, w++)
+        {
+        memset (&w->node, 0, sizeof(w->node));
+        memset (&w->widgetList, 0, sizeof(w->widgetList));
+        w->children = NULL;
+        w->conns = NULL;
+        w->pDev = NULL;
+        w->codec = NULL;
+        }
+    p = (UINT8 *)w;
+
+    as = (ASSOC *)p;
+    memcpy (as, codec->assoc_table, codec->ascnt * sizeof(ASSOC));
+    for (i = 0; i < codec->ascnt; i++)
+        as[i].pcm_dev = NULL;
+    p += codec->ascnt * sizeof(ASSOC);
+
+    ctl = (AUDIO_CTL *)p;
+    memcpy (ctl, codec->ctl, codec->ctlcnt * sizeof(AUDIO_CTL));
+    for (i = 0; i < codec->ctlcnt; i++)
+        {
+        ctl[i].widget = NULL;
+        ctl[i].childwidget = NULL;
+        }
+    p += codec->ctlcnt * sizeof(AUDIO_CTL);
+
+    dev = (PCM_DEVINFO *)p;
+    memcpy (dev, codec->pcm_dev_table, codec->num_devs * sizeof(PCM_DEVINFO));
+    for (i = 0; i < codec->num_devs; i++)
+        {
+        dev[i].pDev = NULL;
+        dev[i].codec = NULL;
+        dev[i].pDspDev = NULL;
+        dev[i].pMixerDev = NULL;
+        dev[i].mixer = NULL;
+        memset (dev[i].plan, 0, sizeof(dev[i].plan));
+        }
+    p += codec->num_devs * sizeof(PCM_DEVINFO);
+
+    ch = (CHAN *)p;
+    memcpy (ch, codec->hdaa_chan_table, codec->num_hdaa_chans * sizeof(CHAN));
+    for (i = 0; i < codec->num_hdaa_chans; i++)
+        {
+        ch[i].codec = NULL;
+        ch[i].b = NULL;
+        ch[i].c = NULL;
+        ch[i].pcm_dev = NULL;
+        ch[i].dmapos = NULL;
+        ch[i].caps.fmtlist = NULL;
+        }
+    p += codec->num_hdaa_chans * sizeof(CHAN);
+
+    /* pointers as indexes: ASSOC pcm_dev, AUDIO_CTL widgets, CHAN pcm_dev */
+
+    ref = (INT32 *)p;
+    for (i = 0; i < codec->ascnt; i++)
+        *ref++ = (codec->assoc_table[i].pcm_dev == NULL) ? -1 :
+                 codec->assoc_table[i].pcm_dev - codec->pcm_dev_table;
+    for (i = 0; i < codec->ctlcnt; i++)
+        {
+        *ref++ = (codec->ctl[i].widget == NULL) ? -1 :
+                 codec->ctl[i].widget->nid;
+        *ref++ = (codec->ctl[i].childwidget == NULL) ? -1 :
+                 codec->ctl[i].childwidget->nid;
+        }
+    for (i = 0; i < codec->num_hdaa_chans; i++)
+        *ref++ = (codec->hdaa_chan_table[i].pcm_dev == NULL) ? -1 :
+                 codec->hdaa_chan_table[i].pcm_dev - codec->pcm_dev_table;
+
+    /* variable length lists: channel formats, then widget connections */
+
+    fmt = (UINT32 *)ref;
+    for (i = 0; i < codec->num_hdaa_chans; i++)
+        {
+        for (j = 0; codec->hdaa_chan_table[i].caps.fmtlist[j] != 0; j++)
+            *fmt++ = codec->hdaa_chan_table[i].caps.fmtlist[j];
+        *fmt++ = 0;
+        }
+    p = (UINT8 *)fmt;
+    for (i = 0; i < codec->nodecnt; i++)
+        {
+        memcpy (p, codec->widgets[i].conns, codec->widgets[i].nconns);
+        p += codec->widgets[i].nconns;
+        }
+
+    hdr->checksum = topo_checksum(buf + sizeof(HDA_TOPO_HDR),
+                                  len - sizeof(HDA_TOPO_HDR));
+
+    if (topo_io(pDrvCtrl, codec->cad, buf, len, TRUE) != len)
+        HDA_DBG(HDA_DBG_ERR, "codec %d: unable to save topology cache\n",
+                codec->cad);
+
+    free (buf);
+    }
+
+/****************************************************************************
+ * STATUS topo_load
+ *
+ * Restore the parse result of a codec from the cache storage.  The blob
+ * must match the codec IDs, the subsystem ID and every pin configuration
+ * default; all of them are read with one batch of verbs.
+ *
+ * RETURNS: OK if the codec tables were restored, ERROR to parse normally
+ ****************************************************************************/
+
+LOCAL STATUS topo_load
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    HDCODEC_ID codec,
+    UINT32 vendorid,
+    UINT32 revisionid
+    )
+    {
+    HDA_TOPO_HDR *hdr;
+    HDA_TOPO_PIN *pins;
+    UINT32 *verbs = NULL, *res = NULL;
+    WIDGET *root, *fg, *w;
+    INT32 *ref;
+    UINT32 *fmt;
+    UINT8 *buf, *p, *end;
+    int i, n, len;
+
+    if (vxbHdAudioTopoPath == NULL && vxbHdAudioTopoReadRtn == NULL)
+        return (ERROR);
+
+    if ((buf = malloc(HDA_TOPO_MAX_SIZE)) == NULL)
+        return (ERROR);
+
+    n = topo_io(pDrvCtrl, codec->cad, buf, HDA_TOPO_MAX_SIZE, FALSE);
+    hdr = (HDA_TOPO_HDR *)buf;
+
+    if (n < (int)sizeof(HDA_TOPO_HDR) ||
+        hdr->magic != HDA_TOPO_MAGIC ||
+        hdr->version != HDA_TOPO_VERSION ||
+        hdr->hdrsize != sizeof(HDA_TOPO_HDR) ||
+        hdr->length != n ||
+        hdr->widgetsize != sizeof(WIDGET) ||
+        hdr->assocsize != sizeof(ASSOC) ||
+        hdr->ctlsize != sizeof(AUDIO_CTL) ||
+        hdr->devsize != sizeof(PCM_DEVINFO) ||
+        hdr->chansize != sizeof(CHAN) ||
+        hdr->vendorid != vendorid ||
+        hdr->revisionid != revisionid ||
+        hdr->nodecnt <= 0 ||
+        hdr->length != topo_size(hdr->npins, hdr->nodecnt, hdr->ascnt,
+                                 hdr->ctlcnt, hdr->num_devs,
+                                 hdr->num_hdaa_chans, hdr->varsize) ||
+        hdr->checksum != topo_checksum(buf + sizeof(HDA_TOPO_HDR),
+                                       n - sizeof(HDA_TOPO_HDR)))
+        goto topo_reject;
+
+    /* confirm the board wiring with the subsystem ID and pin defaults */
+
+    pins = (HDA_TOPO_PIN *)(buf + sizeof(HDA_TOPO_HDR));
+    verbs = malloc((hdr->npins + 1) * sizeof(UINT32));
+    res = malloc((hdr->npins + 1) * sizeof(UINT32));
+    if (verbs == NULL || res == NULL)
+        goto topo_reject;
+
+    verbs[0] = HDA_CMD_GET_SUBSYSTEM_ID(0, hdr->fgnid);
+    for (i = 0; i < hdr->npins; i++)
+        verbs[i + 1] = HDA_CMD_GET_CONFIGURATION_DEFAULT(0, pins[i].nid);
+
+    if (hda_command_batch(codec, verbs, res, hdr->npins + 1) !=
+        hdr->npins + 1 || res[0] != hdr->subsystemid)
+        goto topo_reject;
+
+    for (i = 0; i < hdr->npins; i++)
+        {
+        if (res[i + 1] != pins[i].config)
+            goto topo_reject;
+        }
+
+    free (verbs);
+    free (res);
+    verbs = res = NULL;
+
+    /* rebuild the widget tree: root, the function group and its array */
+
+    root = vxbHdAudioGetRootWidget(pDrvCtrl, codec->cad);
+    lstInit (&root->widgetList);
+    root->nid = 0;
+
+    fg = vxbHdAudioWidgetCreate(pDrvCtrl, codec->cad, hdr->fgnid);
+    if (fg == NULL)
+        goto topo_undo;
+    fg->type = hdr->fgtype;
+    fg->children = arena_alloc(&codec->arena, hdr->nodecnt * sizeof(WIDGET));
+    if (fg->children == NULL)
+        goto topo_undo;
+    lstAdd (&root->widgetList, (NODE*)fg);
+
+    codec->nid = hdr->nid;
+    codec->nodecnt = hdr->nodecnt;
+    codec->startnode = hdr->startnode;
+    codec->endnode = hdr->startnode + hdr->nodecnt - 1;
+    codec->widgets = fg->children;
+    codec->outamp_cap = hdr->outamp_cap;
+    codec->inamp_cap = hdr->inamp_cap;
+    codec->supp_stream_formats = hdr->supp_stream_formats;
+    codec->supp_pcm_size_rate = hdr->supp_pcm_size_rate;
+
+    p = (UINT8 *)(pins + hdr->npins);
+
+    memcpy (codec->widgets, p, hdr->nodecnt * sizeof(WIDGET));
+    p += hdr->nodecnt * sizeof(WIDGET);
+    for (i = 0; i < codec->nodecnt; i++)
+        {
+        w = &codec->widgets[i];
+        lstInit (&w->widgetList);
+        w->pDev = pDrvCtrl->pDev;
+        w->codec = codec;
+        lstAdd (&fg->widgetList, (NODE*)w);
+        }
+
+    codec->ascnt = hdr->ascnt;
+    codec->ctlcnt = hdr->ctlcnt;
+    codec->num_devs = hdr->num_devs;
+    codec->num_hdaa_chans = hdr->num_hdaa_chans;
+
+    codec->assoc_table = arena_alloc(&codec->arena,
+                                     codec->ascnt * sizeof(ASSOC));
+    codec->ctl = arena_alloc(&codec->arena, codec->ctlcnt * sizeof(AUDIO_CTL));
+    codec->pcm_dev_table = arena_alloc(&codec->arena,
+                                       codec->num_devs * sizeof(PCM_DEVINFO));
+    codec->hdaa_chan_table = arena_alloc(&codec->arena,
+                                         codec->num_hdaa_chans * sizeof(CHAN));
+    if (codec->assoc_table == NULL || codec->ctl == NULL ||
+        codec->pcm_dev_table == NULL || codec->hdaa_chan_table == NULL)
+        goto topo_undo;
+
+    memcpy (codec->assoc_table, p, codec->ascnt * sizeof(ASSOC));
+    p += codec->ascnt * sizeof(ASSOC);
+    memcpy (codec->ctl, p, codec->ctlcnt * sizeof(AUDIO_CTL));
+    p += codec->ctlcnt * sizeof(AUDIO_CTL);
+    memcpy (codec->pcm_dev_table, p, codec->num_devs * sizeof(PCM_DEVINFO));
+    p += codec->num_devs * sizeof(PCM_DEVINFO);
+    memcpy (codec->hdaa_chan_table, p, codec->num_hdaa_chans * sizeof(CHAN));
+    p += codec->num_hdaa_chans * sizeof(CHAN);
+
+    ref = (INT32 *)p;
+    for (i = 0; i < codec->ascnt; i++, ref++)
+        codec->assoc_table[i].pcm_dev = (*ref < 0 || *ref >= codec->num_devs) ?
+            NULL : &codec->pcm_dev_table[*ref];
+    for (i = 0; i < codec->ctlcnt; i++, ref += 2)
+        {
+        codec->ctl[i].widget = (ref[0] < 0) ? NULL : widget_get(codec, ref[0]);
+        codec->ctl[i].childwidget = (ref[1] < 0) ? NULL : widget_get(codec, ref[1]);
+        }
+    audio_ctl_index(codec);
+    for (i = 0; i < codec->num_hdaa_chans; i++, ref++)
+        {
+        CHAN *ch = &codec->hdaa_chan_table[i];
+
+        ch->codec = codec;
+        ch->pcm_dev = (*ref < 0 || *ref >= codec->num_devs) ?
+            NULL : &codec->pcm_dev_table[*ref];
+        }
+
+    /* the variable length lists are copied out of the blob */
+
+    end = buf + hdr->length;
+    fmt = (UINT32 *)ref;
+    for (i = 0; i < codec->num_hdaa_chans; i++)
+        {
+        CHAN *ch = &codec->hdaa_chan_table[i];
+
+        for (n = 0; (UINT8 *)&fmt[n] < end && fmt[n] != 0; n++)
+            ;
+        if ((UINT8 *)&fmt[n] >= end || n >= HDA_CHAN_FMTS_MAX)
+            goto topo_undo;
+        ch->caps.fmtlist = arena_carve(&codec->arena,
+                                       (n + 1) * sizeof(UINT32),
+                                       sizeof(UINT32));
+        if (ch->caps.fmtlist == NULL)
+            goto topo_undo;
+        memcpy (ch->caps.fmtlist, fmt, (n + 1) * sizeof(UINT32));
+        fmt += n + 1;
+        }
+    p = (UINT8 *)fmt;
+    for (i = 0; i < codec->nodecnt; i++)
+        {
+        w = &codec->widgets[i];
+        if (w->nconns == 0)
+            continue;
+        if (p + w->nconns > end ||
+            (w->conns = arena_carve(&codec->arena, w->nconns,
+                                    sizeof(nid8_t))) == NULL)
+            goto topo_undo;
+        memcpy (w->conns, p, w->nconns);
+        p += w->nconns;
+        }
+    if (p != end)
+        goto topo_undo;
+    for (i = 0; i < codec->num_devs; i++)
+        {
+        codec->pcm_dev_table[i].pDev = codec->pDev;
+        codec->pcm_dev_table[i].codec = codec;
+        }
+#ifdef  HDA_DBG_ON
+    global_pcmdev = codec->pcm_dev_table;
+#endif
+
+    HDA_DBG(HDA_DBG_INFO, "codec %d: topology restored from cache, "
+            "%d widgets\n", codec->cad, codec->nodecnt);
+
+    free (buf);
+    return (OK);
+
+    topo_undo:
+    vxbHdAudioWidgetDeleteAll(pDrvCtrl, codec);
+    arena_release (&codec->arena);
+    codec->assoc_table = NULL;
+    codec->ctl = NULL;
+    codec->ctl_start = NULL;
+    codec->ctl_ref = NULL;
+    codec->pcm_dev_table = NULL;
+    codec->hdaa_chan_table = NULL;
+    codec->ascnt = codec->ctlcnt = 0;
+    codec->num_devs = codec->num_hdaa_chans = 0;
+
+    topo_reject:
+    HDA_DBG(HDA_DBG_INFO, "codec %d: no valid topology cache\n", codec->cad);
+    free (verbs);
+    free (res);
+    free (buf);
+    return (ERROR);
+    }
+
+/*******************************************************************************
+ *
+ * vxbHdAudioIsr - interrupt service routine
+ *
+ * This routine handles interrupts of the HD Audio controller
+ *
+ * RETURNS: N/A
+ *
+ * ERRNO: N/A
+ */
+
+LOCAL void vxbHdAudioIsr
+    (
+    VXB_DEVICE_ID pDev
+    )
+    {
+    HDA_DRV_CTRL * pDrvCtrl = (HDA_DRV_CTRL *)pDev->pDrvCtrl;
+    UINT8 rirbsts;
+    UINT32 intsts;
+
+    intsts = READ_4(HDAC_INTSTS);
+    if (intsts & HDAC_INTSTS_GIS)
+        {
+        if (intsts & HDAC_INTSTS_CIS)
+            {
+            rirbsts = READ_1(HDAC_RIRBSTS);
+
+            while (rirbsts & HDAC_RIRBSTS_RINTFL)
+                {
+                WRITE_1(HDAC_RIRBSTS, rirbsts);
+                rirb_flush(pDrvCtrl);
+                rirbsts = READ_1(HDAC_RIRBSTS);
+                }
+
+            if (pDrvCtrl->unsolq_rp != pDrvCtrl->unsolq_wp)
+                {
+                VXB_HDA_MSG msg;
+                msg.pDev = pDev;
+                msg.type = VXB_HDA_MSG_TYPE_UNSOLQ;
+                msgQSend(pDrvCtrl->unsolq_msgQ, (char*)&msg,
+                         VXB_HDA_MSG_SIZE, NO_WAIT, MSG_PRI_NORMAL);
+                }
+            }
+
+        if (intsts & HDAC_INTSTS_SIS_MASK)
+            {
+            int i;
+            HDCODEC* codec;
+       
+            for (i = 0; i < pDrvCtrl->num_ss; i++)
+                {
+                if ((intsts & (1 << i)) == 0)
+                    continue;
+
+                WRITE_1((i << 5) + HDAC_SDSTS,
+                             READ_1((i << 5) + HDAC_SDSTS));
+
+                if ((codec = pDrvCtrl->streams[i].codec) != NULL)
+                    {
+                    stream_intr(pDrvCtrl->streams[i].codec, pDrvCtrl->streams[i].dir, pDrvCtrl->streams[i].stream);
+                    }
+                }
+            }
+        WRITE_4(HDAC_INTSTS, intsts);
+        }
+    }
+
+LOCAL void stream_intr
+    (
+    HDCODEC_ID codec,
+    int dir,
+    int stream
+    )
+    {
+    int i;
+    CHAN *ch;
+
+    for (i = 0; i < codec->num_hdaa_chans; i++)
+        {
+        ch = &codec->hdaa_chan_table[i];
+        if (!(ch->flags & CHN_RUNNING))
+            continue;
+
+        if (((ch->sid == stream) && (dir == 1) && (ch->dir == CTL_OUT)) ||
+            ((ch->sid == stream) && (dir == 0) && (ch->dir == CTL_IN)))
+            {
+            osschannel_intr(ch->c);
+            }
+        }
+    }
+
+/*******************************************************************************
+ *
+ * vxbHdAudioMonTask - status monitor task
+ *
+ * This routine is the task loop to handle jack insertion/removal
+ *
+ * RETURN: N/A
+ *
+ * ERRNO: N/A
+ */
+
+LOCAL void vxbHdAudioMonTask
+    (
+    MSG_Q_ID    msgQ
+    )
+    {
+
+    FOREVER
+        {
+        VXB_HDA_MSG msg;
+        
+        if (msgQReceive (msgQ, (char*)&msg, sizeof(msg), NO_WAIT) != ERROR)
+            {
+            HDA_DRV_CTRL * pDrvCtrl;
+            VXB_DEVICE_ID pDev;
 
             pDev = msg.pDev;
             pDrvCtrl = device_get_softc(pDev);
@@ -1021,9 +2152,9 @@ LOCAL int stream_alloc
     if (ss < 0)
         return (0);
 
-    /* Allocate stream number */
+    /* Allocate stream number; bidirectional streams count down from 15 */
     if (ss >= pDrvCtrl->num_iss + pDrvCtrl->num_oss)
-        stream = 15 - (ss - pDrvCtrl->num_iss + pDrvCtrl->num_oss);
+        stream = 15 - (ss - (pDrvCtrl->num_iss + pDrvCtrl->num_oss));
     else if (ss >= pDrvCtrl->num_iss)
         stream = ss - pDrvCtrl->num_iss + 1;
     else
@@ -1139,6 +2270,10 @@ LOCAL int stream_start
     
     WRITE_2(off + HDAC_SDFMT, pDrvCtrl->streams[ss].format);
 
+    /* FIFOS reflects the format just programmed */
+
+    pDrvCtrl->streams[ss].fifosize = READ_2(off + HDAC_SDFIFOS) + 1;
+
     ctl = READ_4(HDAC_INTCTL);
     ctl |= 1 << ss;
     WRITE_4(HDAC_INTCTL, ctl);
@@ -1224,12 +2359,25 @@ LOCAL int rirb_flush
     )
     {
     RIRB *rirb_base, *rirb;
+    HDCODEC_ID codec;
     cad_t cad;
     UINT32 resp;
+    UINT32 wake = 0;
+    UINT32 strayResp = 0, strayEx = 0;
+    int strays = 0, strayCad = 0;
     UINT8 rirbwp;
     int ret;
 
     rirb_base = (RIRB *)pDrvCtrl->rirb_dma.dma_vaddr;
+
+    /*
+     * Called from both the ISR and command waiters.  No kernel calls or
+     * prints under the spinlock: waiters to wake and a stray response are
+     * noted and dealt with once it is released.
+     */
+
+    SPIN_LOCK_ISR_TAKE (&pDrvCtrl->rirb_lock);
+
     rirbwp = READ_1(HDAC_RIRBWP);
 
     vxbDmaBufSync( pDrvCtrl->pDev, pDrvCtrl->rirb_dma.dma_tag,
@@ -1245,61 +2393,452 @@ LOCAL int rirb_flush
         cad = RIRB_RESPONSE_EX_SDATA_IN(rirb->response_ex);
         resp = rirb->response;
 
-        if ((pDrvCtrl->codec_table[cad] != NULL) && (pDrvCtrl->codec_table[cad]->pending > 0))
-            {
-            pDrvCtrl->codec_table[cad]->response = resp;
-            pDrvCtrl->codec_table[cad]->pending--;
-            }
-        else if (rirb->response_ex & RIRB_RESPONSE_EX_UNSOLICITED)
-            {
-            pDrvCtrl->unsolq[pDrvCtrl->unsolq_wp++] = resp;
-            pDrvCtrl->unsolq_wp %= HDAC_UNSOLQ_MAX;
-            pDrvCtrl->unsolq[pDrvCtrl->unsolq_wp++] = cad;
-            pDrvCtrl->unsolq_wp %= HDAC_UNSOLQ_MAX;
-            }
-        else
+        /*
+         * Unsolicited responses may arrive while a batch is outstanding,
+         * so they must be sorted out before crediting a pending verb.
+         */
+
+        if (rirb->response_ex & RIRB_RESPONSE_EX_UNSOLICITED)
+            {
+            pDrvCtrl->unsolq[pDrvCtrl->unsolq_wp++] = resp;
+            pDrvCtrl->unsolq_wp %= HDAC_UNSOLQ_MAX;
+            pDrvCtrl->unsolq[pDrvCtrl->unsolq_wp++] = cad;
+            pDrvCtrl->unsolq_wp %= HDAC_UNSOLQ_MAX;
+            }
+        else if ((codec = pDrvCtrl->codec_table[cad]) != NULL && codec->pending > 0)
+            {
+            codec->response = resp;
+            if (codec->responses != NULL)
+                codec->responses[codec->nresponses] = resp;
+            codec->nresponses++;
+            if (--codec->pending == 0)
+                wake |= 1 << cad;
+            }
+        else
+            {
+            strayCad = cad;
+            strayEx = rirb->response_ex;
+            strayResp = resp;
+            strays++;
+            }
+        
+        ret++;
+        }
+
+    SPIN_LOCK_ISR_GIVE (&pDrvCtrl->rirb_lock);
+
+    for (cad = 0; wake != 0; cad++, wake >>= 1)
+        {
+        if ((wake & 1) && (codec = pDrvCtrl->codec_table[cad]) != NULL &&
+            codec->cmd_sem != NULL)
+            semGive (codec->cmd_sem);
+        }
+
+    if (strays > 0)
+        logMsg ("hda: %d unexpected response(s), last from address %d: %x %08x\n",
+                strays, strayCad, (int)strayEx, (int)strayResp, 5, 6);
+
+    return (ret);
+    }
+
+LOCAL int unsolq_flush
+    (
+    HDA_DRV_CTRL *pDrvCtrl
+    )
+    {
+    cad_t cad;
+    UINT32 resp;
+    int ret = 0;
+
+    /* whoever holds the lock drains the queue for everybody */
+
+    if (pDrvCtrl->unsolq_lock != NULL &&
+        semTake (pDrvCtrl->unsolq_lock, NO_WAIT) != OK)
+        return (0);
+
+    if (pDrvCtrl->unsolq_st == HDAC_UNSOLQ_READY)
+        {
+        pDrvCtrl->unsolq_st = HDAC_UNSOLQ_BUSY;
+
+        while (pDrvCtrl->unsolq_rp != pDrvCtrl->unsolq_wp)
+            {
+            resp = pDrvCtrl->unsolq[pDrvCtrl->unsolq_rp++];
+            pDrvCtrl->unsolq_rp %= HDAC_UNSOLQ_MAX;
+
+            cad = pDrvCtrl->unsolq[pDrvCtrl->unsolq_rp++];
+            pDrvCtrl->unsolq_rp %= HDAC_UNSOLQ_MAX;
+
+            if (pDrvCtrl->codec_table[cad] != NULL)
+                {
+                hdacc_unsol_intr(pDrvCtrl->codec_table[cad], resp);
+                }
+            
+            ret++;
+            }
+        pDrvCtrl->unsolq_st = HDAC_UNSOLQ_READY;
+        }
+
+    if (pDrvCtrl->unsolq_lock != NULL)
+        semGive (pDrvCtrl->unsolq_lock);
+    
+    return (ret);
+    }
+
+/****************************************************************************
+ * STATUS immediate_command(HDA_DRV_CTRL *, int, UINT32, UINT32 *)
+ *
+ * Send one verb through the Immediate Command registers (ICOI/ICII/ICIS)
+ * and busy-wait for its response.  This avoids the CORB/RIRB DMA round
+ * trip and the cache maintenance that goes with it.  The interface is
+ * optional; if it does not respond it is disabled for good and callers
+ * fall back to the rings.
+ *
+ * RETURNS: OK, or ERROR if the interface timed out
+ ****************************************************************************/
+
+LOCAL STATUS immediate_command
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    int cad,
+    UINT32 verb,
+    UINT32 *response
+    )
+    {
+    int timeout;
+    UINT16 icis;
+
+    verb &= ~HDA_CMD_CAD_MASK;
+    verb |= ((UINT32)cad) << HDA_CMD_CAD_SHIFT;
+
+    if (pDrvCtrl->cmd_lock != NULL)
+        semTake (pDrvCtrl->cmd_lock, WAIT_FOREVER);
+
+    /* wait for a previous verb to leave the interface */
+
+    timeout = HDA_IMM_TIMEOUT_US;
+    while ((READ_2(HDAC_ICIS) & HDAC_ICIS_ICB) && --timeout)
+        vxbUsDelay(1);
+
+    if (timeout == 0)
+        goto immediate_fail;
+
+    /* clear a stale result, then issue the verb */
+
+    WRITE_2(HDAC_ICIS, HDAC_ICIS_IRV);
+    WRITE_4(HDAC_ICOI, verb);
+    WRITE_2(HDAC_ICIS, HDAC_ICIS_ICB);
+
+    timeout = HDA_IMM_TIMEOUT_US;
+    while (timeout > 0)
+        {
+        icis = READ_2(HDAC_ICIS);
+        if ((icis & (HDAC_ICIS_ICB | HDAC_ICIS_IRV)) == HDAC_ICIS_IRV)
+            break;
+        vxbUsDelay(1);
+        timeout--;
+        }
+
+    if (timeout == 0)
+        goto immediate_fail;
+
+    *response = READ_4(HDAC_ICII);
+    WRITE_2(HDAC_ICIS, HDAC_ICIS_IRV);
+
+    if (pDrvCtrl->cmd_lock != NULL)
+        semGive (pDrvCtrl->cmd_lock);
+    return (OK);
+
+    immediate_fail:
+    HDA_DBG(HDA_DBG_ERR, "Immediate command timeout on address %d, "
+            "HDAC_ICIS=%4.4x, using CORB/RIRB only\n",
+            cad, READ_2(HDAC_ICIS));
+    pDrvCtrl->imm_ok = FALSE;
+    if (pDrvCtrl->cmd_lock != NULL)
+        semGive (pDrvCtrl->cmd_lock);
+    return (ERROR);
+    }
+
+/****************************************************************************
+ * int immediate_batch
+ *
+ * Send a group of verbs one by one through the Immediate Command interface.
+ * Used while the rings are not running, or after the CORB stalled.
+ *
+ * RETURNS: the number of verbs that completed
+ ****************************************************************************/
+
+LOCAL int immediate_batch
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    int cad,
+    UINT32 *verbs,
+    UINT32 *responses,
+    int n
+    )
+    {
+    UINT32 response;
+    int i;
+
+    for (i = 0; i < n; i++)
+        {
+        if (immediate_command(pDrvCtrl, cad, verbs[i], &response) != OK)
+            break;
+        pDrvCtrl->codec_table[cad]->response = response;
+        if (responses != NULL)
+            responses[i] = response;
+        }
+
+    return (i);
+    }
+
+/****************************************************************************
+ * BOOL ring_idle(HDA_DRV_CTRL *)
+ *
+ * Check that the CORB has been fetched completely and no codec is waiting
+ * for a response, so the immediate interface may be used without the two
+ * paths interleaving on the link.
+ *
+ * RETURNS: TRUE if no verbs are in flight on the rings
+ ****************************************************************************/
+
+LOCAL BOOL ring_idle
+    (
+    HDA_DRV_CTRL *pDrvCtrl
+    )
+    {
+    int cad;
+
+    for (cad = 0; cad < HDAC_CODEC_NUM_MAX; cad++)
+        {
+        if (pDrvCtrl->codec_table[cad] != NULL &&
+            pDrvCtrl->codec_table[cad]->pending != 0)
+            return (FALSE);
+        }
+
+    return ((READ_2(HDAC_CORBRP) & HDAC_CORBRP_CORBRP_MASK) ==
+            pDrvCtrl->corb_wp);
+    }
+
+#define RING_USABLE(sc)                                             \
+    ((sc)->corb_running && (sc)->rirb_running && !(sc)->corb_stalled)
+
+/****************************************************************************
+ * BOOL command_wait(HDA_DRV_CTRL *, HDCODEC_ID)
+ *
+ * Wait for all pending verbs of a codec to be answered.  The RIRB is polled
+ * for a short while first, as a verb normally completes within a couple of
+ * link frames; after that the caller blocks on the codec's completion
+ * semaphore, which rirb_flush() gives from vxbHdAudioIsr() once the last
+ * response is in.  Each expired tick polls the RIRB once more, which also
+ * covers a missed interrupt and bring-up before interrupts are enabled.
+ * With cmd_poll set the legacy 1 ms sleep-poll loop is used instead.
+ *
+ * RETURNS: TRUE if all responses arrived, FALSE on timeout
+ ****************************************************************************/
+
+LOCAL BOOL command_wait
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    HDCODEC_ID codec
+    )
+    {
+    int timeout;
+
+    if (pDrvCtrl->cmd_poll || codec->cmd_sem == NULL)
+        {
+        timeout = HDA_CMD_TIMEOUT_SECS * 1000;
+        do {
+        if (rirb_flush(pDrvCtrl) == 0)
+            vxbUsDelay(1000);
+        } while (codec->pending != 0 && --timeout);
+
+        return (codec->pending == 0);
+        }
+
+    for (timeout = HDA_CMD_SPIN_COUNT; timeout > 0; timeout--)
+        {
+        rirb_flush(pDrvCtrl);
+        if (codec->pending == 0)
+            return (TRUE);
+        vxbUsDelay(1);
+        }
+
+    timeout = HDA_CMD_TIMEOUT_SECS * sysClkRateGet();
+    while (codec->pending != 0 && timeout-- > 0)
+        {
+        if (semTake (codec->cmd_sem, 1) == ERROR)
+            rirb_flush(pDrvCtrl);
+        }
+
+    return (codec->pending == 0);
+    }
+
+/****************************************************************************
+ * int send_command_batch
+ *
+ * Queue a group of verbs for one codec in the CORB with a single write of
+ * HDAC_CORBWP, then collect the responses in the order the verbs were
+ * queued.  A codec answers its verbs strictly in order, so responses[i]
+ * belongs to verbs[i].  Groups larger than the rings are split.  The
+ * <responses> array may be NULL when the results are not needed; entries
+ * for verbs that did not complete are left as HDA_INVALID.
+ *
+ * RETURNS: the number of verbs that completed
+ ****************************************************************************/
+
+LOCAL int send_command_batch
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    int cad,
+    UINT32 *verbs,
+    UINT32 *responses,
+    int n
+    )
+    {
+    HDCODEC_ID codec = pDrvCtrl->codec_table[cad];
+    int i, chunk, max, done, got, left;
+    UINT32 *corb;
+    UINT32 verb;
+    UINT16 corbrp, corbwp,rintcnt,rirbwp;
+    UINT8 corbsts, rirbsts,rirbctl,corbctl;
+
+    if (responses != NULL)
+        {
+        for (i = 0; i < n; i++)
+            responses[i] = HDA_INVALID;
+        }
+
+    /*
+     * One slot of each ring must stay free to tell full from empty.  Every
+     * codec may have a chunk in flight at the same time, so each one only
+     * gets its share of the rings.
+     */
+
+    max = MIN(pDrvCtrl->corb_size, pDrvCtrl->rirb_size) - 1;
+    if (pDrvCtrl->num_codec > 1)
+        max /= pDrvCtrl->num_codec;
+    if (max < 1)
+        max = 1;
+
+    corb = (UINT32 *)pDrvCtrl->corb_dma.dma_vaddr;
+    done = 0;
+
+    if (codec->cmd_mutex != NULL)
+        semTake (codec->cmd_mutex, WAIT_FOREVER);
+
+    codec->prof.verbs += n;
+
+    if (!RING_USABLE(pDrvCtrl) && pDrvCtrl->imm_ok)
+        {
+        done = immediate_batch(pDrvCtrl, cad, verbs, responses, n);
+        if (done == n)
+            goto batch_out;
+        }
+
+    while (done < n)
+        {
+        chunk = MIN(n - done, max);
+
+        /* drop a completion left over from an earlier timeout */
+
+        if (codec->cmd_sem != NULL)
+            semTake (codec->cmd_sem, NO_WAIT);
+
+        SPIN_LOCK_ISR_TAKE (&pDrvCtrl->rirb_lock);
+        codec->response = HDA_INVALID;
+        codec->responses = (responses != NULL) ? &responses[done] : NULL;
+        codec->nresponses = 0;
+        codec->pending += chunk;
+        SPIN_LOCK_ISR_GIVE (&pDrvCtrl->rirb_lock);
+
+        if (pDrvCtrl->cmd_lock != NULL)
+            semTake (pDrvCtrl->cmd_lock, WAIT_FOREVER);
+
+        vxbDmaBufSync( pDrvCtrl->pDev, pDrvCtrl->corb_dma.dma_tag,
+                       pDrvCtrl->corb_dma.dma_map, VXB_DMABUFSYNC_PREWRITE );
+
+        for (i = 0; i < chunk; i++)
             {
-            HDA_DBG(HDA_DBG_ERR, "Unexpected unsolicited response from address %d: %x %08x\n", cad, rirb->response_ex, resp);
+            verb = verbs[done + i];
+            verb &= ~HDA_CMD_CAD_MASK;
+            verb |= ((UINT32)cad) << HDA_CMD_CAD_SHIFT;
+
+            pDrvCtrl->corb_wp++;
+            pDrvCtrl->corb_wp %= pDrvCtrl->corb_size;
+            corb[pDrvCtrl->corb_wp] = verb;
             }
-        
-        ret++;
-        }
 
-    return (ret);
-    }
+        vxbDmaBufSync( pDrvCtrl->pDev, pDrvCtrl->corb_dma.dma_tag,
+                       pDrvCtrl->corb_dma.dma_map, VXB_DMABUFSYNC_POSTWRITE );
 
-LOCAL int unsolq_flush
-    (
-    HDA_DRV_CTRL *pDrvCtrl
-    )
-    {
-    cad_t cad;
-    UINT32 resp;
-    int ret = 0;
+        WRITE_2(HDAC_CORBWP, pDrvCtrl->corb_wp);
 
-    if (pDrvCtrl->unsolq_st == HDAC_UNSOLQ_READY)
-        {
-        pDrvCtrl->unsolq_st = HDAC_UNSOLQ_BUSY;
+        if (pDrvCtrl->cmd_lock != NULL)
+            semGive (pDrvCtrl->cmd_lock);
 
-        while (pDrvCtrl->unsolq_rp != pDrvCtrl->unsolq_wp)
-            {
-            resp = pDrvCtrl->unsolq[pDrvCtrl->unsolq_rp++];
-            pDrvCtrl->unsolq_rp %= HDAC_UNSOLQ_MAX;
+        command_wait(pDrvCtrl, codec);
 
-            cad = pDrvCtrl->unsolq[pDrvCtrl->unsolq_rp++];
-            pDrvCtrl->unsolq_rp %= HDAC_UNSOLQ_MAX;
+        /*
+         * Detach the batch under the lock rirb_flush() credits responses
+         * under, so a response arriving late is reported as stray rather
+         * than written to a finished batch or counted for the next one.
+         */
 
-            if (pDrvCtrl->codec_table[cad] != NULL)
+        SPIN_LOCK_ISR_TAKE (&pDrvCtrl->rirb_lock);
+        got = codec->nresponses;
+        left = codec->pending;
+        codec->responses = NULL;
+        codec->pending = 0;
+        SPIN_LOCK_ISR_GIVE (&pDrvCtrl->rirb_lock);
+
+        done += got;
+
+        if (left != 0)
+            {
+            corbwp = READ_2(HDAC_CORBWP);
+            corbrp = READ_2(HDAC_CORBRP);
+            rintcnt = READ_2(HDAC_RINTCNT);
+            rirbwp = READ_2(HDAC_RIRBWP);
+            corbsts = READ_1(HDAC_CORBSTS);
+            rirbsts = READ_1(HDAC_RIRBSTS);
+            corbctl = READ_1(HDAC_CORBCTL);
+            rirbctl = READ_1(HDAC_RIRBCTL);
+            HDA_DBG(HDA_DBG_ERR, "Command timeout on address %d, HDAC_CORBWP=%4.4x, HDAC_CORBRP=%4.4x, HDAC_RINTCNT=%4.4x, HDAC_RIRBWP=%4.4x\n",
+                    cad, corbwp, corbrp, rintcnt, rirbwp );
+            HDA_DBG(HDA_DBG_ERR, "Command timeout on address %d, HDAC_CORBSTS=%2.2x, HDAC_RIRBSTS=%2.2x, RIRBCTL=%2.2x, HDAC_CORBCTL=%2.2x\n",
+                    cad, corbsts, rirbsts, rirbctl, corbctl );
+            HDA_DBG(HDA_DBG_ERR, "Batch aborted after %d of %d verbs\n",
+                    done, n);
+
+            if ((corbrp & HDAC_CORBRP_CORBRP_MASK) != pDrvCtrl->corb_wp)
                 {
-                hdacc_unsol_intr(pDrvCtrl->codec_table[cad], resp);
+                HDA_DBG(HDA_DBG_ERR, "CORB stalled, "
+                        "falling back to immediate commands\n");
+                pDrvCtrl->corb_stalled = TRUE;
                 }
-            
-            ret++;
+            break;
             }
-        pDrvCtrl->unsolq_st = HDAC_UNSOLQ_READY;
         }
-    
-    return (ret);
+
+    /* deliver whatever a stalled CORB could not */
+
+    if (done < n && pDrvCtrl->corb_stalled && pDrvCtrl->imm_ok)
+        {
+        done += immediate_batch(pDrvCtrl, cad, &verbs[done],
+                                (responses != NULL) ? &responses[done] : NULL,
+                                n - done);
+        }
+
+    batch_out:
+    if (codec->cmd_mutex != NULL)
+        semGive (codec->cmd_mutex);
+
+    if (pDrvCtrl->unsolq_rp != pDrvCtrl->unsolq_wp)
+        {
+        unsolq_flush(pDrvCtrl);
+        }
+
+    return (done);
     }
 
 /****************************************************************************
@@ -1315,59 +2854,76 @@ LOCAL UINT32 send_command
     UINT32 verb
     )
     {
-    int timeout;
-    UINT32 *corb;
-    UINT16 corbrp, corbwp,rintcnt,rirbwp;
-    UINT8 corbsts, rirbsts,rirbctl,corbctl;
+    return (send_command_path(pDrvCtrl, cad, verb, pDrvCtrl->cmd_path));
+    }
 
-    verb &= ~HDA_CMD_CAD_MASK;
-    verb |= ((UINT32)cad) << HDA_CMD_CAD_SHIFT;
+/****************************************************************************
+ * UINT32 send_command_path
+ *
+ * Send one verb over an explicitly chosen transport.  HDA_CMD_PATH_AUTO
+ * takes the immediate interface whenever the rings are idle,
+ * HDA_CMD_PATH_IMMEDIATE first waits for outstanding ring verbs to drain,
+ * and HDA_CMD_PATH_RING always queues in the CORB.  Either way the
+ * immediate interface is used while the rings are stopped or stalled.
+ ****************************************************************************/
 
-    pDrvCtrl->codec_table[cad]->response = HDA_INVALID;
+LOCAL UINT32 send_command_path
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    int cad,
+    UINT32 verb,
+    int path
+    )
+    {
+    UINT32 response = HDA_INVALID;
+    BOOL immediate = FALSE;
+    STATUS status = ERROR;
+    int timeout;
 
-    pDrvCtrl->codec_table[cad]->pending++;
-    pDrvCtrl->corb_wp++;
-    pDrvCtrl->corb_wp %= pDrvCtrl->corb_size;
-    corb = (UINT32 *)pDrvCtrl->corb_dma.dma_vaddr;
+    /*
+     * The command lock keeps other tasks from queueing ring verbs between
+     * the idle check and the immediate command.
+     */
 
-    vxbDmaBufSync( pDrvCtrl->pDev, pDrvCtrl->corb_dma.dma_tag,
-                   pDrvCtrl->corb_dma.dma_map, VXB_DMABUFSYNC_PREWRITE );
+    if (pDrvCtrl->cmd_lock != NULL)
+        semTake (pDrvCtrl->cmd_lock, WAIT_FOREVER);
 
-    corb[pDrvCtrl->corb_wp] = verb;
+    if (pDrvCtrl->imm_ok)
+        {
+        if (!RING_USABLE(pDrvCtrl))
+            immediate = TRUE;
+        else if (path == HDA_CMD_PATH_AUTO)
+            immediate = ring_idle(pDrvCtrl);
+        else if (path == HDA_CMD_PATH_IMMEDIATE)
+            {
+            /* let verbs already queued in the CORB drain first */
 
-    vxbDmaBufSync( pDrvCtrl->pDev, pDrvCtrl->corb_dma.dma_tag,
-                   pDrvCtrl->corb_dma.dma_map, VXB_DMABUFSYNC_POSTWRITE );
+            timeout = HDA_CMD_TIMEOUT_SECS * 1000;
+            while (!ring_idle(pDrvCtrl) && --timeout)
+                {
+                rirb_flush(pDrvCtrl);
+                vxbUsDelay(1000);
+                }
+            immediate = (timeout != 0);
+            }
+        }
 
-    WRITE_2(HDAC_CORBWP, pDrvCtrl->corb_wp);
+    if (immediate)
+        status = immediate_command(pDrvCtrl, cad, verb, &response);
 
-    timeout = 10000;
-    do {
-    if (rirb_flush(pDrvCtrl) == 0)
-        vxbUsDelay(1000);
-    } while (pDrvCtrl->codec_table[cad]->pending != 0 && --timeout);
-
-    if (pDrvCtrl->codec_table[cad]->pending != 0)
-        {
-        corbwp = READ_2(HDAC_CORBWP);
-        corbrp = READ_2(HDAC_CORBRP);
-        rintcnt = READ_2(HDAC_RINTCNT);
-        rirbwp = READ_2(HDAC_RIRBWP);
-        corbsts = READ_1(HDAC_CORBSTS);
-        rirbsts = READ_1(HDAC_RIRBSTS);
-        corbctl = READ_1(HDAC_CORBCTL);
-        rirbctl = READ_1(HDAC_RIRBCTL);
-        HDA_DBG(HDA_DBG_ERR, "Command timeout on address %d, HDAC_CORBWP=%4.4x, HDAC_CORBRP=%4.4x, HDAC_RINTCNT=%4.4x, HDAC_RIRBWP=%4.4x\n",
-                cad, corbwp, corbrp, rintcnt, rirbwp );
-        HDA_DBG(HDA_DBG_ERR, "Command timeout on address %d, HDAC_CORBSTS=%2.2x, HDAC_RIRBSTS=%2.2x, RIRBCTL=%2.2x, HDAC_CORBCTL=%2.2x\n",
-                cad, corbsts, rirbsts, rirbctl, corbctl );
-        pDrvCtrl->codec_table[cad]->pending = 0;
-        }
+    if (pDrvCtrl->cmd_lock != NULL)
+        semGive (pDrvCtrl->cmd_lock);
 
-    if (pDrvCtrl->unsolq_rp != pDrvCtrl->unsolq_wp)
+    if (status == OK)
         {
-        unsolq_flush(pDrvCtrl);
+        pDrvCtrl->codec_table[cad]->response = response;
+        pDrvCtrl->codec_table[cad]->prof.verbs++;
+        return (response);
         }
-    return (pDrvCtrl->codec_table[cad]->response);
+
+    send_command_batch(pDrvCtrl, cad, &verb, &response, 1);
+
+    return (response);
     }
 
 
@@ -1810,6 +3366,9 @@ LOCAL void corb_start
     corbctl = READ_1(HDAC_CORBCTL);
     corbctl |= (HDAC_CORBCTL_CORBRUN | HDAC_CORBCTL_CMEIE);
     WRITE_1(HDAC_CORBCTL, corbctl);
+
+    pDrvCtrl->corb_running = TRUE;
+    pDrvCtrl->corb_stalled = FALSE;
     }
 
 /****************************************************************************
@@ -1827,6 +3386,8 @@ LOCAL void rirb_start
     rirbctl = READ_1(HDAC_RIRBCTL);
     rirbctl |= (HDAC_RIRBCTL_RIRBDMAEN | HDAC_RIRBCTL_RINTCTL);
     WRITE_1(HDAC_RIRBCTL, rirbctl);
+
+    pDrvCtrl->rirb_running = TRUE;
     }
 
 /****************************************************************************
@@ -1845,6 +3406,8 @@ LOCAL void corb_stop
     corbctl = READ_1(HDAC_CORBCTL);
     corbctl &= ~(HDAC_CORBCTL_CORBRUN | HDAC_CORBCTL_CMEIE);
     WRITE_1(HDAC_CORBCTL, corbctl);
+
+    pDrvCtrl->corb_running = FALSE;
     }
 
 /****************************************************************************
@@ -1862,23 +3425,19 @@ LOCAL void rirb_stop
     rirbctl = READ_1(HDAC_RIRBCTL);
     rirbctl &= ~(HDAC_RIRBCTL_RIRBDMAEN | HDAC_RIRBCTL_RINTCTL);
     WRITE_1(HDAC_RIRBCTL, rirbctl);
+
+    pDrvCtrl->rirb_running = FALSE;
     }
 
 LOCAL UINT32 vxbHdAudioCommand (HDA_DRV_CTRL* pDrvCtrl, cad_t cad, UINT32 verb)
     {
+    if (pDrvCtrl->codec_table[cad] != NULL)
+        return cached_command(pDrvCtrl, pDrvCtrl->codec_table[cad], verb);
     return send_command(pDrvCtrl, cad, verb);
     }
 
-LOCAL void vxbHdAudioWidgetDelete (WIDGET* w)
-    {
-    free (w);
-    }
-
-LOCAL WIDGET* vxbHdAudioWidgetCreate (HDA_DRV_CTRL* pDrvCtrl, cad_t cad, nid_t nid)
+LOCAL void vxbHdAudioWidgetInit (HDA_DRV_CTRL* pDrvCtrl, cad_t cad, nid_t nid, WIDGET* w)
     {
-    WIDGET* w;
-
-    w = calloc(1, sizeof(WIDGET));
     memset(w, 0, sizeof(WIDGET));
 
     lstInit(&w->widgetList);
@@ -1888,6 +3447,17 @@ LOCAL WIDGET* vxbHdAudioWidgetCreate (HDA_DRV_CTRL* pDrvCtrl, cad_t cad, nid_t n
     w->bindas = -1;
     w->codec = pDrvCtrl->codec_table[cad];
     w->pDev = pDrvCtrl->pDev;
+    }
+
+LOCAL WIDGET* vxbHdAudioWidgetCreate (HDA_DRV_CTRL* pDrvCtrl, cad_t cad, nid_t nid)
+    {
+    WIDGET* w;
+
+    w = arena_alloc(&pDrvCtrl->codec_table[cad]->arena, sizeof(WIDGET));
+    if (w == NULL)
+        return NULL;
+
+    vxbHdAudioWidgetInit (pDrvCtrl, cad, nid, w);
 
 #if 0
     widget_parse (w);
@@ -1928,30 +3498,18 @@ LOCAL void vxbHdAudioWidgetTraverse(HDA_DRV_CTRL* pDrvCtrl, cad_t cad)
 
 LOCAL void vxbHdAudioWidgetDeleteAll(HDA_DRV_CTRL* pDrvCtrl, HDCODEC_ID codec)
     {
-    WIDGET *parent, *child, *root, *afg;
-
-    /* retrieve the root Widget */
+    WIDGET *root;
 
-    root = parent = vxbHdAudioGetRootWidget(pDrvCtrl, codec->cad);
-
-    afg = child = (WIDGET*)lstFirst(&parent->widgetList);
-    
-    while (child)
-        {
-        HDA_DBG(HDA_DBG_INFO, "Widget nid = %d child of %d\n", child->nid, parent->nid);
-
-        if (lstCount(&child->widgetList) > 0)
-            {
-            parent = child;
-            child = (WIDGET*)lstFirst((LIST*)&parent->widgetList);
-            }
-        else
-            child = (WIDGET*)lstNext((NODE*)child);
+    /*
+     * Function groups and their subnode arrays are carved from the codec
+     * arena; they go back to the heap with arena_release().  Only the tree
+     * is dropped here.
+     */
 
-        vxbHdAudioWidgetDelete (child);
-        }
+    root = vxbHdAudioGetRootWidget(pDrvCtrl, codec->cad);
 
-    vxbHdAudioWidgetDelete (afg);
+    lstInit (&root->widgetList);
+    codec->widgets = NULL;
     }
 
 
@@ -1975,7 +3533,7 @@ LOCAL WIDGET* vxbHdAudioWidgetNext (WIDGET *node)
     }
 
 
-LOCAL WIDGET* vxbHdAudioWidgetFind (HDCODEC_ID codec, cad_t cad, nid_t nid)
+LOCAL WIDGET* vxbHdAudioWidgetListFind (HDCODEC_ID codec, cad_t cad, nid_t nid)
     {
     WIDGET *parent, *child;
 
@@ -2005,6 +3563,19 @@ LOCAL WIDGET* vxbHdAudioWidgetFind (HDCODEC_ID codec, cad_t cad, nid_t nid)
     return child;
     }
 
+LOCAL WIDGET* vxbHdAudioWidgetFind (HDCODEC_ID codec, cad_t cad, nid_t nid)
+    {
+    codec->prof.lookups++;
+
+    /* audio function group widgets are indexed directly */
+
+    if (codec->widgets != NULL && cad == codec->cad &&
+        nid >= codec->startnode && nid <= codec->endnode)
+        return &codec->widgets[nid - codec->startnode];
+
+    return vxbHdAudioWidgetListFind (codec, cad, nid);
+    }
+
 void vxbHdAudioWidgetDiscovery (HDA_DRV_CTRL* pDrvCtrl, cad_t cad)
     {
     WIDGET *parent, *child;
@@ -2043,7 +3614,17 @@ void vxbHdAudioWidgetDiscovery (HDA_DRV_CTRL* pDrvCtrl, cad_t cad)
     
     while (subnode < limit)
         {
-        child = vxbHdAudioWidgetCreate(pDrvCtrl, cad, subnode);
+        if (parent->children != NULL)
+            {
+            child = &parent->children[subnode - codec->startnode];
+            vxbHdAudioWidgetInit(pDrvCtrl, cad, subnode, child);
+            }
+        else
+            {
+            child = vxbHdAudioWidgetCreate(pDrvCtrl, cad, subnode);
+            if (child == NULL)
+                break;
+            }
         lstAdd (&parent->widgetList, (NODE*)child);
 
         HDA_DBG(HDA_DBG_INFO, "Widget nid = %d\n", child->nid);
@@ -2075,6 +3656,12 @@ void vxbHdAudioWidgetDiscovery (HDA_DRV_CTRL* pDrvCtrl, cad_t cad)
             codec->inamp_cap =  0xffffffff;
             codec->supp_stream_formats = 0xffffffff;
             codec->supp_pcm_size_rate = 0xffffffff;
+
+            /* the group's widgets are kept in one array, indexed by nid */
+
+            parent->children = arena_alloc(&codec->arena,
+                                           size * sizeof(WIDGET));
+            codec->widgets = parent->children;
             }
         else
             {
@@ -2091,6 +3678,13 @@ LOCAL WIDGET* vxbHdAudioWidgetNum (HDCODEC_ID codec, int num)
     {
     WIDGET *node;
 
+    if (codec->widgets != NULL)
+        {
+        if (num < 0 || num >= codec->nodecnt)
+            return NULL;
+        return &codec->widgets[num];
+        }
+
     node = vxbHdAudioWidgetNext (vxbHdAudioGetRootWidget(device_get_softc(codec->pDev), codec->cad));
 
     return (WIDGET*)lstNth(&node->widgetList, num + 1);
@@ -2182,16 +3776,12 @@ LOCAL int channel_setformat(PCM_CHANNEL *chan, UINT32 format)
       this driver exploits unused bits in afmt
       to indicate the number of channels used in afmt
     */
-    /*icelee, workaround for 8bit sample  */
-    if (chan->afmt == AFMT_U8 )
-        format = AFMT_S16_LE;
-    else
-        format = chan->afmt;
-        
-    if  (chan->channels == 1 )
-        format |= (2 << 20);
-    else
-    	format |= (chan->channels << 20);
+    /*
+     * The OSS layer converts between the application format and the ring
+     * format; it passes the ring encoding in and the ring channel count in
+     * hwchannels.
+     */
+    format |= (chan->hwchannels << 20);
 #if 0
     for (i = 0; ch->caps.fmtlist[i] != 0; i++)
         {
@@ -2215,6 +3805,12 @@ LOCAL int channel_setformat(PCM_CHANNEL *chan, UINT32 format)
     return (val);
     }
 
+/*
+ * Program the supported rate closest to speed from above, or the highest
+ * one if speed is beyond them all, and return it.  The OSS layer resamples
+ * whenever the rate returned is not the one asked for.
+ */
+
 LOCAL UINT32 channel_setspeed(PCM_CHANNEL *chan, UINT32 speed)
     {
     int i;
@@ -2224,17 +3820,16 @@ LOCAL UINT32 channel_setspeed(PCM_CHANNEL *chan, UINT32 speed)
 
     semTake (pDrvCtrl->mutex, WAIT_FOREVER);
 
-    for (i = 0; ch->pcmrates[i] != 0; i++)
+    for (i = 0; i < NELEMENTS(hda_pcm_rates); i++)
         {
-        spd = ch->pcmrates[i];
-        if (speed != 0 && spd / speed * speed == spd)
-            {
-            ch->spd = spd;
+        if ((ch->pcmrates & (1 << i)) == 0)
+            continue;
+        spd = hda_pcm_rates[i];
+        if (spd >= speed)
             break;
-            }
         }
 
-    chan->rate = ch->spd = spd;
+    ch->spd = spd;
     
     semGive (pDrvCtrl->mutex);
 
@@ -2291,6 +3886,8 @@ LOCAL void audio_setup(CHAN *ch)
 
     int convmapid = -1;
     nid_t nid;
+    UINT32 verbs[NELEMENTS(ch->io) * 5];
+    int n = 0;
 
     totalchn = AFMT_CHANNEL(ch->fmt);
     totalextchn = AFMT_EXTCHANNEL(ch->fmt);
@@ -2311,7 +3908,7 @@ LOCAL void audio_setup(CHAN *ch)
     dfmt = HDA_CMD_SET_DIGITAL_CONV_FMT1_DIGEN;
 
     chn = 0;
-    for (i = 0; ch->io[i] != -1; i++) {
+    for (i = 0; ch->io[i] != 0; i++) {
     w = widget_get(ch->codec, ch->io[i]);
     if (w == NULL)
         continue;
@@ -2331,22 +3928,20 @@ LOCAL void audio_setup(CHAN *ch)
     c = (ch->sid << 4) | chn;
     }
     }
-    hda_command(ch->codec, HDA_CMD_SET_CONV_FMT(0, ch->io[i], fmt));
+    verbs[n++] = HDA_CMD_SET_CONV_FMT(0, ch->io[i], fmt);
     if (HDA_PARAM_AUDIO_WIDGET_CAP_DIGITAL(w->param.widget_cap))
         {
-        hda_command(ch->codec,
-                    HDA_CMD_SET_DIGITAL_CONV_FMT1(0, ch->io[i], dfmt));
+        verbs[n++] = HDA_CMD_SET_DIGITAL_CONV_FMT1(0, ch->io[i], dfmt);
         }
-    hda_command(ch->codec, HDA_CMD_SET_CONV_STREAM_CHAN(0, ch->io[i], c));
+    verbs[n++] = HDA_CMD_SET_CONV_STREAM_CHAN(0, ch->io[i], c);
     if (HDA_PARAM_AUDIO_WIDGET_CAP_STRIPE(w->param.widget_cap))
         {
-        hda_command(ch->codec, HDA_CMD_SET_STRIPE_CONTROL(0, w->nid, ch->stripectl));
+        verbs[n++] = HDA_CMD_SET_STRIPE_CONTROL(0, w->nid, ch->stripectl);
         }
     cchn = HDA_PARAM_AUDIO_WIDGET_CAP_CC(w->param.widget_cap);
     if (cchn > 1 && chn < totalchn) {
     cchn = min(cchn, totalchn - chn - 1);
-    hda_command(ch->codec,
-                HDA_CMD_SET_CONV_CHAN_COUNT(0, ch->io[i], cchn));
+    verbs[n++] = HDA_CMD_SET_CONV_CHAN_COUNT(0, ch->io[i], cchn);
     }
     HDA_DBG(HDA_DBG_INFO,
             "PCMDIR_%s: Stream setup nid=%d: "
@@ -2372,6 +3967,10 @@ LOCAL void audio_setup(CHAN *ch)
     }
     chn += cchn + 1;
     }
+
+    /* program all converters of the channel in one go */
+
+    hda_command_batch(ch->codec, verbs, NULL, n);
     }
 
 /*
@@ -2459,7 +4058,7 @@ LOCAL void channel_stop(PCM_CHANNEL *chan)
     stream_stop(pDrvCtrl->pDev, pDrvCtrl->pDev,
                      ch->dir == CTL_OUT ? 1 : 0, ch->sid);
 
-    for (i = 0; ch->io[i] != -1; i++) {
+    for (i = 0; ch->io[i] != 0; i++) {
     w = widget_get(ch->codec, ch->io[i]);
     if (w == NULL)
         continue;
@@ -2504,6 +4103,8 @@ LOCAL int channel_start(PCM_CHANNEL* chan)
                       ch->dir == CTL_OUT ? 1 : 0, ch->sid,
                       sndbuf_getbufaddr(ch->b), ch->blksz, ch->blkcnt);
 
+    ch->fifosize = pDrvCtrl->streams[find_stream(pDrvCtrl,
+                            ch->dir == CTL_OUT ? 1 : 0, ch->sid)].fifosize;
     ch->flags |= CHN_RUNNING;
     return (0);
     }
@@ -2538,17 +4139,26 @@ LOCAL int channel_trigger(PCM_CHANNEL* chan, int go)
     return (error);
     }
 
+/*
+ * channel_getptr and channel_getfifo are polled for A/V sync and do not take
+ * the driver mutex: the DMA position buffer and LPIB are plain reads, and
+ * the ring geometry and FIFO size only change while the channel is stopped.
+ */
+
 LOCAL UINT32 channel_getptr(PCM_CHANNEL *chan)
     {
     CHAN *ch = chan->stream;
     HDA_DRV_CTRL *pDrvCtrl = device_get_softc(ch->codec->pDev);
-    UINT32 ptr;
+    UINT32 *dmapos = ch->dmapos;
+    UINT32 ptr, size;
 
-    semTake (pDrvCtrl->mutex, WAIT_FOREVER);
+    size = ch->blksz * ch->blkcnt;
+    if (((ch->flags & CHN_RUNNING) == 0) || (size == 0))
+        return (0);
 
-    if (ch->dmapos != NULL)
+    if (dmapos != NULL)
         {
-        ptr = *(ch->dmapos);
+        ptr = *(volatile UINT32 *)dmapos;
         }
     else
         {
@@ -2556,15 +4166,17 @@ LOCAL UINT32 channel_getptr(PCM_CHANNEL *chan)
                                   ch->dir == CTL_OUT ? 1 : 0, ch->sid);
         }
 
-    /*
-     * Round to available space and force 128 bytes aligment.
-     */
-    ptr %= ch->blksz * ch->blkcnt;
-    ptr &= HDA_BLK_ALIGN;
+    return (ptr % size);
+    }
 
-    semGive (pDrvCtrl->mutex);
+LOCAL UINT32 channel_getfifo(PCM_CHANNEL *chan)
+    {
+    CHAN *ch = chan->stream;
 
-    return (ptr);
+    if ((ch->flags & CHN_RUNNING) == 0)
+        return (0);
+
+    return (ch->fifosize);
     }
 
 LOCAL PCMCHAN_CAPS * channel_getcaps(PCM_CHANNEL* chan)
@@ -2609,7 +4221,7 @@ LOCAL UINT32 audio_ctl_ossmixer_setrecsrc(SND_MIXER *m, UINT32 src)
     for (j = 0; j < as->num_chans; j++)
         {
         ch = &codec->hdaa_chan_table[as->chans[j]];
-        for (i = 0; ch->io[i] >= 0; i++)
+        for (i = 0; ch->io[i] != 0; i++)
             {
             w = widget_get(codec, ch->io[i]);
             if (w == NULL || w->enable == 0)
@@ -2639,14 +4251,10 @@ LOCAL UINT32 audio_ctl_ossmixer_setrecsrc(SND_MIXER *m, UINT32 src)
               (pdevinfo->index == 0 &&
                ctl->widget->bindas == -2)))
             continue;
-        for (j = 0; j < SOUND_MIXER_NRDEVICES; j++)
+        for (j = 0; j < HDA_CTL_DEVS_MAX; j++)
             {
-            if (pdevinfo->recsrc & (1 << j))
-                {
-                ctl->devleft[j] = 0;
-                ctl->devright[j] = 0;
-                ctl->devmute[j] = 0;
-                }
+            if (pdevinfo->recsrc & (1 << ctl->dev[j].dev))
+                memset (&ctl->dev[j], 0, sizeof(HDA_CTL_DEV));
             }
         }
 
@@ -2725,7 +4333,7 @@ LOCAL int audio_ctl_ossmixer_init(SND_MIXER *m)
                 continue;
             for (j = 0; j < w->nconns; j++)
                 {
-                if (w->connsenable[j] == 0)
+                if (!HDA_CONN_ENABLED(w, j))
                     continue;
                 cw = widget_get(codec, w->conns[j]);
                 if (cw == NULL || cw->enable == 0)
@@ -2860,10 +4468,16 @@ LOCAL STATUS vxbHdCodecUnlink
 
     vxbHdAudioWidgetDeleteAll(pDrvCtrl, codec);
 
-    free (codec->assoc_table);
-    free (codec->ctl);
-    free (codec->pcm_dev_table);
-    free (codec->hdaa_chan_table);
+    for (i = 0; i < codec->num_devs; i++)
+        mix_plan_free(&codec->pcm_dev_table[i]);
+
+    prune_free (codec);
+    arena_release (&codec->arena);
+    if (codec->cmd_sem != NULL)
+        semDelete (codec->cmd_sem);
+    if (codec->cmd_mutex != NULL)
+        semDelete (codec->cmd_mutex);
+    free (codec->param_cache);
     free (codec);
     return OK;
     }
@@ -2878,59 +4492,239 @@ LOCAL STATUS vxbHdCodecUnlink
 * ERRNO: N/A
 */
 
-LOCAL STATUS vxbHdAudioUnlink
+LOCAL STATUS vxbHdAudioUnlink
+    (
+    VXB_DEVICE_ID pDev,
+    void * unused
+    )
+    { 
+    int i;
+    HDA_DRV_CTRL * pDrvCtrl;
+    VXB_HDA_MSG msg;
+    
+    pDrvCtrl = (HDA_DRV_CTRL*)pDev->pDrvCtrl;
+
+
+    semTake(pDrvCtrl->mutex, NO_WAIT);
+    
+    msg.pDev = pDev;
+    msg.type = VXB_HDA_MSG_TYPE_UNLINK;
+    msgQSend(pDrvCtrl->unsolq_msgQ, (char*)&msg,
+             VXB_HDA_MSG_SIZE, NO_WAIT, MSG_PRI_NORMAL);
+
+    for (i = 0; i < pDrvCtrl->num_codec; i++)
+        vxbHdCodecUnlink(pDrvCtrl->codec_table[i], 0);
+
+    for (i = 0; i < pDrvCtrl->num_ss; i++)
+        dma_free (pDrvCtrl, &pDrvCtrl->streams[i].bdl);
+    free (pDrvCtrl->streams);
+
+
+    dma_free (pDrvCtrl, &pDrvCtrl->rirb_dma);
+    dma_free (pDrvCtrl, &pDrvCtrl->corb_dma);
+    dma_free (pDrvCtrl, &pDrvCtrl->pos_dma);
+
+    vxbDmaBufTagDestroy (pDrvCtrl->sndbuf_dma_tag);
+
+    vxbIntDisconnect (pDev, 0, vxbHdAudioIsr, pDev);
+    vxbIntDisable (pDev, 0, vxbHdAudioIsr, pDev);
+
+    semDelete (pDrvCtrl->mutex);
+    semDelete (pDrvCtrl->cmd_lock);
+    semDelete (pDrvCtrl->unsolq_lock);
+
+    free (pDrvCtrl);
+
+    return OK;
+    }
+
+LOCAL WIDGET* widget_get (HDCODEC* codec, nid_t nid)
+    {
+    return vxbHdAudioWidgetFind (codec, codec->cad, nid);
+    }
+
+/****************************************************************************
+ * BOOL param_cacheable(UINT32 verb)
+ *
+ * GET_PARAMETER and GET_CONN_LIST_ENTRY return values that are fixed by the
+ * codec silicon, so their responses may be kept for the life of the codec.
+ ****************************************************************************/
+
+LOCAL BOOL param_cacheable
+    (
+    UINT32 verb
+    )
+    {
+    UINT32 id = (verb & HDA_CMD_VERB_MASK) >> HDA_CMD_VERB_12BIT_SHIFT;
+
+    return (id == HDA_CMD_VERB_GET_PARAMETER ||
+            id == HDA_CMD_VERB_GET_CONN_LIST_ENTRY);
+    }
+
+LOCAL HDA_PARAM_CACHE * param_cache_slot
+    (
+    HDCODEC * codec,
+    UINT32 key,
+    BOOL insert
+    )
+    {
+    UINT32 h;
+    int i;
+
+    if (codec->param_cache == NULL)
+        return (NULL);
+
+    h = (key * 0x9e3779b1) >> 16;
+    for (i = 0; i < HDA_PARAM_CACHE_PROBE; i++)
+        {
+        HDA_PARAM_CACHE *ent;
+
+        ent = &codec->param_cache[(h + i) & (HDA_PARAM_CACHE_SIZE - 1)];
+        if (ent->key == key)
+            return (ent);
+        if (ent->key == 0)
+            return (insert ? ent : NULL);
+        }
+
+    return (NULL);
+    }
+
+LOCAL BOOL param_cache_get
+    (
+    HDCODEC * codec,
+    UINT32 verb,
+    UINT32 * val
+    )
+    {
+    HDA_PARAM_CACHE *ent;
+    UINT32 key = (verb & ~HDA_CMD_CAD_MASK) | HDA_PARAM_CACHE_VALID;
+
+    ent = param_cache_slot(codec, key, FALSE);
+    if (ent == NULL)
+        {
+        codec->param_misses++;
+        return (FALSE);
+        }
+
+    codec->param_hits++;
+    VX_MEM_BARRIER_R ();
+    *val = ent->val;
+    return (TRUE);
+    }
+
+LOCAL void param_cache_put
     (
-    VXB_DEVICE_ID pDev,
-    void * unused
+    HDCODEC * codec,
+    UINT32 verb,
+    UINT32 val
     )
-    { 
-    int i;
-    HDA_DRV_CTRL * pDrvCtrl;
-    VXB_HDA_MSG msg;
-    
-    pDrvCtrl = (HDA_DRV_CTRL*)pDev->pDrvCtrl;
+    {
+    HDA_PARAM_CACHE *ent;
+    UINT32 key = (verb & ~HDA_CMD_CAD_MASK) | HDA_PARAM_CACHE_VALID;
 
+    /* a timed out verb must be asked again next time */
 
-    semTake(pDrvCtrl->mutex, NO_WAIT);
-    
-    msg.pDev = pDev;
-    msg.type = VXB_HDA_MSG_TYPE_UNLINK;
-    msgQSend(pDrvCtrl->unsolq_msgQ, (char*)&msg,
-             VXB_HDA_MSG_SIZE, NO_WAIT, MSG_PRI_NORMAL);
+    if (val == HDA_INVALID)
+        return;
 
-    for (i = 0; i < pDrvCtrl->num_codec; i++)
-        vxbHdCodecUnlink(pDrvCtrl->codec_table[i], 0);
+    /*
+     * Lookups run without a lock, so an entry is published by storing its
+     * value before its key; cmd_mutex keeps two inserters off one slot.
+     */
 
-    for (i = 0; i < pDrvCtrl->num_ss; i++)
-        dma_free (pDrvCtrl, &pDrvCtrl->streams[i].bdl);
-    free (pDrvCtrl->streams);
+    if (codec->cmd_mutex != NULL)
+        semTake (codec->cmd_mutex, WAIT_FOREVER);
 
+    ent = param_cache_slot(codec, key, TRUE);
+    if (ent != NULL && ent->key != key)
+        {
+        ent->val = val;
+        VX_MEM_BARRIER_W ();
+        ent->key = key;
+        }
 
-    dma_free (pDrvCtrl, &pDrvCtrl->rirb_dma);
-    dma_free (pDrvCtrl, &pDrvCtrl->corb_dma);
-    dma_free (pDrvCtrl, &pDrvCtrl->pos_dma);
+    if (codec->cmd_mutex != NULL)
+        semGive (codec->cmd_mutex);
+    }
 
-    vxbDmaBufTagDestroy (pDrvCtrl->sndbuf_dma_tag);
+/****************************************************************************
+ * UINT32 cached_command
+ *
+ * Send a verb to a codec, answering the read-only parameter queries from
+ * the codec's parameter cache so they never reach the command ring twice.
+ ****************************************************************************/
 
-    vxbIntDisconnect (pDev, 0, vxbHdAudioIsr, pDev);
-    vxbIntDisable (pDev, 0, vxbHdAudioIsr, pDev);
+LOCAL UINT32 cached_command
+    (
+    HDA_DRV_CTRL *pDrvCtrl,
+    HDCODEC * codec,
+    UINT32 verb
+    )
+    {
+    UINT32 res;
 
-    semDelete (pDrvCtrl->mutex);
+    if (!param_cacheable(verb))
+        return send_command(pDrvCtrl, codec->cad, verb);
 
-    free (pDrvCtrl);
+    if (param_cache_get(codec, verb, &res))
+        return (res);
 
-    return OK;
+    res = send_command(pDrvCtrl, codec->cad, verb);
+    param_cache_put(codec, verb, res);
+    return (res);
     }
 
-LOCAL WIDGET* widget_get (HDCODEC* codec, nid_t nid)
+LOCAL UINT32 hda_command (HDCODEC* codec, UINT32 verb)
     {
-    return vxbHdAudioWidgetFind (codec, codec->cad, nid);
+    HDA_DRV_CTRL *pDrvCtrl = device_get_softc(codec->pDev);
+    return cached_command(pDrvCtrl, codec, verb);
     }
 
-LOCAL UINT32 hda_command (HDCODEC* codec, UINT32 verb)
+LOCAL int hda_command_batch (HDCODEC* codec, UINT32 *verbs, UINT32 *responses, int n)
     {
     HDA_DRV_CTRL *pDrvCtrl = device_get_softc(codec->pDev);
-    return send_command(pDrvCtrl, codec->cad, verb);
+    UINT32 missverbs[HDA_CONN_LIST_VERBS_MAX];
+    UINT32 missres[HDA_CONN_LIST_VERBS_MAX];
+    int missidx[HDA_CONN_LIST_VERBS_MAX];
+    int i, j, nmiss, sent, done;
+
+    if (responses == NULL)
+        return send_command_batch(pDrvCtrl, codec->cad, verbs, NULL, n);
+
+    /* answer cached queries locally, send the rest as one batch */
+
+    done = 0;
+    i = 0;
+    while (i < n)
+        {
+        for (nmiss = 0; i < n && nmiss < HDA_CONN_LIST_VERBS_MAX; i++)
+            {
+            if (param_cacheable(verbs[i]) &&
+                param_cache_get(codec, verbs[i], &responses[i]))
+                {
+                done++;
+                continue;
+                }
+            missidx[nmiss] = i;
+            missverbs[nmiss++] = verbs[i];
+            }
+
+        if (nmiss == 0)
+            break;
+
+        sent = send_command_batch(pDrvCtrl, codec->cad, missverbs, missres,
+                                  nmiss);
+        done += sent;
+
+        for (j = 0; j < nmiss; j++)
+            {
+            responses[missidx[j]] = missres[j];
+            if (param_cacheable(missverbs[j]))
+                param_cache_put(codec, missverbs[j], missres[j]);
+            }
+        }
+
+    return (done);
     }
 
 LOCAL int hdacc_unsol_alloc(VXB_DEVICE_ID pDev, HDCODEC_ID  codec, int wanted)
@@ -2992,34 +4786,72 @@ LOCAL void hdacc_unsol_intr(HDCODEC_ID codec, UINT32 resp)
     }
 
 
+/****************************************************************************
+ * void audio_ctl_amp_set_internal
+ *
+ * Write one direction of a control's amplifier.  The last value committed
+ * for each side is kept in the control, so writes that change nothing are
+ * dropped and only the side that changed is sent; equal left and right
+ * values always go out as a single verb.
+ ****************************************************************************/
+
 LOCAL void audio_ctl_amp_set_internal
     (
-    HDCODEC_ID codec,
-    nid_t nid,
-    int index, int lmute, int rmute,
+    AUDIO_CTL *ctl,
+    int lmute, int rmute,
     int left, int right, int dir
     )
     {
+    HDCODEC_ID codec = ctl->widget->codec;
+    nid_t nid = ctl->widget->nid;
+    int index = ctl->index;
+    UINT8 *shadow = ctl->amp_shadow[dir];
+    UINT8 lval, rval;
+    BOOL lchg, rchg;
     UINT16 v = 0;
 
+    lval = (UINT8)((lmute << 7) | left);
+    rval = (UINT8)((rmute << 7) | right);
+
+    if (ctl->amp_valid & (1 << dir))
+        {
+        lchg = (shadow[0] != lval);
+        rchg = (shadow[1] != rval);
+        }
+    else
+        {
+        lchg = TRUE;
+        rchg = TRUE;
+        }
+
+    if (!lchg && !rchg)
+        return;
+
     HDA_DBG(HDA_DBG_INFO, "Setting amplifier nid=%d index=%d %s mute=%d/%d vol=%d/%d\n",
             nid,index,dir ? "in" : "out",lmute,rmute,left,right);
 
-    if (left != right || lmute != rmute)
+    if (lval == rval && lchg && rchg)
         {
-        v = (1 << (15 - dir)) | (1 << 13) | (index << 8) |
-            (lmute << 7) | left;
+        v = (1 << (15 - dir)) | (3 << 12) | (index << 8) | lval;
         hda_command(codec, HDA_CMD_SET_AMP_GAIN_MUTE(0, nid, v));
-        v = (1 << (15 - dir)) | (1 << 12) | (index << 8) |
-            (rmute << 7) | right;
         }
     else
         {
-        v = (1 << (15 - dir)) | (3 << 12) | (index << 8) |
-            (lmute << 7) | left;
+        if (lchg)
+            {
+            v = (1 << (15 - dir)) | (1 << 13) | (index << 8) | lval;
+            hda_command(codec, HDA_CMD_SET_AMP_GAIN_MUTE(0, nid, v));
+            }
+        if (rchg)
+            {
+            v = (1 << (15 - dir)) | (1 << 12) | (index << 8) | rval;
+            hda_command(codec, HDA_CMD_SET_AMP_GAIN_MUTE(0, nid, v));
+            }
         }
 
-    hda_command(codec, HDA_CMD_SET_AMP_GAIN_MUTE(0, nid, v));
+    shadow[0] = lval;
+    shadow[1] = rval;
+    ctl->amp_valid |= (1 << dir);
     }
 
 LOCAL void audio_ctl_amp_set
@@ -3030,11 +4862,8 @@ LOCAL void audio_ctl_amp_set
     int right
     )
     {
-    nid_t nid;
     int lmute, rmute;
 
-    nid = ctl->widget->nid;
-
     /* Save new values if valid. */
     if (mute != HDAA_AMP_MUTE_DEFAULT)
         ctl->muted = mute;
@@ -3060,11 +4889,9 @@ LOCAL void audio_ctl_amp_set
         }
     /* Apply effective values */
     if (ctl->dir & CTL_OUT)
-        audio_ctl_amp_set_internal(ctl->widget->codec, nid, ctl->index,
-                                        lmute, rmute, left, right, 0);
+        audio_ctl_amp_set_internal(ctl, lmute, rmute, left, right, 0);
     if (ctl->dir & CTL_IN)
-        audio_ctl_amp_set_internal(ctl->widget->codec, nid, ctl->index,
-                                        lmute, rmute, left, right, 1);
+        audio_ctl_amp_set_internal(ctl, lmute, rmute, left, right, 1);
     }
 
 LOCAL void widget_connection_select(WIDGET *w, UINT8 index)
@@ -3076,17 +4903,23 @@ LOCAL void widget_connection_select(WIDGET *w, UINT8 index)
 
     hda_command(w->codec,
                 HDA_CMD_SET_CONNECTION_SELECT_CONTROL(0, w->nid, index));
+    if (w->selconn != index)
+        w->codec->mix_gen++;    /* mixer plans follow the selectors */
     w->selconn = index;
     }
 
 LOCAL void widget_connection_parse(WIDGET *w)
     {
     UINT32 res;
-    int i, j, max, ents, entnum;
+    UINT32 verbs[HDA_CONN_LIST_VERBS_MAX], entries[HDA_CONN_LIST_VERBS_MAX];
+    nid8_t conns[HDA_MAX_CONNS];
+    int i, j, k, max, ents, entnum, nverbs;
     nid_t nid = w->nid;
     nid_t cnid, addcnid, prevcnid;
 
     w->nconns = 0;
+    w->connsenable = 0;
+    w->conns = NULL;
 
     res = hda_command(w->codec,
                       HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_CONN_LIST_LENGTH));
@@ -3097,7 +4930,7 @@ LOCAL void widget_connection_parse(WIDGET *w)
         return;
 
     entnum = HDA_PARAM_CONN_LIST_LENGTH_LONG_FORM(res) ? 2 : 4;
-    max = (sizeof(w->conns) / sizeof(w->conns[0])) - 1;
+    max = NELEMENTS(conns) - 1;
     prevcnid = 0;
 
 #define CONN_RMASK(e)       (1 << ((32 / (e)) - 1))
@@ -3106,9 +4939,16 @@ LOCAL void widget_connection_parse(WIDGET *w)
 #define CONN_RANGE(r, e, n) (CONN_RESVAL(r, e, n) & CONN_RMASK(e))
 #define CONN_CNID(r, e, n)  (CONN_RESVAL(r, e, n) & CONN_NMASK(e))
 
-    for (i = 0; i < ents; i += entnum) {
-    res = hda_command(w->codec,
-                      HDA_CMD_GET_CONN_LIST_ENTRY(0, nid, i));
+    /* fetch the whole connection list in one batch */
+
+    nverbs = 0;
+    for (i = 0; i < ents && nverbs < HDA_CONN_LIST_VERBS_MAX; i += entnum)
+        verbs[nverbs++] = HDA_CMD_GET_CONN_LIST_ENTRY(0, nid, i);
+
+    hda_command_batch(w->codec, verbs, entries, nverbs);
+
+    for (i = 0, k = 0; k < nverbs; i += entnum, k++) {
+    res = entries[k];
     for (j = 0; j < entnum; j++) {
     cnid = CONN_CNID(res, entnum, j);
     if (cnid == 0) {
@@ -3154,15 +4994,33 @@ LOCAL void widget_connection_parse(WIDGET *w)
             addcnid, nid, max + 1);
     goto getconns_out;
     }
-    w->connsenable[w->nconns] = 1;
-    w->conns[w->nconns++] = addcnid++;
+    if (addcnid > 0xff) {
+    /* keep the selector index, but the entry can never be used */
+    HDA_DBG(HDA_DBG_INFO, 
+            "WARNING: nid=%d ignores wide cnid %d\n", nid, addcnid);
+    conns[w->nconns++] = 0;
+    addcnid++;
+    continue;
+    }
+    HDA_CONN_ENABLE(w, w->nconns);
+    conns[w->nconns++] = addcnid++;
     }
     prevcnid = cnid;
     }
     }
 
     getconns_out:
-    return;
+    if (w->nconns == 0)
+        return;
+    w->conns = arena_carve(&w->codec->arena, w->nconns, sizeof(nid8_t));
+    if (w->conns == NULL)
+        {
+        HDA_DBG(HDA_DBG_ERR, "nid=%d: no memory for connections\n", nid);
+        w->nconns = 0;
+        w->connsenable = 0;
+        return;
+        }
+    memcpy (w->conns, conns, w->nconns);
     }
 
 
@@ -3172,6 +5030,8 @@ LOCAL void widget_parse
     )
     {
     UINT32 wcap, cap;
+    UINT32 verbs[8], res[8];
+    int n, oamp, iamp, sfmt, spcm, stripe, pcfg, pcap, pctl;
     nid_t nid = w->nid;
     
     wcap = hda_command(w->codec, HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_AUDIO_WIDGET_CAP));
@@ -3181,10 +5041,62 @@ LOCAL void widget_parse
     
     widget_connection_parse(w);
 
+    /*
+     * Everything else only depends on the widget capabilities, so queue
+     * the remaining reads as one batch and pick the results out by slot.
+     */
+
+    n = 0;
+    oamp = iamp = sfmt = spcm = stripe = pcfg = pcap = pctl = -1;
+
+    if (HDA_PARAM_AUDIO_WIDGET_CAP_OUT_AMP(wcap) &&
+        HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
+        {
+        oamp = n;
+        verbs[n++] = HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_OUTPUT_AMP_CAP);
+        }
+
+    if (HDA_PARAM_AUDIO_WIDGET_CAP_IN_AMP(wcap) &&
+        HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
+        {
+        iamp = n;
+        verbs[n++] = HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_INPUT_AMP_CAP);
+        }
+
+    if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_OUTPUT ||
+        w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_INPUT)
+        {
+        if (HDA_PARAM_AUDIO_WIDGET_CAP_FORMAT_OVR(wcap))
+            {
+            sfmt = n;
+            verbs[n++] = HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_SUPP_STREAM_FORMATS);
+            spcm = n;
+            verbs[n++] = HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_SUPP_PCM_SIZE_RATE);
+            }
+        if (HDA_PARAM_AUDIO_WIDGET_CAP_STRIPE(wcap))
+            {
+            stripe = n;
+            verbs[n++] = HDA_CMD_GET_STRIPE_CONTROL(0, nid);
+            }
+        }
+
+    if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX)
+        {
+        pcfg = n;
+        verbs[n++] = HDA_CMD_GET_CONFIGURATION_DEFAULT(0, nid);
+        pcap = n;
+        verbs[n++] = HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_PIN_CAP);
+        pctl = n;
+        verbs[n++] = HDA_CMD_GET_PIN_WIDGET_CTRL(0, nid);
+        }
+
+    if (n > 0)
+        hda_command_batch(w->codec, verbs, res, n);
+
     if (HDA_PARAM_AUDIO_WIDGET_CAP_OUT_AMP(wcap))
         {
-        if (HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
-            w->param.outamp_cap =  hda_command(w->codec, HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_OUTPUT_AMP_CAP));
+        if (oamp >= 0)
+            w->param.outamp_cap = res[oamp];
         else
             w->param.outamp_cap = w->codec->outamp_cap;
         }
@@ -3193,8 +5105,8 @@ LOCAL void widget_parse
 
     if (HDA_PARAM_AUDIO_WIDGET_CAP_IN_AMP(wcap))
         {
-        if (HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
-            w->param.inamp_cap = hda_command(w->codec, HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_INPUT_AMP_CAP));
+        if (iamp >= 0)
+            w->param.inamp_cap = res[iamp];
         else
             w->param.inamp_cap = w->codec->inamp_cap;
         }
@@ -3204,11 +5116,11 @@ LOCAL void widget_parse
     if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_OUTPUT ||
         w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_INPUT)
         {
-        if (HDA_PARAM_AUDIO_WIDGET_CAP_FORMAT_OVR(wcap))
+        if (sfmt >= 0)
             {
-            cap = hda_command(w->codec, HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_SUPP_STREAM_FORMATS));
+            cap = res[sfmt];
             w->param.supp_stream_formats = (cap != 0) ? cap : w->codec->supp_stream_formats;
-            cap = hda_command(w->codec, HDA_CMD_GET_PARAMETER(0, nid, HDA_PARAM_SUPP_PCM_SIZE_RATE));
+            cap = res[spcm];
             w->param.supp_pcm_size_rate = (cap != 0) ? cap :  w->codec->supp_pcm_size_rate;
             }
         else
@@ -3216,11 +5128,8 @@ LOCAL void widget_parse
             w->param.supp_stream_formats = w->codec->supp_stream_formats;
             w->param.supp_pcm_size_rate = w->codec->supp_pcm_size_rate;
             }
-        if (HDA_PARAM_AUDIO_WIDGET_CAP_STRIPE(w->param.widget_cap))
-            {
-            w->wclass.conv.stripecap = hda_command(w->codec,
-                                                   HDA_CMD_GET_STRIPE_CONTROL(0, w->nid)) >> 20;
-            }
+        if (stripe >= 0)
+            w->wclass.conv.stripecap = res[stripe] >> 20;
         else
             w->wclass.conv.stripecap = 1;
         }
@@ -3232,11 +5141,11 @@ LOCAL void widget_parse
 
     if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX)
         {
-        w->wclass.pin.config = hda_command(w->codec, HDA_CMD_GET_CONFIGURATION_DEFAULT(0, w->nid));
+        w->wclass.pin.config = res[pcfg];
         w->wclass.pin.original = w->wclass.pin.config;
         w->wclass.pin.newconf = w->wclass.pin.config;
-        w->wclass.pin.cap = hda_command(w->codec, HDA_CMD_GET_PARAMETER(0, w->nid, HDA_PARAM_PIN_CAP));;
-        w->wclass.pin.ctrl = hda_command(w->codec, HDA_CMD_GET_PIN_WIDGET_CTRL(0, nid));
+        w->wclass.pin.cap = res[pcap];
+        w->wclass.pin.ctrl = res[pctl];
 
         w->param.eapdbtl = HDA_INVALID;
         if (HDA_PARAM_PIN_CAP_EAPD_CAP(w->wclass.pin.cap))
@@ -3275,11 +5184,34 @@ LOCAL AUDIO_CTL* audio_ctl_amp_get
     )
     {
     AUDIO_CTL *ctl;
-    int i, found = 0;
+    int i, n, found = 0;
 
     if (codec == NULL || codec->ctl == NULL)
         return (NULL);
 
+    if (codec->ctl_start != NULL &&
+        nid >= codec->startnode && nid <= codec->endnode)
+        {
+        /* only the controls of <nid>, still in codec->ctl order */
+
+        n = nid - codec->startnode;
+        for (i = codec->ctl_start[n]; i < codec->ctl_start[n + 1]; i++)
+            {
+            ctl = codec->ctl_ref[i];
+            if (ctl->enable == 0)
+                continue;
+            if (dir && ctl->ndir != dir)
+                continue;
+            if (index >= 0 && ctl->ndir == CTL_IN &&
+                ctl->dir == ctl->ndir && ctl->index != index)
+                continue;
+            found++;
+            if (found == cnt || cnt <= 0)
+                return (ctl);
+            }
+        return (NULL);
+        }
+
     i = 0;
     while ((ctl = audio_ctl_each(codec, &i)) != NULL) {
     if (ctl->enable == 0)
@@ -3299,6 +5231,60 @@ LOCAL AUDIO_CTL* audio_ctl_amp_get
     return (NULL);
     }
 
+/*
+ * Index the controls by the widget they belong to, so that
+ * audio_ctl_amp_get() only looks at the controls of one widget.
+ */
+LOCAL void audio_ctl_index(HDCODEC_ID codec)
+    {
+    AUDIO_CTL *ctl;
+    int *fill;
+    int i, n;
+
+    codec->ctl_start = NULL;
+    codec->ctl_ref = NULL;
+
+    if (codec->ctl == NULL || codec->ctlcnt < 1)
+        return;
+
+    fill = calloc(codec->nodecnt, sizeof(int));
+    if (fill != NULL)
+        {
+        codec->ctl_start = arena_alloc(&codec->arena,
+                                       (codec->nodecnt + 1) * sizeof(int));
+        codec->ctl_ref = arena_alloc(&codec->arena,
+                                     codec->ctlcnt * sizeof(AUDIO_CTL *));
+        }
+    if (codec->ctl_start == NULL || codec->ctl_ref == NULL || fill == NULL)
+        {
+        HDA_DBG(HDA_DBG_ERR, "no memory for control index, scanning\n");
+        free (fill);
+        codec->ctl_start = NULL;
+        codec->ctl_ref = NULL;
+        return;
+        }
+
+    for (i = 0; i < codec->ctlcnt; i++)
+        {
+        ctl = &codec->ctl[i];
+        if (ctl->widget == NULL)
+            continue;
+        codec->ctl_start[ctl->widget->nid - codec->startnode + 1]++;
+        }
+    for (n = 0; n < codec->nodecnt; n++)
+        codec->ctl_start[n + 1] += codec->ctl_start[n];
+    for (i = 0; i < codec->ctlcnt; i++)
+        {
+        ctl = &codec->ctl[i];
+        if (ctl->widget == NULL)
+            continue;
+        n = ctl->widget->nid - codec->startnode;
+        codec->ctl_ref[codec->ctl_start[n] + fill[n]++] = ctl;
+        }
+
+    free (fill);
+    }
+
 LOCAL void audio_ctl_parse (HDCODEC_ID codec)
     {
     AUDIO_CTL *ctls;
@@ -3341,7 +5327,7 @@ LOCAL void audio_ctl_parse (HDCODEC_ID codec)
     if (max < 1)
         return;
 
-    ctls = (AUDIO_CTL *)calloc(max, sizeof(*ctls));
+    ctls = (AUDIO_CTL *)arena_alloc(&codec->arena, max * sizeof(*ctls));
 
     if (ctls == NULL)
         {
@@ -3462,167 +5448,411 @@ LOCAL void audio_ctl_parse (HDCODEC_ID codec)
             }
         }
 
-    codec->ctl = ctls;
+    codec->ctl = ctls;
+    audio_ctl_index(codec);
+    }
+
+LOCAL void audio_disable_nonaudio(HDCODEC_ID codec)
+    {
+    WIDGET *w;
+    int i;
+
+    /* Disable power and volume widgets. */
+    for (i = codec->startnode; i < codec->endnode; i++)
+        {
+        w = widget_get(codec, i);
+        if (w == NULL || w->enable == 0)
+            continue;
+        if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_POWER_WIDGET ||
+            w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_VOLUME_WIDGET)
+            {
+            w->enable = 0;
+            HDA_DBG(HDA_DBG_INFO, 
+                    " Disabling nid %d due to it's"
+                    " non-audio type.\n",
+                    w->nid);
+            }
+        }
+    }
+
+/****************************************************************************
+ * void widget_rconn_build(HDCODEC_ID codec)
+ *
+ * Index the consumers of every widget.  The connection lists only name
+ * the inputs of a widget; this inverts them once after they are parsed so
+ * the passes below can find who reads a widget without a full scan.
+ ****************************************************************************/
+
+LOCAL void widget_rconn_build(HDCODEC_ID codec)
+    {
+    WIDGET *w;
+    int *fill;
+    int i, j, n, total;
+
+    codec->rconn = NULL;
+    codec->rconn_start = arena_alloc(&codec->arena,
+                                     (codec->nodecnt + 1) * sizeof(int));
+    fill = calloc(codec->nodecnt, sizeof(int));
+    if (codec->rconn_start == NULL || fill == NULL)
+        goto rconn_fail;
+
+    for (i = codec->startnode; i <= codec->endnode; i++)
+        {
+        w = widget_get(codec, i);
+        if (w == NULL)
+            continue;
+        for (j = 0; j < w->nconns; j++)
+            {
+            n = w->conns[j];
+            if (n >= codec->startnode && n <= codec->endnode)
+                codec->rconn_start[n - codec->startnode + 1]++;
+            }
+        }
+
+    for (i = 0; i < codec->nodecnt; i++)
+        codec->rconn_start[i + 1] += codec->rconn_start[i];
+
+    total = codec->rconn_start[codec->nodecnt];
+    codec->rconn = arena_alloc(&codec->arena, total * sizeof(HDA_RCONN));
+    if (codec->rconn == NULL)
+        goto rconn_fail;
+
+    for (i = codec->startnode; i <= codec->endnode; i++)
+        {
+        w = widget_get(codec, i);
+        if (w == NULL)
+            continue;
+        for (j = 0; j < w->nconns; j++)
+            {
+            n = w->conns[j];
+            if (n < codec->startnode || n > codec->endnode)
+                continue;
+            n -= codec->startnode;
+            codec->rconn[codec->rconn_start[n] + fill[n]].nid = i;
+            codec->rconn[codec->rconn_start[n] + fill[n]].index = j;
+            fill[n]++;
+            }
+        }
+
+    free (fill);
+    return;
+
+    rconn_fail:
+    HDA_DBG(HDA_DBG_ERR, "codec %d: no memory for connection index\n",
+            codec->cad);
+    free (fill);
+    codec->rconn = NULL;
+    codec->rconn_start = NULL;
+    }
+
+/****************************************************************************
+ * Widget pruning worklist
+ *
+ * The disable passes remove widgets and connections that cannot be part
+ * of a useful path.  audio_disable_useless() used to rescan every widget,
+ * connection and control until nothing changed, and ran three times.  Now
+ * the first run queues every node and later changes only queue the nodes
+ * next to them, so each run costs the changes made since the last one.
+ ****************************************************************************/
+
+#define PRUNE_BIT(map, n)       ((map)[(n) >> 5] & (1U << ((n) & 31)))
+#define PRUNE_SET(map, n)       ((map)[(n) >> 5] |= (1U << ((n) & 31)))
+#define PRUNE_CLR(map, n)       ((map)[(n) >> 5] &= ~(1U << ((n) & 31)))
+
+LOCAL void prune_free(HDCODEC_ID codec)
+    {
+    HDA_PRUNE *pr = codec->prune;
+
+    if (pr == NULL)
+        return;
+
+    free (pr->stack);
+    free (pr->queued);
+    free (pr->gone);
+    free (pr->ctl_start);
+    free (pr->ctl_ref);
+    free (pr);
+    codec->prune = NULL;
+    }
+
+LOCAL HDA_PRUNE* prune_get(HDCODEC_ID codec)
+    {
+    HDA_PRUNE *pr;
+    AUDIO_CTL *ctl;
+    int *fill;
+    int i, n, words;
+
+    if (codec->prune != NULL)
+        return (codec->prune);
+
+    if (codec->rconn == NULL)
+        widget_rconn_build(codec);
+    if (codec->rconn == NULL)
+        return (NULL);
+
+    words = (codec->nodecnt + 31) / 32;
+
+    pr = calloc(1, sizeof(HDA_PRUNE));
+    if (pr == NULL)
+        return (NULL);
+    codec->prune = pr;
+
+    pr->stack = calloc(codec->nodecnt, sizeof(nid_t));
+    pr->queued = calloc(words, sizeof(UINT32));
+    pr->gone = calloc(words, sizeof(UINT32));
+    pr->ctl_start = calloc(codec->nodecnt + 1, sizeof(int));
+    pr->ctl_ref = calloc(2 * codec->ctlcnt + 1, sizeof(AUDIO_CTL *));
+    fill = calloc(codec->nodecnt, sizeof(int));
+    if (pr->stack == NULL || pr->queued == NULL || pr->gone == NULL ||
+        pr->ctl_start == NULL || pr->ctl_ref == NULL || fill == NULL)
+        {
+        free (fill);
+        prune_free(codec);
+        return (NULL);
+        }
+
+    /* index the controls by both of the widgets they sit between */
+
+    for (i = 0; i < codec->ctlcnt; i++)
+        {
+        ctl = &codec->ctl[i];
+        if (ctl->widget == NULL)
+            continue;
+        n = ctl->widget->nid - codec->startnode;
+        pr->ctl_start[n + 1]++;
+        if (ctl->childwidget != NULL)
+            {
+            n = ctl->childwidget->nid - codec->startnode;
+            pr->ctl_start[n + 1]++;
+            }
+        }
+
+    for (i = 0; i < codec->nodecnt; i++)
+        pr->ctl_start[i + 1] += pr->ctl_start[i];
+
+    for (i = 0; i < codec->ctlcnt; i++)
+        {
+        ctl = &codec->ctl[i];
+        if (ctl->widget == NULL)
+            continue;
+        n = ctl->widget->nid - codec->startnode;
+        pr->ctl_ref[pr->ctl_start[n] + fill[n]++] = ctl;
+        if (ctl->childwidget != NULL)
+            {
+            n = ctl->childwidget->nid - codec->startnode;
+            pr->ctl_ref[pr->ctl_start[n] + fill[n]++] = ctl;
+            }
+        }
+
+    free (fill);
+    return (pr);
     }
 
-LOCAL void audio_disable_nonaudio(HDCODEC_ID codec)
+/* queue <nid> for another look, once until it is taken off again */
+
+LOCAL void prune_push(HDCODEC_ID codec, nid_t nid)
     {
-    WIDGET *w;
+    HDA_PRUNE *pr = codec->prune;
+    int n = nid - codec->startnode;
+
+    if (pr == NULL || n < 0 || n >= codec->nodecnt ||
+        PRUNE_BIT(pr->queued, n))
+        return;
+
+    PRUNE_SET(pr->queued, n);
+    pr->stack[pr->depth++] = nid;
+    }
+
+/* drop connection <j> of <w>: w lost an input, its child a consumer */
+
+LOCAL void prune_conn_off(HDCODEC_ID codec, WIDGET *w, int j)
+    {
+    HDA_CONN_DISABLE(w, j);
+    prune_push(codec, w->nid);
+    prune_push(codec, w->conns[j]);
+    }
+
+/* a widget left the graph: update its controls, consumers and inputs */
+
+LOCAL void prune_gone(HDCODEC_ID codec, WIDGET *w)
+    {
+    HDA_PRUNE *pr = codec->prune;
+    AUDIO_CTL *ctl;
+    WIDGET *cw;
+    int n = w->nid - codec->startnode;
     int i;
 
-    /* Disable power and volume widgets. */
-    for (i = codec->startnode; i < codec->endnode; i++)
+    for (i = pr->ctl_start[n]; i < pr->ctl_start[n + 1]; i++)
         {
-        w = widget_get(codec, i);
-        if (w == NULL || w->enable == 0)
+        ctl = pr->ctl_ref[i];
+        if (ctl->enable == 0)
             continue;
-        if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_POWER_WIDGET ||
-            w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_VOLUME_WIDGET)
-            {
-            w->enable = 0;
-            HDA_DBG(HDA_DBG_INFO, 
-                    " Disabling nid %d due to it's"
-                    " non-audio type.\n",
-                    w->nid);
-            }
+        ctl->forcemute = 1;
+        ctl->muted = HDAA_AMP_MUTE_ALL;
+        ctl->left = 0;
+        ctl->right = 0;
+        ctl->enable = 0;
+        if (ctl->ndir == CTL_IN)
+            prune_conn_off(codec, ctl->widget, ctl->index);
+        HDA_DBG(HDA_DBG_INFO, 
+                " Disabling ctl nid %d cnid %d due"
+                " to disabled widget.\n",
+                ctl->widget->nid,
+                (ctl->childwidget != NULL)?
+                ctl->childwidget->nid:-1);
+        }
+
+    for (i = codec->rconn_start[n]; i < codec->rconn_start[n + 1]; i++)
+        {
+        cw = widget_get(codec, codec->rconn[i].nid);
+        if (cw == NULL || cw->enable == 0 || cw->nid >= codec->endnode ||
+            !HDA_CONN_ENABLED(cw, codec->rconn[i].index))
+            continue;
+        prune_conn_off(codec, cw, codec->rconn[i].index);
+        HDA_DBG(HDA_DBG_INFO, 
+                " Disabling nid %d connection %d due"
+                " to disabled child widget.\n",
+                cw->nid, codec->rconn[i].index);
+        }
+
+    for (i = 0; i < w->nconns; i++)
+        prune_push(codec, w->conns[i]);
+    }
+
+LOCAL BOOL prune_has_consumer(HDCODEC_ID codec, WIDGET *w)
+    {
+    WIDGET *cw;
+    int n = w->nid - codec->startnode;
+    int i;
+
+    for (i = codec->rconn_start[n]; i < codec->rconn_start[n + 1]; i++)
+        {
+        cw = widget_get(codec, codec->rconn[i].nid);
+        if (cw == NULL || cw->enable == 0 || cw->nid >= codec->endnode)
+            continue;
+        if (HDA_CONN_ENABLED(cw, codec->rconn[i].index))
+            return (TRUE);
         }
+
+    return (FALSE);
     }
 
 LOCAL void audio_disable_useless(HDCODEC_ID codec)
     {
+    HDA_PRUNE *pr;
     WIDGET *w, *cw;
-    AUDIO_CTL *ctl;
-    int done, found, i, j, k;
+    nid_t nid;
+    int i, j, n;
 
-    /* Disable useless pins. */
-    for (i = codec->startnode; i < codec->endnode; i++)
+    pr = prune_get(codec);
+    if (pr == NULL)
         {
-        w = widget_get(codec, i);
-        if (w == NULL || w->enable == 0)
-            continue;
-        if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX)
-            {
-            if ((w->wclass.pin.config &
-                 HDA_CONFIG_DEFAULTCONF_CONNECTIVITY_MASK) ==
-                HDA_CONFIG_DEFAULTCONF_CONNECTIVITY_NONE)
-                {
-                w->enable = 0;
-                HDA_DBG(HDA_DBG_INFO, 
-                        " Disabling pin nid %d due"
-                        " to None connectivity.\n",
-                        w->nid);
-                } else if ((w->wclass.pin.config &
-                            HDA_CONFIG_DEFAULTCONF_ASSOCIATION_MASK) == 0)
-                {
-                w->enable = 0;
-                HDA_DBG(HDA_DBG_INFO, 
-                        " Disabling unassociated"
-                        " pin nid %d.\n",
-                        w->nid);
-                }
-            }
+        HDA_DBG(HDA_DBG_ERR, "codec %d: no memory to prune widgets\n",
+                codec->cad);
+        return;
         }
-    do
+
+    if (!pr->seeded)
         {
-        done = 1;
-        /* Disable and mute controls for disabled widgets. */
-        i = 0;
-        while ((ctl = audio_ctl_each(codec, &i)) != NULL)
-            {
-            if (ctl->enable == 0)
-                continue;
-            if (ctl->widget->enable == 0 ||
-                (ctl->childwidget != NULL &&
-                 ctl->childwidget->enable == 0))
-                {
-                ctl->forcemute = 1;
-                ctl->muted = HDAA_AMP_MUTE_ALL;
-                ctl->left = 0;
-                ctl->right = 0;
-                ctl->enable = 0;
-                if (ctl->ndir == CTL_IN)
-                    ctl->widget->connsenable[ctl->index] = 0;
-                done = 0;
-                HDA_DBG(HDA_DBG_INFO, 
-                        " Disabling ctl %d nid %d cnid %d due"
-                        " to disabled widget.\n", i,
-                        ctl->widget->nid,
-                        (ctl->childwidget != NULL)?
-                        ctl->childwidget->nid:-1);
-                }
-            }
-        /* Disable useless widgets. */
+        /* Disable useless pins. */
         for (i = codec->startnode; i < codec->endnode; i++)
             {
             w = widget_get(codec, i);
             if (w == NULL || w->enable == 0)
                 continue;
-            /* Disable inputs with disabled child widgets. */
-            for (j = 0; j < w->nconns; j++)
+            if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX)
                 {
-                if (w->connsenable[j])
+                if ((w->wclass.pin.config &
+                     HDA_CONFIG_DEFAULTCONF_CONNECTIVITY_MASK) ==
+                    HDA_CONFIG_DEFAULTCONF_CONNECTIVITY_NONE)
                     {
-                    cw = widget_get(codec, w->conns[j]);
-                    if (cw == NULL || cw->enable == 0)
-                        {
-                        w->connsenable[j] = 0;
-                        HDA_DBG(HDA_DBG_INFO, 
-                                " Disabling nid %d connection %d due"
-                                " to disabled child widget.\n",
-                                i, j);
-                        }
-                    }
-                }
-            if (w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_SELECTOR &&
-                w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_MIXER)
-                continue;
-            /* Disable mixers and selectors without inputs. */
-            found = 0;
-            for (j = 0; j < w->nconns; j++)
-                {
-                if (w->connsenable[j])
+                    w->enable = 0;
+                    HDA_DBG(HDA_DBG_INFO, 
+                            " Disabling pin nid %d due"
+                            " to None connectivity.\n",
+                            w->nid);
+                    } else if ((w->wclass.pin.config &
+                                HDA_CONFIG_DEFAULTCONF_ASSOCIATION_MASK) == 0)
                     {
-                    found = 1;
-                    break;
+                    w->enable = 0;
+                    HDA_DBG(HDA_DBG_INFO, 
+                            " Disabling unassociated"
+                            " pin nid %d.\n",
+                            w->nid);
                     }
                 }
-            if (found == 0)
+            }
+
+        for (i = codec->startnode; i <= codec->endnode; i++)
+            prune_push(codec, i);
+
+        pr->seeded = TRUE;
+        }
+
+    while (pr->depth > 0)
+        {
+        nid = pr->stack[--pr->depth];
+        n = nid - codec->startnode;
+        PRUNE_CLR(pr->queued, n);
+
+        w = widget_get(codec, nid);
+        if (w == NULL)
+            continue;
+
+        if (w->enable == 0)
+            {
+            if (!PRUNE_BIT(pr->gone, n))
                 {
-                w->enable = 0;
-                done = 0;
-                HDA_DBG(HDA_DBG_INFO, 
-                        " Disabling nid %d due to all it's"
-                        " inputs disabled.\n", w->nid);
+                PRUNE_SET(pr->gone, n);
+                prune_gone(codec, w);
                 }
-            /* Disable nodes without consumers. */
-            if (w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_SELECTOR &&
-                w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_MIXER)
+            continue;
+            }
+
+        if (nid >= codec->endnode)
+            continue;
+
+        /* Disable inputs with disabled child widgets. */
+        for (j = 0; j < w->nconns; j++)
+            {
+            if (!HDA_CONN_ENABLED(w, j))
                 continue;
-            found = 0;
-            for (k = codec->startnode; k < codec->endnode; k++)
+            cw = widget_get(codec, w->conns[j]);
+            if (cw == NULL || cw->enable == 0)
                 {
-                cw = widget_get(codec, k);
-                if (cw == NULL || cw->enable == 0)
-                    continue;
-                for (j = 0; j < cw->nconns; j++)
-                    {
-                    if (cw->connsenable[j] && cw->conns[j] == i)
-                        {
-                        found = 1;
-                        break;
-                        }
-                    }
+                prune_conn_off(codec, w, j);
+                HDA_DBG(HDA_DBG_INFO, 
+                        " Disabling nid %d connection %d due"
+                        " to disabled child widget.\n",
+                        nid, j);
                 }
-            if (found == 0) {
+            }
+
+        if (w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_SELECTOR &&
+            w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_MIXER)
+            continue;
+
+        /* Disable mixers and selectors without inputs. */
+        if (w->connsenable == 0)
+            {
             w->enable = 0;
-            done = 0;
+            prune_push(codec, nid);
             HDA_DBG(HDA_DBG_INFO, 
                     " Disabling nid %d due to all it's"
-                    " consumers disabled.\n", w->nid);
-            }
+                    " inputs disabled.\n", w->nid);
+            continue;
             }
-        } while (done == 0);
 
+        /* Disable nodes without consumers. */
+        if (!prune_has_consumer(codec, w))
+            {
+            w->enable = 0;
+            prune_push(codec, nid);
+            HDA_DBG(HDA_DBG_INFO, 
+                    " Disabling nid %d due to all it's"
+                    " consumers disabled.\n", w->nid);
+            }
+        }
     }
 
 LOCAL void audio_disable_unas(HDCODEC_ID codec)
@@ -3639,6 +5869,7 @@ LOCAL void audio_disable_unas(HDCODEC_ID codec)
         continue;
     if (w->bindas == -1) {
     w->enable = 0;
+    prune_push(codec, i);
     HDA_DBG(HDA_DBG_INFO, 
             " Disabling unassociated nid %d.\n",
             w->nid);
@@ -3656,9 +5887,9 @@ LOCAL void audio_disable_unas(HDCODEC_ID codec)
         continue;
     if (as[w->bindas].dir == CTL_IN) {
     for (j = 0; j < w->nconns; j++) {
-    if (w->connsenable[j] == 0)
+    if (!HDA_CONN_ENABLED(w, j))
         continue;
-    w->connsenable[j] = 0;
+    prune_conn_off(codec, w, j);
     HDA_DBG(HDA_DBG_INFO, 
             " Disabling connection to input pin "
             "nid %d conn %d.\n",
@@ -3688,8 +5919,8 @@ LOCAL void audio_disable_unas(HDCODEC_ID codec)
     if (cw == NULL || cw->enable == 0)
         continue;
     for (j = 0; j < cw->nconns; j++) {
-    if (cw->connsenable[j] && cw->conns[j] == i) {
-    cw->connsenable[j] = 0;
+    if (HDA_CONN_ENABLED(cw, j) && cw->conns[j] == i) {
+    prune_conn_off(codec, cw, j);
     HDA_DBG(HDA_DBG_INFO, 
             " Disabling connection from output pin "
             "nid %d conn %d cnid %d.\n",
@@ -3731,11 +5962,11 @@ LOCAL void audio_disable_notselected(HDCODEC_ID codec)
     if (w->bindas < 0 || as[w->bindas].dir == CTL_IN)
         continue;
     for (j = 0; j < w->nconns; j++) {
-    if (w->connsenable[j] == 0)
+    if (!HDA_CONN_ENABLED(w, j))
         continue;
     if (w->selconn < 0 || w->selconn == j)
         continue;
-    w->connsenable[j] = 0;
+    prune_conn_off(codec, w, j);
     HDA_DBG(HDA_DBG_INFO, 
             " Disabling unselected connection "
             "nid %d conn %d.\n",
@@ -3765,7 +5996,7 @@ LOCAL void audio_disable_crossas(HDCODEC_ID codec)
     if (w->bindas == -2)
         continue;
     for (j = 0; j < w->nconns; j++) {
-    if (w->connsenable[j] == 0)
+    if (!HDA_CONN_ENABLED(w, j))
         continue;
     cw = widget_get(codec, w->conns[j]);
     if (cw == NULL || w->enable == 0)
@@ -3787,7 +6018,7 @@ LOCAL void audio_disable_crossas(HDCODEC_ID codec)
     if (w->bindas == cw->bindas &&
         (w->bindseqmask & cw->bindseqmask) != 0)
         continue;
-    w->connsenable[j] = 0;
+    prune_conn_off(codec, w, j);
     HDA_DBG(HDA_DBG_INFO, 
             " Disabling crossassociatement connection "
             "nid %d conn %d cnid %d.\n",
@@ -3827,7 +6058,7 @@ LOCAL void audio_disable_crossas(HDCODEC_ID codec)
     ctl->right = 0;
     ctl->enable = 0;
     if (ctl->ndir == CTL_IN)
-        ctl->widget->connsenable[ctl->index] = 0;
+        prune_conn_off(codec, ctl->widget, ctl->index);
     HDA_DBG(HDA_DBG_INFO, 
             " Disabling crossassociatement connection "
             "ctl %d nid %d cnid %d.\n", i,
@@ -3837,15 +6068,29 @@ LOCAL void audio_disable_crossas(HDCODEC_ID codec)
 
     }
 
+/*
+ * HDMI and DisplayPort pins each drive a display of their own, so they
+ * get an association of their own even when the BIOS groups them, and
+ * every display can play its own stream on its own converter.
+ */
+LOCAL int audio_pin_alone(WIDGET *w)
+    {
+    if (!HDA_PARAM_AUDIO_WIDGET_CAP_DIGITAL(w->param.widget_cap))
+        return (0);
+    return (HDA_PARAM_PIN_CAP_HDMI(w->wclass.pin.cap) ||
+            HDA_PARAM_PIN_CAP_DP(w->wclass.pin.cap));
+    }
+
 void audio_as_parse(HDCODEC_ID codec)
     {
     ASSOC *as;
     WIDGET *w;
-    int i, j, cnt, max, type, dir, assoc, seq, first, hpredir;
+    int i, j, k, cnt, max, type, dir, assoc, seq, first, hpredir, shared;
 
     /* Count present associations */
     max = 0;
     for (j = 1; j < 16; j++) {
+    shared = 0;
     for (i = codec->startnode; i < codec->endnode; i++) {
     w = widget_get(codec, i);
     if (w == NULL || w->enable == 0)
@@ -3855,10 +6100,13 @@ void audio_as_parse(HDCODEC_ID codec)
     if (HDA_CONFIG_DEFAULTCONF_ASSOCIATION(w->wclass.pin.config)
         != j)
         continue;
-    max++;
-    if (j != 15)  /* There could be many 1-pin assocs #15 */
-        break;
+    /* There could be many 1-pin assocs #15, and every display pin is one */
+    if (j == 15 || audio_pin_alone(w))
+        max++;
+    else
+        shared = 1;
     }
+    max += shared;
     }
 
 
@@ -3867,7 +6115,7 @@ void audio_as_parse(HDCODEC_ID codec)
     if (max < 1)
         return;
 
-    as = (ASSOC*)calloc(max, sizeof(ASSOC));
+    as = (ASSOC*)arena_alloc(&codec->arena, max * sizeof(ASSOC));
 
     if (as == NULL) {
     /* Blekh! */
@@ -3878,7 +6126,7 @@ void audio_as_parse(HDCODEC_ID codec)
     else
         {
         /* clear as contents */
-        memset(as, 0, sizeof(ASSOC));
+        memset(as, 0, max * sizeof(ASSOC));
         }
 
     for (i = 0; i < max; i++) {
@@ -3893,6 +6141,7 @@ void audio_as_parse(HDCODEC_ID codec)
     for (j = 1; j < 16; j++) {
     first = 16;
     hpredir = 0;
+    shared = -1;
     for (i = codec->startnode; i < codec->endnode; i++) {
     w = widget_get(codec, i);
     if (w == NULL || w->enable == 0)
@@ -3904,6 +6153,13 @@ void audio_as_parse(HDCODEC_ID codec)
     if (assoc != j) {
     continue;
     }
+    if (j == 15 || audio_pin_alone(w))
+        k = cnt++;
+    else {
+    if (shared < 0)
+        shared = cnt++;
+    k = shared;
+    }
 
     type = w->wclass.pin.config &
         HDA_CONFIG_DEFAULTCONF_DEVICE_MASK;
@@ -3917,56 +6173,50 @@ void audio_as_parse(HDCODEC_ID codec)
     else
         dir = CTL_IN;
     /* If this is a first pin - create new association. */
-    if (as[cnt].pincnt == 0) {
-    as[cnt].enable = 1;
-    as[cnt].index = j;
-    as[cnt].dir = dir;
+    if (as[k].pincnt == 0) {
+    as[k].enable = 1;
+    as[k].index = j;
+    as[k].dir = dir;
     }
-    if (seq < first)
+    if (k == shared && seq < first)
         first = seq;
     /* Check association correctness. */
-    if (as[cnt].pins[seq] != 0) {
+    if (as[k].pins[seq] != 0) {
     HDA_DBG(HDA_DBG_INFO, "%s: Duplicate pin %d (%d) "
             "in association %d! Disabling association.\n",
             __func__, seq, w->nid, j);
-    as[cnt].enable = 0;
+    as[k].enable = 0;
     }
-    if (dir != as[cnt].dir) {
+    if (dir != as[k].dir) {
     HDA_DBG(HDA_DBG_INFO, "%s: Pin %d has wrong "
             "direction for association %d! Disabling "
             "association.\n",
             __func__, w->nid, j);
-    as[cnt].enable = 0;
+    as[k].enable = 0;
     }
     if (HDA_PARAM_AUDIO_WIDGET_CAP_DIGITAL(w->param.widget_cap)) {
-    as[cnt].digital |= 0x1;
+    as[k].digital |= 0x1;
     if (HDA_PARAM_PIN_CAP_HDMI(w->wclass.pin.cap))
-        as[cnt].digital |= 0x2;
+        as[k].digital |= 0x2;
     if (HDA_PARAM_PIN_CAP_DP(w->wclass.pin.cap))
-        as[cnt].digital |= 0x4;
+        as[k].digital |= 0x4;
     }
-    if (as[cnt].location == -1) {
-    as[cnt].location =
+    if (as[k].location == -1) {
+    as[k].location =
         HDA_CONFIG_DEFAULTCONF_LOCATION(w->wclass.pin.config);
-    } else if (as[cnt].location !=
+    } else if (as[k].location !=
                HDA_CONFIG_DEFAULTCONF_LOCATION(w->wclass.pin.config)) {
-    as[cnt].location = -2;
+    as[k].location = -2;
     }
     /* Headphones with seq=15 may mean redirection. */
     if (type == HDA_CONFIG_DEFAULTCONF_DEVICE_HP_OUT &&
-        seq == 15)
+        seq == 15 && k == shared)
         hpredir = 1;
-    as[cnt].pins[seq] = w->nid;
-    as[cnt].pincnt++;
-    /* Association 15 is a multiple unassociated pins. */
-    if (j == 15)
-        cnt++;
-    }
-    if (j != 15 && as[cnt].pincnt > 0) {
-    if (hpredir && as[cnt].pincnt > 1)
-        as[cnt].hpredir = first;
-    cnt++;
+    as[k].pins[seq] = w->nid;
+    as[k].pincnt++;
     }
+    if (shared >= 0 && hpredir && as[shared].pincnt > 1)
+        as[shared].hpredir = first;
     }
     for (i = 0; i < max; i++) {
     if (as[i].dir == CTL_IN && (as[i].pincnt == 1 ||
@@ -4000,15 +6250,15 @@ LOCAL int pcmchannel_setup(CHAN *ch)
     ASSOC *as = codec->assoc_table;
     WIDGET *w;
     UINT32 cap, fmtcap, pcmcap;
+    UINT32 fmtlist[HDA_CHAN_FMTS_MAX];
     int i, j, ret, channels, onlystereo;
     UINT16 pinset;
 
     ch->caps = caps;
-    ch->caps.fmtlist = ch->fmtlist;
+    ch->caps.fmtlist = hda_fmt_none;
     ch->bit16 = 1;
     ch->bit32 = 0;
-    ch->pcmrates[0] = 48000;
-    ch->pcmrates[1] = 0;
+    ch->pcmrates = HDA_PCM_RATE_48K;
     ch->stripecap = 0xff;
 
     ret = 0;
@@ -4059,7 +6309,7 @@ LOCAL int pcmchannel_setup(CHAN *ch)
         onlystereo = 0;
     pinset |= (1 << i);
     }
-    ch->io[ret] = -1;
+    ch->io[ret] = 0;
     ch->channels = channels;
 
     if (as[ch->as].fakeredir)
@@ -4095,102 +6345,105 @@ LOCAL int pcmchannel_setup(CHAN *ch)
         ch->bit32 = 4;
 
     /* 8bit */
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_U8, 1, 0);
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_U8, 2, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_U8, 1, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_U8, 2, 0);
 
     /* mono */
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 1, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 1, 0);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 1, 0);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 1, 0);
 
     if (channels >= 2) {
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 2, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 2, 0);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 2, 0);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 2, 0);
     }
     if (channels >= 3 && !onlystereo) {
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 3, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 3, 0);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 3, 0);
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 3, 1);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 3, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 3, 1);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 3, 1);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 3, 1);
     }
     if (channels >= 4) {
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 4, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 4, 0);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 4, 0);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 4, 0);
     if (!onlystereo) {
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 4, 1);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 4, 1);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 4, 1);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 4, 1);
     }
     }
     if (channels >= 5 && !onlystereo) {
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 5, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 5, 0);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 5, 0);
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 5, 1);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 5, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 5, 1);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 5, 1);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 5, 1);
     }
     if (channels >= 6) {
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 6, 1);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 6, 1);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 6, 1);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 6, 1);
     if (!onlystereo) {
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 6, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 6, 0);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 6, 0);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 6, 0);
     }
     }
     if (channels >= 7 && !onlystereo) {
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 7, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 7, 0);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 7, 0);
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 7, 1);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 7, 0);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 7, 1);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 7, 1);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 7, 1);
     }
     if (channels >= 8) {
-    ch->fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 8, 1);
+    fmtlist[i++] = SND_FORMAT(AFMT_S16_LE, 8, 1);
     if (ch->bit32)
-        ch->fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 8, 1);
+        fmtlist[i++] = SND_FORMAT(AFMT_S32_LE, 8, 1);
     }
     }
 
-    ch->fmtlist[i] = 0;
-    i = 0;
+    fmtlist[i++] = 0;
+
+    /* keep only the entries in use */
+
+    ch->caps.fmtlist = arena_carve(&codec->arena, i * sizeof(UINT32),
+                                   sizeof(UINT32));
+    if (ch->caps.fmtlist == NULL) {
+    HDA_DBG(HDA_DBG_ERR, "no memory for the format list\n");
+    ch->caps.fmtlist = hda_fmt_none;
+    } else
+        memcpy (ch->caps.fmtlist, fmtlist, i * sizeof(UINT32));
         
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_8KHZ(pcmcap))
-        ch->pcmrates[i++] = 8000;
+        ch->pcmrates |= HDA_PCM_RATE_8K;
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_11KHZ(pcmcap))
-        ch->pcmrates[i++] = 11025;
+        ch->pcmrates |= HDA_PCM_RATE_11K;
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_16KHZ(pcmcap))
-        ch->pcmrates[i++] = 16000;
+        ch->pcmrates |= HDA_PCM_RATE_16K;
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_22KHZ(pcmcap))
-        ch->pcmrates[i++] = 22050;
+        ch->pcmrates |= HDA_PCM_RATE_22K;
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_32KHZ(pcmcap))
-        ch->pcmrates[i++] = 32000;
+        ch->pcmrates |= HDA_PCM_RATE_32K;
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_44KHZ(pcmcap))
-        ch->pcmrates[i++] = 44100;
-
-    ch->pcmrates[i++] = 48000;
-
+        ch->pcmrates |= HDA_PCM_RATE_44K;
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_88KHZ(pcmcap))
-        ch->pcmrates[i++] = 88200;
+        ch->pcmrates |= HDA_PCM_RATE_88K;
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_96KHZ(pcmcap))
-        ch->pcmrates[i++] = 96000;
+        ch->pcmrates |= HDA_PCM_RATE_96K;
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_176KHZ(pcmcap))
-        ch->pcmrates[i++] = 176400;
+        ch->pcmrates |= HDA_PCM_RATE_176K;
     if (HDA_PARAM_SUPP_PCM_SIZE_RATE_192KHZ(pcmcap))
-        ch->pcmrates[i++] = 192000;
+        ch->pcmrates |= HDA_PCM_RATE_192K;
 
-    ch->pcmrates[i] = 0;
-    if (i > 0) {
-    ch->caps.minspeed = ch->pcmrates[0];
-    ch->caps.maxspeed = ch->pcmrates[i - 1];
-    }
+    ch->caps.minspeed = hda_pcm_rates[ffsLsb(ch->pcmrates) - 1];
+    ch->caps.maxspeed = hda_pcm_rates[ffsMsb(ch->pcmrates) - 1];
     }
 
     return (ret);
@@ -4223,7 +6476,8 @@ LOCAL void prepare_pcms(HDCODEC_ID codec)
 
     codec->num_devs = max(ardev, apdev) + max(drdev, dpdev);
 
-    codec->pcm_dev_table = (PCM_DEVINFO *)calloc(codec->num_devs, sizeof(PCM_DEVINFO));
+    codec->pcm_dev_table = (PCM_DEVINFO *)arena_alloc(&codec->arena,
+                                     codec->num_devs * sizeof(PCM_DEVINFO));
 #ifdef  HDA_DBG_ON
     global_pcmdev = codec->pcm_dev_table;
 #endif
@@ -4371,59 +6625,272 @@ LOCAL void delete_pcms(HDCODEC_ID codec)
 LOCAL void audio_bind_as(HDCODEC_ID codec)
     {
     ASSOC *as = codec->assoc_table;
+    CHAN *chans;
     int i, j, cnt = 0, free;
 
     for (j = 0; j < codec->ascnt; j++) {
     if (as[j].enable)
         cnt += as[j].num_chans;
     }
-    if (codec->num_hdaa_chans == 0) {
-    codec->hdaa_chan_table = (CHAN *)calloc(cnt, sizeof(CHAN));
-    if (codec->hdaa_chan_table == NULL) {
-    HDA_DBG(HDA_DBG_ERR, 
-            "Channels memory allocation failed!\n");
-    return;
-    }
-    } else {
-    codec->hdaa_chan_table = (CHAN *)realloc(codec->hdaa_chan_table,
-                                                         sizeof(CHAN) * (codec->num_hdaa_chans + cnt));
-    if (codec->hdaa_chan_table == NULL) {
+    /* The arena cannot grow a table in place; copy it into a larger one. */
+    chans = (CHAN *)arena_alloc(&codec->arena,
+                                sizeof(CHAN) * (codec->num_hdaa_chans + cnt));
+    if (chans == NULL) {
     codec->num_hdaa_chans = 0;
+    codec->hdaa_chan_table = NULL;
     HDA_DBG(HDA_DBG_ERR, 
             "Channels memory allocation failed!\n");
     return;
     }
-    /* Fixup relative pointers after realloc */
-    for (j = 0; j < codec->num_hdaa_chans; j++)
-        codec->hdaa_chan_table[j].caps.fmtlist = codec->hdaa_chan_table[j].fmtlist;
-    }
+    if (codec->num_hdaa_chans != 0)
+        memcpy(chans, codec->hdaa_chan_table,
+               sizeof(CHAN) * codec->num_hdaa_chans);
+    codec->hdaa_chan_table = chans;
     free = codec->num_hdaa_chans;
     codec->num_hdaa_chans += cnt;
 
-    for (j = free; j < free + cnt; j++) {
-    codec->hdaa_chan_table[j].codec = codec;
-    codec->hdaa_chan_table[j].as = -1;
-    }
+    for (j = free; j < free + cnt; j++) {
+    codec->hdaa_chan_table[j].codec = codec;
+    codec->hdaa_chan_table[j].as = -1;
+    }
+
+    /* Assign associations in order of their numbers, */
+    for (j = 0; j < codec->ascnt; j++) {
+    if (as[j].enable == 0)
+        continue;
+    for (i = 0; i < as[j].num_chans; i++) {
+    codec->hdaa_chan_table[free].as = j;
+    codec->hdaa_chan_table[free].asindex = i;
+    codec->hdaa_chan_table[free].dir = as[j].dir;
+    pcmchannel_setup(&codec->hdaa_chan_table[free]);
+    as[j].chans[i] = free;
+    free++;
+    }
+    }
+    }
+
+/****************************************************************************
+ * Association trace cache
+ *
+ * The tracers below are depth first searches that backtrack for every
+ * sequence and every candidate converter, so a meshed codec makes them
+ * revisit the same nodes many times.  While audio_build_tree() runs, the
+ * converters each widget can reach are precomputed, so branches that
+ * cannot succeed are skipped, and a search that does not bind anything
+ * remembers its result per (nid, depth).
+ ****************************************************************************/
+
+#define TRACE_ROW(tr, map, n)   (&(tr)->map[(n) * (tr)->words])
+#define TRACE_BIT(row, n)       (((row)[(n) >> 5] >> ((n) & 31)) & 1)
+
+LOCAL void trace_free(HDCODEC_ID codec)
+    {
+    HDA_TRACE *tr = codec->trace;
+
+    if (tr == NULL)
+        return;
+
+    free (tr->dac_reach);
+    free (tr->adc_reach);
+    free (tr->memo);
+    free (tr);
+    codec->trace = NULL;
+    }
+
+/* OR the bitmap of widget <src> into widget <dst>, TRUE if it grew */
+
+LOCAL BOOL trace_row_merge(UINT32 *dst, const UINT32 *src, int words)
+    {
+    UINT32 v;
+    BOOL grew = FALSE;
+    int k;
+
+    for (k = 0; k < words; k++)
+        {
+        v = dst[k] | src[k];
+        if (v != dst[k])
+            {
+            dst[k] = v;
+            grew = TRUE;
+            }
+        }
+
+    return (grew);
+    }
+
+LOCAL void trace_init(HDCODEC_ID codec)
+    {
+    HDA_TRACE *tr;
+    WIDGET *w, *cw;
+    UINT32 *row;
+    BOOL grew;
+    int i, j, n, c;
+
+    trace_free(codec);
+
+    if (codec->rconn == NULL)
+        widget_rconn_build(codec);
+    if (codec->rconn == NULL)
+        return;
+
+    tr = calloc(1, sizeof(HDA_TRACE));
+    if (tr == NULL)
+        return;
+    codec->trace = tr;
+
+    tr->words = (codec->nodecnt + 31) / 32;
+    tr->dac_reach = calloc(codec->nodecnt * tr->words, sizeof(UINT32));
+    tr->adc_reach = calloc(codec->nodecnt * tr->words, sizeof(UINT32));
+    tr->memo = calloc(codec->nodecnt * (HDA_PARSE_MAXDEPTH + 1),
+                      sizeof(HDA_TRACE_MEMO));
+    if (tr->dac_reach == NULL || tr->adc_reach == NULL || tr->memo == NULL)
+        {
+        HDA_DBG(HDA_DBG_ERR, "codec %d: no memory for trace cache\n",
+                codec->cad);
+        trace_free(codec);
+        return;
+        }
+
+    /* converters reach themselves */
+
+    for (n = 0; n < codec->nodecnt; n++)
+        {
+        w = widget_get(codec, codec->startnode + n);
+        if (w == NULL || w->enable == 0)
+            continue;
+        if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_OUTPUT)
+            TRACE_ROW(tr, dac_reach, n)[n >> 5] |= 1U << (n & 31);
+        else if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_INPUT)
+            TRACE_ROW(tr, adc_reach, n)[n >> 5] |= 1U << (n & 31);
+        }
+
+    /*
+     * Spread them along the enabled connections until nothing changes.
+     * The tracers stop at pins and at the converter of the other
+     * direction, and audio_trace_adc() only looks at consumers below
+     * endnode, so the propagation does the same.
+     */
+
+    do
+        {
+        grew = FALSE;
+        for (n = 0; n < codec->nodecnt; n++)
+            {
+            w = widget_get(codec, codec->startnode + n);
+            if (w == NULL || w->enable == 0 ||
+                w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX)
+                continue;
+
+            if (w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_OUTPUT &&
+                w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_INPUT)
+                {
+                row = TRACE_ROW(tr, dac_reach, n);
+                for (j = 0; j < w->nconns; j++)
+                    {
+                    c = w->conns[j] - codec->startnode;
+                    if (!HDA_CONN_ENABLED(w, j) ||
+                        c < 0 || c >= codec->nodecnt)
+                        continue;
+                    if (trace_row_merge(row, TRACE_ROW(tr, dac_reach, c),
+                                        tr->words))
+                        grew = TRUE;
+                    }
+                }
+
+            if (w->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_INPUT)
+                {
+                row = TRACE_ROW(tr, adc_reach, n);
+                for (i = codec->rconn_start[n];
+                     i < codec->rconn_start[n + 1]; i++)
+                    {
+                    cw = widget_get(codec, codec->rconn[i].nid);
+                    if (cw == NULL || cw->enable == 0 ||
+                        cw->nid >= codec->endnode ||
+                        !HDA_CONN_ENABLED(cw, codec->rconn[i].index))
+                        continue;
+                    c = cw->nid - codec->startnode;
+                    if (trace_row_merge(row, TRACE_ROW(tr, adc_reach, c),
+                                        tr->words))
+                        grew = TRUE;
+                    }
+                }
+            }
+        } while (grew);
+    }
+
+/*
+ * Can a search continuing at <nid> end at a DAC (<dir> CTL_OUT) or an ADC
+ * (CTL_IN), or at converter <only> when it is set?  Without the cache
+ * every branch is worth a try.
+ */
+
+LOCAL BOOL trace_reach(HDCODEC_ID codec, int dir, nid_t nid, nid_t only)
+    {
+    HDA_TRACE *tr = codec->trace;
+    UINT32 *row;
+    int n = nid - codec->startnode;
+    int k;
+
+    if (tr == NULL || n < 0 || n >= codec->nodecnt)
+        return (TRUE);
+
+    if (dir == CTL_OUT)
+        row = TRACE_ROW(tr, dac_reach, n);
+    else
+        row = TRACE_ROW(tr, adc_reach, n);
+
+    if (only != 0)
+        {
+        only -= codec->startnode;
+        if (only < 0 || only >= codec->nodecnt)
+            return (TRUE);
+        return (TRACE_BIT(row, only) != 0);
+        }
+
+    for (k = 0; k < tr->words; k++)
+        {
+        if (row[k] != 0)
+            return (TRUE);
+        }
+
+    return (FALSE);
+    }
+
+/*
+ * Memo slot of a search step.  Only searches that do not bind (<only> 0)
+ * are cached, and each one starting at depth 0 opens a new generation.
+ */
+
+LOCAL HDA_TRACE_MEMO* trace_memo(HDCODEC_ID codec, nid_t nid, int only,
+                                 int depth)
+    {
+    HDA_TRACE *tr = codec->trace;
+    int n = nid - codec->startnode;
+
+    if (tr == NULL || only != 0)
+        return (NULL);
+
+    if (depth == 0)
+        tr->gen++;
 
-    /* Assign associations in order of their numbers, */
-    for (j = 0; j < codec->ascnt; j++) {
-    if (as[j].enable == 0)
-        continue;
-    for (i = 0; i < as[j].num_chans; i++) {
-    codec->hdaa_chan_table[free].as = j;
-    codec->hdaa_chan_table[free].asindex = i;
-    codec->hdaa_chan_table[free].dir = as[j].dir;
-    pcmchannel_setup(&codec->hdaa_chan_table[free]);
-    as[j].chans[i] = free;
-    free++;
-    }
-    }
+    if (depth > HDA_PARSE_MAXDEPTH || n < 0 || n >= codec->nodecnt)
+        return (NULL);
+
+    return (&tr->memo[n * (HDA_PARSE_MAXDEPTH + 1) + depth]);
     }
 
+LOCAL nid_t audio_trace_adc
+    (
+    HDCODEC_ID codec,
+    int as, int seq, nid_t nid,
+    int mixed, int min, int only,
+    int depth, int *length, int onlylength
+    );
+
 /*
  * Trace path from widget to ADC.
  */
-LOCAL nid_t audio_trace_adc
+LOCAL nid_t trace_adc_node
     (
     HDCODEC_ID codec,
     int as, int seq, nid_t nid,
@@ -4432,7 +6899,7 @@ LOCAL nid_t audio_trace_adc
     )
     {
     WIDGET *w, *wc;
-    int i, j, im, lm = HDA_PARSE_MAXDEPTH;
+    int i, j, k, end, im, lm = HDA_PARSE_MAXDEPTH;
     nid_t m = 0, ret;
 
     if (depth > HDA_PARSE_MAXDEPTH)
@@ -4471,16 +6938,26 @@ LOCAL nid_t audio_trace_adc
             break;
         /* Fall */
     default:
-        /* Try to find reachable ADCs with specified nid. */
-        for (j = codec->startnode; j < codec->endnode; j++) {
+        /*
+         * Try to find reachable ADCs with specified nid.  The consumers
+         * come from the reverse connection index, in nid order.
+         */
+        if (codec->rconn == NULL ||
+            nid < codec->startnode || nid > codec->endnode)
+            break;
+        k = codec->rconn_start[nid - codec->startnode];
+        end = codec->rconn_start[nid - codec->startnode + 1];
+        while (k < end) {
+        j = codec->rconn[k].nid;
         wc = widget_get(codec, j);
-        if (wc == NULL || wc->enable == 0)
-            continue;
         im = -1;
-        for (i = 0; i < wc->nconns; i++) {
-        if (wc->connsenable[i] == 0)
+        for (; k < end && codec->rconn[k].nid == j; k++) {
+        i = codec->rconn[k].index;
+        if (wc == NULL || wc->enable == 0 || j >= codec->endnode)
+            continue;
+        if (!HDA_CONN_ENABLED(wc, i))
             continue;
-        if (wc->conns[i] != nid)
+        if (!trace_reach(codec, CTL_IN, j, only))
             continue;
         if ((ret = audio_trace_adc(codec, as, seq,
                                         j, mixed, min, only, depth + 1,
@@ -4496,6 +6973,10 @@ LOCAL nid_t audio_trace_adc
             break;
         }
         }
+        while (k < end && codec->rconn[k].nid == j)
+            k++;
+        if (wc == NULL)
+            continue;
         if (im >= 0 && only && ((wc->nconns > 1 &&
                                  wc->type != HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_MIXER) ||
                                 wc->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_SELECTOR))
@@ -4513,10 +6994,42 @@ LOCAL nid_t audio_trace_adc
     return (m);
     }
 
+LOCAL nid_t audio_trace_adc
+    (
+    HDCODEC_ID codec,
+    int as, int seq, nid_t nid,
+    int mixed, int min, int only,
+    int depth, int *length, int onlylength
+    )
+    {
+    HDA_TRACE_MEMO *memo;
+    nid_t ret;
+
+    memo = trace_memo(codec, nid, only, depth);
+    if (memo != NULL && memo->gen == codec->trace->gen)
+        {
+        if (memo->ret != 0 && length != NULL)
+            *length = memo->length;
+        return (memo->ret);
+        }
+
+    ret = trace_adc_node(codec, as, seq, nid, mixed, min, only, depth,
+                         length, onlylength);
+
+    if (memo != NULL)
+        {
+        memo->gen = codec->trace->gen;
+        memo->ret = ret;
+        memo->length = (length != NULL) ? *length : 0;
+        }
+
+    return (ret);
+    }
+
 /*
  * Trace path from DAC to pin.
  */
-LOCAL nid_t audio_trace_dac
+LOCAL nid_t trace_dac_node
     (
     HDCODEC_ID codec,
     int as,
@@ -4591,10 +7104,12 @@ LOCAL nid_t audio_trace_dac
     default:
         /* Find reachable DACs with smallest nid respecting constraints. */
         for (i = 0; i < w->nconns; i++) {
-        if (w->connsenable[i] == 0)
+        if (!HDA_CONN_ENABLED(w, i))
             continue;
         if (w->selconn != -1 && w->selconn != i)
             continue;
+        if (!trace_reach(codec, CTL_OUT, w->conns[i], only))
+            continue;
         if ((ret = audio_trace_dac(codec, as, seq,
                                         w->conns[i], dupseq, min, only, depth + 1)) != 0) {
         if (m == 0 || ret < m) {
@@ -4623,6 +7138,36 @@ LOCAL nid_t audio_trace_dac
     return (m);
     }
 
+LOCAL nid_t audio_trace_dac
+    (
+    HDCODEC_ID codec,
+    int as,
+    int seq,
+    nid_t nid,
+    int dupseq,
+    int min,
+    int only,
+    int depth
+    )
+    {
+    HDA_TRACE_MEMO *memo;
+    nid_t ret;
+
+    memo = trace_memo(codec, nid, only, depth);
+    if (memo != NULL && memo->gen == codec->trace->gen)
+        return (memo->ret);
+
+    ret = trace_dac_node(codec, as, seq, nid, dupseq, min, only, depth);
+
+    if (memo != NULL)
+        {
+        memo->gen = codec->trace->gen;
+        memo->ret = ret;
+        }
+
+    return (ret);
+    }
+
 
 
 /*
@@ -4674,7 +7219,7 @@ LOCAL int audio_dacs_equal(WIDGET *w1, WIDGET *w2)
         continue;
     c1 = c2 = -1;
     for (j = 0; j < w3->nconns; j++) {
-    if (w3->connsenable[j] == 0)
+    if (!HDA_CONN_ENABLED(w3, j))
         continue;
     if (w3->conns[j] == w1->nid)
         c1 = j;
@@ -5132,6 +7677,8 @@ void audio_build_tree(HDCODEC_ID codec)
     ASSOC *as = codec->assoc_table;
     int j, res;
 
+    trace_init(codec);
+
     /* Trace all associations in order of their numbers. */
     for (j = 0; j < codec->ascnt; j++)
         {
@@ -5179,6 +7726,8 @@ void audio_build_tree(HDCODEC_ID codec)
             continue;
         audio_adddac(codec, j);
         }
+
+    trace_free(codec);
     }
 
 
@@ -5271,7 +7820,7 @@ LOCAL void audio_assign_mixers(HDCODEC_ID codec)
             {
             for (j = 0; j < w->nconns; j++)
                 {
-                if (!w->connsenable[j])
+                if (!HDA_CONN_ENABLED(w, j))
                     continue;
                 cw = widget_get(codec, w->conns[j]);
                 if (cw == NULL || cw->enable == 0)
@@ -5314,7 +7863,7 @@ LOCAL int audio_ctl_source_amp(HDCODEC_ID codec, nid_t nid, int index,
         {
         for (j = 0; j < w->nconns; j++)
             {
-            if (!w->connsenable[j])
+            if (!HDA_CONN_ENABLED(w, j))
                 continue;
             conns++;
             }
@@ -5384,7 +7933,7 @@ LOCAL int audio_ctl_source_amp(HDCODEC_ID codec, nid_t nid, int index,
             continue;
         for (j = 0; j < wc->nconns; j++)
             {
-            if (wc->connsenable[j] && wc->conns[j] == nid)
+            if (HDA_CONN_ENABLED(wc, j) && wc->conns[j] == nid)
                 {
                 tminamp = tmaxamp = 0;
                 found += audio_ctl_source_amp(codec,
@@ -5441,7 +7990,7 @@ LOCAL int audio_ctl_dest_amp(HDCODEC_ID codec, nid_t nid, int index,
                 continue;
             for (j = 0; j < wc->nconns; j++)
                 {
-                if (wc->connsenable[j] && wc->conns[j] == nid)
+                if (HDA_CONN_ENABLED(wc, j) && wc->conns[j] == nid)
                     consumers++;
                 }
             }
@@ -5478,7 +8027,7 @@ LOCAL int audio_ctl_dest_amp(HDCODEC_ID codec, nid_t nid, int index,
     cminamp = cmaxamp = 0;
     for (i = 0; i < w->nconns; i++)
         {
-        if (w->connsenable[i] == 0)
+        if (!HDA_CONN_ENABLED(w, i))
             continue;
         if (index >= 0 && i != index)
             continue;
@@ -5668,24 +8217,30 @@ LOCAL void autorecsrc_handler(ASSOC *as, WIDGET *w)
     }
 
 /*
- * Jack presence detection event handler.
+ * Check whether a pin widget can report jack presence.
  */
-LOCAL void presence_handler(WIDGET *w)
+LOCAL BOOL presence_capable(WIDGET *w)
     {
-    HDCODEC_ID codec = w->codec;
-    ASSOC *as;
-    UINT32 res;
-    int connected;
-
     if (w->enable == 0 || w->type !=
         HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX)
-        return;
+        return (FALSE);
 
     if (HDA_PARAM_PIN_CAP_PRESENCE_DETECT_CAP(w->wclass.pin.cap) == 0 ||
         (HDA_CONFIG_DEFAULTCONF_MISC(w->wclass.pin.config) & 1) != 0)
-        return;
+        return (FALSE);
+
+    return (TRUE);
+    }
+
+/*
+ * Act on a pin sense value read from a presence capable pin.
+ */
+LOCAL void presence_update(WIDGET *w, UINT32 res)
+    {
+    HDCODEC_ID codec = w->codec;
+    ASSOC *as;
+    int connected;
 
-    res = hda_command(w->codec, HDA_CMD_GET_PIN_SENSE(0, w->nid));
     connected = (res & HDA_CMD_GET_PIN_SENSE_PRESENCE_DETECT) != 0;
 
     if (connected == w->wclass.pin.connected)
@@ -5703,6 +8258,35 @@ LOCAL void presence_handler(WIDGET *w)
         autorecsrc_handler(as, w);
     }
 
+/*
+ * Jack presence detection event handler.
+ */
+LOCAL void presence_handler(WIDGET *w)
+    {
+    UINT32 res;
+
+    if (!presence_capable(w))
+        return;
+
+    res = hda_command(w->codec, HDA_CMD_GET_PIN_SENSE(0, w->nid));
+
+    presence_update(w, res);
+    }
+
+/*
+ * Read the pin sense of a group of pins with one batch.
+ */
+LOCAL void sense_batch(HDCODEC_ID codec, WIDGET **pins, UINT32 *verbs, int n)
+    {
+    UINT32 res[HDA_COMMIT_BATCH_MAX];
+    int i;
+
+    hda_command_batch(codec, verbs, res, n);
+
+    for (i = 0; i < n; i++)
+        presence_update(pins[i], res[i]);
+    }
+
 /*
  * Pin sense initializer.
  */
@@ -5710,8 +8294,12 @@ LOCAL void sense_init(HDCODEC_ID codec)
     {
     ASSOC *as = codec->assoc_table;
     WIDGET *w;
-    int i, poll = 0;
+    WIDGET *pins[HDA_COMMIT_BATCH_MAX];
+    UINT32 verbs[HDA_COMMIT_BATCH_MAX];
+    int i, n, poll = 0;
 
+    /* Enable unsolicited responses on all capable pins. */
+    n = 0;
     for (i = codec->startnode; i < codec->endnode; i++)
         {
         w = widget_get(codec, i);
@@ -5721,20 +8309,23 @@ LOCAL void sense_init(HDCODEC_ID codec)
         if (HDA_PARAM_AUDIO_WIDGET_CAP_UNSOL_CAP(w->param.widget_cap) &&
             w->unsol < 0)
             {
+            if (n == HDA_COMMIT_BATCH_MAX)
+                {
+                hda_command_batch(codec, verbs, NULL, n);
+                n = 0;
+                }
             w->unsol = hdacc_unsol_alloc(codec->pDev, codec, w->nid);
-            hda_command(codec,
-                        HDA_CMD_SET_UNSOLICITED_RESPONSE(0, w->nid,
-                                                         HDA_CMD_SET_UNSOLICITED_RESPONSE_ENABLE | w->unsol));
+            verbs[n++] = HDA_CMD_SET_UNSOLICITED_RESPONSE(0, w->nid,
+                                                          HDA_CMD_SET_UNSOLICITED_RESPONSE_ENABLE | w->unsol);
             }
         as = &codec->assoc_table[w->bindas];
         if (as->hpredir >= 0 && as->pins[15] == w->nid)
             {
-            if (HDA_PARAM_PIN_CAP_PRESENCE_DETECT_CAP(w->wclass.pin.cap) == 0 ||
-                (HDA_CONFIG_DEFAULTCONF_MISC(w->wclass.pin.config) & 1) != 0)
+            if (!presence_capable(w))
                 {
                 HDA_DBG(HDA_DBG_INFO, 
                         "No presence detection support at nid %d\n",
-                        as[i].pins[15]);
+                        as->pins[15]);
                 }
             else
                 {
@@ -5755,13 +8346,29 @@ LOCAL void sense_init(HDCODEC_ID codec)
 
                 };
             }
+        }
 
-        presence_handler(w);
+    if (n > 0)
+        hda_command_batch(codec, verbs, NULL, n);
 
-        if (!HDA_PARAM_PIN_CAP_DP(w->wclass.pin.cap) &&
-            !HDA_PARAM_PIN_CAP_HDMI(w->wclass.pin.cap))
+    /* Read the initial jack state of all presence capable pins. */
+    n = 0;
+    for (i = codec->startnode; i < codec->endnode; i++)
+        {
+        w = widget_get(codec, i);
+        if (w == NULL || !presence_capable(w))
             continue;
+        pins[n] = w;
+        verbs[n++] = HDA_CMD_GET_PIN_SENSE(0, w->nid);
+        if (n == HDA_COMMIT_BATCH_MAX)
+            {
+            sense_batch(codec, pins, verbs, n);
+            n = 0;
+            }
         }
+
+    if (n > 0)
+        sense_batch(codec, pins, verbs, n);
 #if 0
     if (poll)
         {
@@ -5889,27 +8496,41 @@ LOCAL void audio_ctl_commit(HDCODEC_ID codec)
 LOCAL void audio_commit(HDCODEC_ID codec)
     {
     WIDGET *w;
-    int i;
+    UINT32 verbs[HDA_COMMIT_BATCH_MAX];
+    int i, n;
 
     /* Commit controls. */
     audio_ctl_commit(codec);
 
-    /* Commit selectors, pins and EAPD. */
+    /* Commit selectors, pins and EAPD, flushing the batch as it fills. */
+    n = 0;
     for (i = 0; i < codec->nodecnt; i++)
         {
         w = vxbHdAudioWidgetNum (codec, i);
         if (w == NULL)
             continue;
+        if (n > HDA_COMMIT_BATCH_MAX - 3)
+            {
+            hda_command_batch(codec, verbs, NULL, n);
+            n = 0;
+            }
         if (w->selconn == -1)
+            {
             w->selconn = 0;
-        if (w->nconns > 0)
-            widget_connection_select(w, w->selconn);
+            codec->mix_gen++;
+            }
+        if (w->nconns > 0 && w->selconn < w->nconns)
+            {
+            HDA_DBG(HDA_DBG_INFO, "Setting selector nid=%d index=%d\n",
+                    w->nid, w->selconn);
+            verbs[n++] = HDA_CMD_SET_CONNECTION_SELECT_CONTROL(0, w->nid,
+                                                               w->selconn);
+            }
         if (w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX ||
             w->waspin)
             {
-            hda_command(codec,
-                        HDA_CMD_SET_PIN_WIDGET_CTRL(0, w->nid,
-                                                    w->wclass.pin.ctrl));
+            verbs[n++] = HDA_CMD_SET_PIN_WIDGET_CTRL(0, w->nid,
+                                                     w->wclass.pin.ctrl);
             }
         if (w->param.eapdbtl != HDA_INVALID)
             {
@@ -5917,11 +8538,12 @@ LOCAL void audio_commit(HDCODEC_ID codec)
 
             val = w->param.eapdbtl;
 
-            hda_command(codec,
-                        HDA_CMD_SET_EAPD_BTL_ENABLE(0, w->nid,
-                                                    val));
+            verbs[n++] = HDA_CMD_SET_EAPD_BTL_ENABLE(0, w->nid, val);
             }
         }
+
+    if (n > 0)
+        hda_command_batch(codec, verbs, NULL, n);
     }
 
 LOCAL void powerup(HDCODEC_ID codec)
@@ -6053,6 +8675,8 @@ LOCAL void
             widget_parse(w);
             }
         }
+
+    widget_rconn_build(codec);
     }
 
 /*
@@ -6075,7 +8699,7 @@ LOCAL UINT32 audio_ctl_recsel_comm(PCM_DEVINFO *pdevinfo, UINT32 src, nid_t nid,
 
     for (i = 0; i < w->nconns; i++)
         {
-        if (w->connsenable[i] == 0)
+        if (!HDA_CONN_ENABLED(w, i))
             continue;
         cw = widget_get(codec, w->conns[i]);
         if (cw == NULL || cw->enable == 0 || cw->bindas == -1)
@@ -6135,21 +8759,44 @@ LOCAL UINT32 audio_ctl_recsel_comm(PCM_DEVINFO *pdevinfo, UINT32 src, nid_t nid,
 LOCAL void audio_ctl_dev_set(AUDIO_CTL *ctl, int ossdev,
                                   int mute, int *left, int *right)
     {
+    HDA_CTL_DEV *d, *slot = NULL;
     int i, zleft, zright, sleft, sright, smute, lval, rval;
 
-    ctl->devleft[ossdev] = *left;
-    ctl->devright[ossdev] = *right;
-    ctl->devmute[ossdev] = mute;
+    /* the slot of ossdev, else one that contributes nothing */
+
+    for (i = 0; i < HDA_CTL_DEVS_MAX; i++)
+        {
+        d = &ctl->dev[i];
+        if (d->dev == ossdev)
+            {
+            slot = d;
+            break;
+            }
+        if (slot == NULL && d->left == 0 && d->right == 0 && d->mute == 0)
+            slot = d;
+        }
+    if (slot != NULL)
+        {
+        slot->dev = ossdev;
+        slot->mute = mute;
+        slot->left = *left;
+        slot->right = *right;
+        }
+    else
+        HDA_DBG(HDA_DBG_ERR, "nid=%d: no slot for ossdev %d\n",
+                ctl->widget->nid, ossdev);
+
     smute = sleft = sright = zleft = zright = 0;
-    for (i = 0; i < SOUND_MIXER_NRDEVICES; i++)
+    for (i = 0; i < HDA_CTL_DEVS_MAX; i++)
         {
-        sleft += ctl->devleft[i];
-        sright += ctl->devright[i];
-        smute |= ctl->devmute[i];
-        if (i == ossdev)
+        d = &ctl->dev[i];
+        sleft += d->left;
+        sright += d->right;
+        smute |= d->mute;
+        if (d == slot)
             continue;
-        zleft += ctl->devleft[i];
-        zright += ctl->devright[i];
+        zleft += d->left;
+        zright += d->right;
         }
     lval = QDB2VAL(ctl, sleft);
     rval = QDB2VAL(ctl, sright);
@@ -6159,13 +8806,41 @@ LOCAL void audio_ctl_dev_set(AUDIO_CTL *ctl, int ossdev,
     }
 
 /*
- * Trace signal from source, setting volumes on the way.
+ * Append a step for <ctl> to a mixer plan.  The step is fed by *parent
+ * and becomes the parent of whatever follows it on the signal path.
+ */
+LOCAL void mix_plan_add(HDA_MIX_PLAN *plan, AUDIO_CTL *ctl, int *parent)
+    {
+    HDA_MIX_STEP *steps;
+    int size;
+
+    if (plan->nsteps == plan->size)
+        {
+        size = (plan->size == 0) ? 8 : plan->size * 2;
+        steps = realloc(plan->steps, size * sizeof(HDA_MIX_STEP));
+        if (steps == NULL)
+            {
+            plan->valid = FALSE;
+            return;
+            }
+        plan->steps = steps;
+        plan->size = size;
+        }
+
+    plan->steps[plan->nsteps].ctl = ctl;
+    plan->steps[plan->nsteps].parent = *parent;
+    *parent = plan->nsteps++;
+    }
+
+/*
+ * Trace signal from source, collecting the controls on the way.
  */
-LOCAL void audio_ctl_source_volume
+LOCAL void mix_plan_source
     (
     PCM_DEVINFO *pdevinfo,
-    int ossdev, nid_t nid, int index,
-    int mute, int left, int right, int depth
+    HDA_MIX_PLAN *plan,
+    nid_t nid, int index,
+    int parent, int depth
     )
     {
     HDCODEC_ID codec = pdevinfo->codec;
@@ -6185,7 +8860,7 @@ LOCAL void audio_ctl_source_volume
         {
         for (j = 0; j < w->nconns; j++)
             {
-            if (!w->connsenable[j])
+            if (!HDA_CONN_ENABLED(w, j))
                 continue;
             conns++;
             }
@@ -6199,7 +8874,7 @@ LOCAL void audio_ctl_source_volume
         ctl = audio_ctl_amp_get(codec, w->nid, CTL_IN,
                                      index, 1);
         if (ctl)
-            audio_ctl_dev_set(ctl, ossdev, mute, &left, &right);
+            mix_plan_add(plan, ctl, &parent);
         }
 
     /* If widget has own ossdev - not traverse it.
@@ -6224,37 +8899,35 @@ LOCAL void audio_ctl_source_volume
 
     ctl = audio_ctl_amp_get(codec, w->nid, CTL_OUT, -1, 1);
     if (ctl)
-        audio_ctl_dev_set(ctl, ossdev, mute, &left, &right);
+        mix_plan_add(plan, ctl, &parent);
 
-    for (i = codec->startnode; i < codec->endnode; i++)
+    if (codec->rconn == NULL || nid > codec->endnode)
+        return;
+
+    i = nid - codec->startnode;
+    for (j = codec->rconn_start[i]; j < codec->rconn_start[i + 1]; j++)
         {
-        wc = widget_get(codec, i);
-        if (wc == NULL || wc->enable == 0)
+        wc = widget_get(codec, codec->rconn[j].nid);
+        if (wc == NULL || wc->enable == 0 || wc->nid >= codec->endnode)
             continue;
-        for (j = 0; j < wc->nconns; j++)
+        if (HDA_CONN_ENABLED(wc, codec->rconn[j].index))
             {
-            if (wc->connsenable[j] && wc->conns[j] == nid)
-                {
-                audio_ctl_source_volume(pdevinfo, ossdev,
-                                             wc->nid, j, mute, left, right, depth + 1);
-                }
+            mix_plan_source(pdevinfo, plan, wc->nid,
+                            codec->rconn[j].index, parent, depth + 1);
             }
         }
-    return;
     }
 
 /*
- * Trace signal from destination, setting volumes on the way.
+ * Trace signal from destination, collecting the controls on the way.
  */
-LOCAL void audio_ctl_dest_volume
+LOCAL void mix_plan_dest
     (
     PCM_DEVINFO *pdevinfo,
-    int ossdev,
+    HDA_MIX_PLAN *plan,
     nid_t nid,
     int index,
-    int mute,
-    int left,
-    int right,
+    int parent,
     int depth
     )
     {
@@ -6262,7 +8935,7 @@ LOCAL void audio_ctl_dest_volume
     ASSOC *as = codec->assoc_table;
     WIDGET *w, *wc;
     AUDIO_CTL *ctl;
-    int i, j, consumers, cleft, cright;
+    int i, consumers, cparent;
 
     if (depth > HDA_PARSE_MAXDEPTH)
         return;
@@ -6276,14 +8949,16 @@ LOCAL void audio_ctl_dest_volume
         /* If this node produce output for several consumers,
            we can't touch it. */
         consumers = 0;
-        for (i = codec->startnode; i < codec->endnode; i++)
+        if (codec->rconn != NULL && nid <= codec->endnode)
             {
-            wc = widget_get(codec, i);
-            if (wc == NULL || wc->enable == 0)
-                continue;
-            for (j = 0; j < wc->nconns; j++)
+            i = codec->rconn_start[nid - codec->startnode];
+            for (; i < codec->rconn_start[nid - codec->startnode + 1]; i++)
                 {
-                if (wc->connsenable[j] && wc->conns[j] == nid)
+                wc = widget_get(codec, codec->rconn[i].nid);
+                if (wc == NULL || wc->enable == 0 ||
+                    wc->nid >= codec->endnode)
+                    continue;
+                if (HDA_CONN_ENABLED(wc, codec->rconn[i].index))
                     consumers++;
                 }
             }
@@ -6301,7 +8976,7 @@ LOCAL void audio_ctl_dest_volume
         ctl = audio_ctl_amp_get(codec, w->nid,
                                      CTL_OUT, -1, 1);
         if (ctl)
-            audio_ctl_dev_set(ctl, ossdev, mute, &left, &right);
+            mix_plan_add(plan, ctl, &parent);
         }
 
     /* We must not traverse pin */
@@ -6311,50 +8986,37 @@ LOCAL void audio_ctl_dest_volume
 
     for (i = 0; i < w->nconns; i++)
         {
-        if (w->connsenable[i] == 0)
+        if (!HDA_CONN_ENABLED(w, i))
             continue;
         if (index >= 0 && i != index)
             continue;
-        cleft = left;
-        cright = right;
+        cparent = parent;
         ctl = audio_ctl_amp_get(codec, w->nid,
                                      CTL_IN, i, 1);
         if (ctl)
-            audio_ctl_dev_set(ctl, ossdev, mute, &cleft, &cright);
-        audio_ctl_dest_volume(pdevinfo, ossdev, w->conns[i], -1,
-                                   mute, cleft, cright, depth + 1);
+            mix_plan_add(plan, ctl, &cparent);
+        mix_plan_dest(pdevinfo, plan, w->conns[i], -1, cparent, depth + 1);
         }
     }
 
 /*
- * Set volumes for the specified pdevinfo and ossdev.
+ * Collect the controls of the specified pdevinfo and ossdev, in the order
+ * the volume tracers used to visit them.
  */
-LOCAL void audio_ctl_dev_volume(PCM_DEVINFO *pdevinfo, unsigned dev)
+LOCAL void mix_plan_compile(PCM_DEVINFO *pdevinfo, unsigned dev)
     {
     HDCODEC_ID codec = pdevinfo->codec;
+    HDA_MIX_PLAN *plan = &pdevinfo->plan[dev];
     WIDGET *w, *cw;
-    UINT32 mute;
-    int lvol, rvol;
     int i, j;
 
-    mute = 0;
-    if (pdevinfo->left[dev] == 0)
-        {
-        mute |= HDAA_AMP_MUTE_LEFT;
-        lvol = -4000;
-        } else
-        lvol = ((pdevinfo->maxamp[dev] - pdevinfo->minamp[dev]) *
-                pdevinfo->left[dev] + 50) / 100 + pdevinfo->minamp[dev];
-    if (pdevinfo->right[dev] == 0)
-        {
-        mute |= HDAA_AMP_MUTE_RIGHT;
-        rvol = -4000;
-        } else
-        rvol = ((pdevinfo->maxamp[dev] - pdevinfo->minamp[dev]) *
-                pdevinfo->right[dev] + 50) / 100 + pdevinfo->minamp[dev];
-#ifdef HDA_DBG_ON
-    HDA_DBG(HDA_DBG_INFO, "audio_ctl_dev_volume(): lvol= x%x, rvol= x%x\n", lvol, rvol);
-#endif
+    if (codec->rconn == NULL)
+        widget_rconn_build(codec);
+
+    plan->nsteps = 0;
+    plan->valid = TRUE;
+    plan->gen = codec->mix_gen;
+
     for (i = codec->startnode; i < codec->endnode; i++)
         {
         w = widget_get(codec, i);
@@ -6368,16 +9030,14 @@ LOCAL void audio_ctl_dev_volume(PCM_DEVINFO *pdevinfo, unsigned dev)
         if (dev == SOUND_MIXER_RECLEV &&
             w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_INPUT)
             {
-            audio_ctl_dest_volume(pdevinfo, dev,
-                                       w->nid, -1, mute, lvol, rvol, 0);
+            mix_plan_dest(pdevinfo, plan, w->nid, -1, -1, 0);
             continue;
             }
         if (dev == SOUND_MIXER_VOLUME &&
             w->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX &&
             codec->assoc_table[w->bindas].dir == CTL_OUT)
             {
-            audio_ctl_dest_volume(pdevinfo, dev,
-                                       w->nid, -1, mute, lvol, rvol, 0);
+            mix_plan_dest(pdevinfo, plan, w->nid, -1, -1, 0);
             continue;
             }
         if (dev == SOUND_MIXER_IGAIN &&
@@ -6385,7 +9045,7 @@ LOCAL void audio_ctl_dev_volume(PCM_DEVINFO *pdevinfo, unsigned dev)
             {
             for (j = 0; j < w->nconns; j++)
                 {
-                if (!w->connsenable[j])
+                if (!HDA_CONN_ENABLED(w, j))
                     continue;
                 cw = widget_get(codec, w->conns[j]);
                 if (cw == NULL || cw->enable == 0)
@@ -6395,18 +9055,97 @@ LOCAL void audio_ctl_dev_volume(PCM_DEVINFO *pdevinfo, unsigned dev)
                 if (cw->bindas >= 0 &&
                     codec->assoc_table[cw->bindas].dir != CTL_IN)
                     continue;
-                audio_ctl_dest_volume(pdevinfo, dev,
-                                           w->nid, j, mute, lvol, rvol, 0);
+                mix_plan_dest(pdevinfo, plan, w->nid, j, -1, 0);
                 }
             continue;
             }
         if (w->ossdev != dev)
             continue;
-        audio_ctl_source_volume(pdevinfo, dev,
-                                     w->nid, -1, mute, lvol, rvol, 0);
+        mix_plan_source(pdevinfo, plan, w->nid, -1, -1, 0);
         if (dev == SOUND_MIXER_IMIX && (w->pflags & HDAA_IMIX_AS_DST))
-            audio_ctl_dest_volume(pdevinfo, dev,
-                                       w->nid, -1, mute, lvol, rvol, 0);
+            mix_plan_dest(pdevinfo, plan, w->nid, -1, -1, 0);
+        }
+
+    if (!plan->valid)
+        HDA_DBG(HDA_DBG_ERR, "no memory for mixer plan of dev %d\n", dev);
+    }
+
+LOCAL void mix_plan_free(PCM_DEVINFO *pdevinfo)
+    {
+    int dev;
+
+    for (dev = 0; dev < SOUND_MIXER_NRDEVICES; dev++)
+        {
+        free (pdevinfo->plan[dev].steps);
+        memset (&pdevinfo->plan[dev], 0, sizeof(HDA_MIX_PLAN));
+        }
+    }
+
+/*
+ * Compile the mixer plans of every OSS device of the codec, once the
+ * controls, OSS device assignment and selector positions are settled.
+ */
+LOCAL void audio_ctl_plan_build(HDCODEC_ID codec)
+    {
+    int i, dev;
+
+    for (i = 0; i < codec->num_devs; i++)
+        {
+        for (dev = 0; dev < SOUND_MIXER_NRDEVICES; dev++)
+            mix_plan_compile(&codec->pcm_dev_table[i], dev);
+        }
+    }
+
+/*
+ * Set volumes for the specified pdevinfo and ossdev.
+ */
+LOCAL void audio_ctl_dev_volume(PCM_DEVINFO *pdevinfo, unsigned dev)
+    {
+    HDCODEC_ID codec = pdevinfo->codec;
+    HDA_MIX_PLAN *plan = &pdevinfo->plan[dev];
+    HDA_MIX_STEP *step;
+    UINT32 mute;
+    int lvol, rvol;
+    int i;
+
+    mute = 0;
+    if (pdevinfo->left[dev] == 0)
+        {
+        mute |= HDAA_AMP_MUTE_LEFT;
+        lvol = -4000;
+        } else
+        lvol = ((pdevinfo->maxamp[dev] - pdevinfo->minamp[dev]) *
+                pdevinfo->left[dev] + 50) / 100 + pdevinfo->minamp[dev];
+    if (pdevinfo->right[dev] == 0)
+        {
+        mute |= HDAA_AMP_MUTE_RIGHT;
+        rvol = -4000;
+        } else
+        rvol = ((pdevinfo->maxamp[dev] - pdevinfo->minamp[dev]) *
+                pdevinfo->right[dev] + 50) / 100 + pdevinfo->minamp[dev];
+#ifdef HDA_DBG_ON
+    HDA_DBG(HDA_DBG_INFO, "audio_ctl_dev_volume(): lvol= x%x, rvol= x%x\n", lvol, rvol);
+#endif
+
+    if (!plan->valid || plan->gen != codec->mix_gen)
+        mix_plan_compile(pdevinfo, dev);
+
+    /* parents come first, so one sweep carries the remainders down */
+
+    for (i = 0; i < plan->nsteps; i++)
+        {
+        step = &plan->steps[i];
+        if (step->parent < 0)
+            {
+            step->left = lvol;
+            step->right = rvol;
+            }
+        else
+            {
+            step->left = plan->steps[step->parent].left;
+            step->right = plan->steps[step->parent].right;
+            }
+        audio_ctl_dev_set(step->ctl, dev, mute, &step->left, &step->right);
         }
     }
 
@@ -6424,5 +9163,6 @@ void vxbHdAudioSetPinCtrl (HDA_DRV_CTRL* pDrvCtrl, cad_t cad, nid_t nid, int val
 #ifdef  HDA_DBG_ON
 #include "vxbHdAudioShow.inc"
 #include "vxbHdAudioDebug.inc"
+#include "vxbHdAudioBench.inc"
 #endif
 